@@ -0,0 +1,34 @@
+#include "backoff.hh"
+#include <random>
+
+// jitter source for reconnect delays
+static std::random_device RNG;
+static std::mt19937 Rand(RNG());
+
+/**
+ * Reserve a reconnect, waiting for the budget to refill when it is used up
+ * @return {long} ms to wait until the reserved reconnect may start
+ */
+long cda::ReconnectBudget::reserve() {
+  if (rate <= 0) return 0;
+  const io::TimeStamp now = io::Clock::now();
+  const double elapsed = std::chrono::duration<double>(now - refilled).count();
+  tokens = std::min<double>(burst, tokens + elapsed * rate);
+  refilled = now;
+  tokens -= 1;
+  return tokens >= 0 ? 0 : (long)std::ceil(-tokens * 1000 / rate);
+}
+
+/**
+ * Get the delay of the next reconnect
+ * @return {long} ms to wait before reconnecting
+ */
+long cda::ReconnectPolicy::next() {
+  const long low = base;
+  const long high = std::max(base, std::min(cap, (last > 0 ? last : base) * 3));
+  std::uniform_int_distribution<long> jitter(low, high);
+  last = std::min(cap, jitter(Rand));
+  attempts++;
+  const long wait = budget != nullptr ? budget->reserve() : 0;
+  return std::max(last, wait);
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include "rest.hh"
+
+namespace cda {
+
+  class ReconnectBudget {
+  /**
+   * Reconnects shared by many shards. A burst of shards may reconnect
+   * at once, the rest are spread out at a fixed rate so an outage does
+   * not end with every shard hitting the gateway in the same second.
+   */
+  public:
+    io::uint burst = 8; // reconnects allowed at once
+    double rate = 2;    // reconnects per second after the burst (0 for no limit)
+
+    /**
+     * Reserve a reconnect
+     * @return {long} ms to wait until the reserved reconnect may start
+     */
+    long reserve();
+
+  private:
+    double tokens = burst; // reconnects left, negative ones are reserved
+    io::TimeStamp refilled = io::Clock::now();   // last refill
+  };
+
+  class ReconnectPolicy {
+  /**
+   * Delays between the reconnects of a shard: exponential backoff with
+   * decorrelated jitter, every delay is random between the base and
+   * three times the previous one, up to the cap. A successful session
+   * starts over from the base.
+   */
+  public:
+    long base = 1000; // ms of the shortest delay
+    long cap = 60000; // ms of the longest delay
+    io::uint attempts = 0; // reconnects since the last success
+    ReconnectBudget *budget = nullptr; // budget shared with other shards
+
+    /**
+     * Create the policy of a shard
+     * @param {ReconnectBudget} budget the shared budget (nullptr for none)
+     */
+    inline ReconnectPolicy(ReconnectBudget *budget = nullptr) :
+      budget(budget) {}
+
+    /**
+     * Get the delay of the next reconnect, including the wait for the
+     * shared budget
+     * @return {long} ms to wait before reconnecting
+     */
+    long next();
+
+    /**
+     * Start over after a successful session
+     */
+    inline void reset() {
+      attempts = 0;
+      last = 0;
+    }
+
+  private:
+    long last = 0; // previous delay in ms
+  };
+
+}
@@ -1,3 +1,3 @@
 #pragma once
 
-#include "client.hh"
+#include "cluster.hh"
\ No newline at end of file
@@ -1,5 +1,37 @@
 #include "client.hh"
 
+// ms of snapshot building per loop iteration
+#define SNAPSHOT_SLICE 2
+
+/**
+ * Write a cache snapshot, then schedule the next one. The image is
+ * built on the loop in slices and written to disk by the executor.
+ * @param {Client} client the client to snapshot
+ */
+static void SaveSnapshot(cda::Client *client) {
+  client->loop->later(client->snapshotInterval, [client](){
+    SaveSnapshot(client);
+  });
+  if (client->snapshotting.exchange(true)) return;
+  const io::uint gen = client->snapshotGen;
+  cda::SnapshotCallback save = [client, gen](io::Data &built){
+    std::shared_ptr<io::Data> image = std::make_shared<io::Data>(
+      std::move(built));
+    client->executor.post([client, image, gen](){
+      {
+        // handoff() wrote a newer one meanwhile
+        std::lock_guard<std::mutex> lock(client->snapshotMutex);
+        if (gen == client->snapshotGen &&
+          !cda::CacheSnapshot::write(*image, client->snapshotPath))
+          std::cerr << "[cda] Could not write cache snapshot "
+            << client->snapshotPath << std::endl;
+      }
+      client->snapshotting = false;
+    });
+  };
+  cda::CacheSnapshot::build(client, SNAPSHOT_SLICE, save);
+}
+
 int cda::Client::login(const std::string &_token) {
   token = _token;     // save the token internally
   api.token = _token; //  save token to api controller
@@ -8,23 +40,79 @@ int cda::Client::login(const std::string &_token) {
   cda::Client *self = this;
   api.get("/gateway/bot", {}, [self](io::json &resp) {
 
+    // read the session start limits
+    self->launcher.configure(resp);
+
     // get the amount of shards to use
     self->numShards = self->numShards > 0 ?
       self->numShards : resp["shards"].get<io::uint>();
-
-    // create shard connections
-    for (io::uint i = 0; i < self->numShards; i++) {
-      std::shared_ptr<cda::Gateway> shard = 
-        std::make_shared<cda::Gateway>(i, self->numShards, self);
-      self->shards.push_back(shard);
-    }
-
-    // Start the shard connections
-    std::string url = resp["url"];
-    for (auto shard : self->shards)
-      shard->start(url);
+    self->launch(resp["url"], self->numShards, 0, self->numShards);
   });
 
   // start the internal event loop
   return api.loop->run();
+}
+
+/**
+ * Stop the client without closing the gateway sessions
+ */
+void cda::Client::handoff() {
+  if (sessions.get() != nullptr)
+    sessions->flush();
+  if (!snapshotPath.empty()) {
+    // drop a snapshot still being built, this one is newer
+    snapshotGen++;
+    std::lock_guard<std::mutex> lock(snapshotMutex);
+    cda::CacheSnapshot::write(cda::CacheSnapshot::build(this), snapshotPath);
+  }
+  loop->quit();
+}
+
+/**
+ * Build the intents sent in IDENTIFY
+ * @return {uint32_t} the cda::Intent bits
+ */
+uint32_t cda::Client::intents() const {
+  uint32_t result = required;
+  for (unsigned int e = 0; e < Event::COUNT; e++) {
+    const Event::Type event = (Event::Type)e;
+    if (events.has(event))
+      result |= cda::EventIntents[e];
+    else if (event < cda::FIRST_RAW_EVENT && caches(event))
+      result |= cda::EventIntents[e] & ~cda::Intent::PRIVILEGED;
+  }
+  return result;
+}
+
+/**
+ * Start a range of shards on a known gateway url
+ * @param {string} url the gateway url
+ * @param {uint} total the amount of shards of the whole bot
+ * @param {uint} first the first shard id to run
+ * @param {uint} count the amount of shards to run
+ */
+void cda::Client::launch(const std::string &url,
+  io::uint total, io::uint first, io::uint count)
+{
+  // warm the cache and start writing snapshots
+  if (!snapshotPath.empty() && guilds.empty()) {
+    cda::CacheSnapshot::load(this, snapshotPath);
+    if (snapshotInterval > 0) SaveSnapshot(this);
+  }
+
+  // map the sessions left by a previous process
+  if (!sessionPath.empty() && sessions.get() == nullptr)
+    sessions = std::make_unique<cda::SessionStore>(sessionPath, total);
+
+  // create shard connections
+  numShards = total;
+  for (io::uint i = first; i < first + count && i < total; i++) {
+    std::shared_ptr<cda::Gateway> shard =
+      std::make_shared<cda::Gateway>(i, total, this);
+    shards.push_back(shard);
+  }
+
+  // Queue the shard connections
+  for (auto shard : shards)
+    shard->start(url);
 }
\ No newline at end of file
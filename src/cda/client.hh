@@ -1,9 +1,104 @@
 #pragma once
 
-#include "gateway.hh"
+#include "snapshot.hh"
+#include "dispatch.hh"
+#include <bitset>
 
 namespace cda {
 
+  // compile time signatures of the dispatched events
+  namespace Signals {
+    typedef io::Signal<Event::READY> Ready;
+    typedef io::Signal<Event::RESUMED> Resumed;
+    typedef io::Signal<Event::GUILD_CREATE, std::shared_ptr<Guild>> GuildCreate;
+    typedef io::Signal<Event::GUILD_UPDATE, std::shared_ptr<Guild>> GuildUpdate;
+    typedef io::Signal<Event::GUILD_DELETE, std::shared_ptr<Guild>> GuildDelete;
+    typedef io::Signal<Event::CHANNEL_CREATE,
+      std::shared_ptr<Channel>> ChannelCreate;
+    typedef io::Signal<Event::CHANNEL_UPDATE,
+      std::shared_ptr<Channel>> ChannelUpdate;
+    typedef io::Signal<Event::CHANNEL_DELETE,
+      std::shared_ptr<Channel>> ChannelDelete;
+    typedef io::Signal<Event::GUILD_MEMBER_ADD,
+      std::shared_ptr<Member>> MemberAdd;
+    typedef io::Signal<Event::GUILD_MEMBER_UPDATE,
+      std::shared_ptr<Member>> MemberUpdate;
+    typedef io::Signal<Event::GUILD_MEMBER_REMOVE,
+      std::shared_ptr<Member>> MemberRemove;
+    typedef io::Signal<Event::GUILD_ROLE_CREATE,
+      std::shared_ptr<Guild>, Role> RoleCreate;
+    typedef io::Signal<Event::GUILD_ROLE_UPDATE,
+      std::shared_ptr<Guild>, Role> RoleUpdate;
+    typedef io::Signal<Event::GUILD_ROLE_DELETE,
+      std::shared_ptr<Guild>, Role> RoleDelete;
+    typedef io::Signal<Event::USER_UPDATE, std::shared_ptr<User>> UserUpdate;
+  }
+
+  // events from here on are not cached and only have raw signals
+  static const Event::Type FIRST_RAW_EVENT = Event::CHANNEL_PINS_UPDATE;
+
+  namespace Signals {
+    /**
+     * Raw signal of an event without a typed signal, listeners receive
+     * the d field as sent. ex: Signals::Raw<Event::PRESENCE_UPDATE>
+     */
+    template <Event::Type E>
+    struct Raw : public io::Signal<E, io::json> {
+      static_assert(E >= FIRST_RAW_EVENT && E < Event::COUNT,
+        "Event has a typed signal");
+    };
+  }
+
+}
+
+namespace io {
+  // the one signature of every dispatched event id (see cda::Signals)
+  template <> struct SignalTraits<cda::Event::READY>
+    : cda::Signals::Ready {};
+  template <> struct SignalTraits<cda::Event::RESUMED>
+    : cda::Signals::Resumed {};
+  template <> struct SignalTraits<cda::Event::GUILD_CREATE>
+    : cda::Signals::GuildCreate {};
+  template <> struct SignalTraits<cda::Event::GUILD_UPDATE>
+    : cda::Signals::GuildUpdate {};
+  template <> struct SignalTraits<cda::Event::GUILD_DELETE>
+    : cda::Signals::GuildDelete {};
+  template <> struct SignalTraits<cda::Event::CHANNEL_CREATE>
+    : cda::Signals::ChannelCreate {};
+  template <> struct SignalTraits<cda::Event::CHANNEL_UPDATE>
+    : cda::Signals::ChannelUpdate {};
+  template <> struct SignalTraits<cda::Event::CHANNEL_DELETE>
+    : cda::Signals::ChannelDelete {};
+  template <> struct SignalTraits<cda::Event::GUILD_MEMBER_ADD>
+    : cda::Signals::MemberAdd {};
+  template <> struct SignalTraits<cda::Event::GUILD_MEMBER_UPDATE>
+    : cda::Signals::MemberUpdate {};
+  template <> struct SignalTraits<cda::Event::GUILD_MEMBER_REMOVE>
+    : cda::Signals::MemberRemove {};
+  template <> struct SignalTraits<cda::Event::GUILD_ROLE_CREATE>
+    : cda::Signals::RoleCreate {};
+  template <> struct SignalTraits<cda::Event::GUILD_ROLE_UPDATE>
+    : cda::Signals::RoleUpdate {};
+  template <> struct SignalTraits<cda::Event::GUILD_ROLE_DELETE>
+    : cda::Signals::RoleDelete {};
+  template <> struct SignalTraits<cda::Event::USER_UPDATE>
+    : cda::Signals::UserUpdate {};
+  template <uint Id>
+  struct SignalTraits<Id, typename std::enable_if<
+    (Id >= cda::FIRST_RAW_EVENT && Id < cda::Event::COUNT)>::type>
+    : Signal<Id, json> {};
+}
+
+namespace cda {
+
+  // typed event callbacks
+  typedef Signals::Ready::Callback ReadyCallback;
+  typedef Signals::UserUpdate::Callback UserCallback;
+  typedef Signals::GuildCreate::Callback GuildCallback;
+  typedef Signals::MemberAdd::Callback MemberCallback;
+  typedef Signals::ChannelCreate::Callback ChannelCallback;
+  typedef Signals::RoleCreate::Callback RoleCallback;
+
   class Client {
   public:
     io::Loop *loop;
@@ -12,11 +107,47 @@ namespace cda {
     io::uint numShards; // the amount of shards to spawn
 
     std::shared_ptr<User> user;
-    std::vector<std::shared_ptr<User>> users;
+    std::unordered_map<snowflake, std::shared_ptr<User>> users;
     std::vector<std::shared_ptr<Guild>> guilds;
 
     // array of shards spawned
     std::vector<std::shared_ptr<Gateway>> shards;
+
+    // paces shard identifies within the session start limits
+    ShardLauncher launcher{api.loop.get()};
+
+    // spreads out the reconnects of all shards after an outage
+    ReconnectBudget reconnects;
+
+    // use the binary ETF gateway encoding instead of json
+    bool etf = false;
+
+    // shard sessions shared with the next process (see persist())
+    std::string sessionPath;
+    std::unique_ptr<SessionStore> sessions;
+
+    // entity cache snapshot (see snapshot())
+    std::string snapshotPath;
+    long snapshotInterval = 0;
+    std::atomic<bool> snapshotting{false}; // one is being built or written
+    std::atomic<io::uint> snapshotGen{0};  // bumped to drop one in progress
+    std::mutex snapshotMutex;              // serializes snapshot writes
+
+    // dispatched gateway events (see cda::Signals)
+    io::Emitter events{Event::COUNT};
+
+    // events whose payloads update the cache (see cache())
+    std::bitset<Event::COUNT> cached = std::bitset<Event::COUNT>().set();
+
+    // intents requested on top of the derived ones (see require())
+    uint32_t required = 0;
+
+    // runs event listeners off the event loop, typed ones get copies
+    // of the cache entities (see listenerThreads())
+    io::Executor executor;
+
+    // shard, loop and api metrics (see serveMetrics())
+    io::Metrics metrics;
     
     // deconstructors
     inline ~Client() = default;
@@ -28,6 +159,8 @@ namespace cda {
     inline Client(io::uint num = 0) {
       numShards = num;
       loop = api.loop.get();
+      loop->instrument(metrics);
+      api.metrics = &metrics;
     }
 
     /**
@@ -35,5 +168,170 @@ namespace cda {
      * @param {string} _token the bot token
      */
     int login(const std::string &_token);
+
+    /**
+     * Start a range of shards on a known gateway url (no /gateway/bot)
+     * @param {string} url the gateway url
+     * @param {uint} total the amount of shards of the whole bot
+     * @param {uint} first the first shard id to run
+     * @param {uint} count the amount of shards to run
+     */
+    void launch(const std::string &url,
+      io::uint total, io::uint first, io::uint count);
+
+    /**
+     * Keep shard sessions in a memory mapped file. Shards started with
+     * a fresh session in it RESUME instead of identifying.
+     * @param {string} path the session file path
+     */
+    inline void persist(const std::string &path) {
+      sessionPath = path;
+    }
+
+    /**
+     * Serve the metrics in the Prometheus text format on GET /metrics
+     * @param {int} port the tcp port
+     * @param {string} host the address to bind, local only by default
+     * @return {bool} if listening
+     */
+    inline bool serveMetrics(int port,
+      const std::string &host = "127.0.0.1") {
+      return metrics.serve(loop, port, host);
+    }
+
+    /**
+     * Turn caching of an event on or off. Payloads of events that are
+     * not cached and have no listeners are skipped without parsing them.
+     * Typed listeners need the cached objects, so registering one still
+     * parses and caches its event. READY and RESUMED are always handled.
+     * @param {Event::Type} event the event
+     * @param {bool} enabled if the event should update the cache
+     */
+    inline void cache(Event::Type event, bool enabled) {
+      if (event >= Event::COUNT) return;
+      if (event == Event::READY || event == Event::RESUMED) return;
+      cached[event] = enabled;
+    }
+
+    /**
+     * Check if an event updates the cache
+     * @param {Event::Type} event the event
+     * @return {bool} if the event is cached
+     */
+    inline bool caches(Event::Type event) const {
+      return event < Event::COUNT && cached[event];
+    }
+
+    /**
+     * Always request some intents, ex: privileged ones for the cache
+     * @param {uint32_t} intents the cda::Intent bits to add
+     */
+    inline void require(uint32_t intents) {
+      required |= intents;
+    }
+
+    /**
+     * Build the intents sent in IDENTIFY from the cached events, the
+     * events with listeners and require(). Privileged intents are only
+     * derived from listeners since identifying with ones the bot was not
+     * granted fails. Listeners added later apply on the next identify.
+     * @return {uint32_t} the cda::Intent bits
+     */
+    uint32_t intents() const;
+
+    /**
+     * Warm start the cache from a snapshot file and keep rewriting it.
+     * Snapshot guilds are marked stale until GUILD_CREATE confirms them.
+     * Every process (cluster worker) needs its own file.
+     * @param {string} path the snapshot file path
+     * @param {long} interval ms between snapshots (0 for only on handoff)
+     */
+    inline void snapshot(const std::string &path, long interval = 60000) {
+      snapshotPath = path;
+      snapshotInterval = interval;
+    }
+
+    /**
+     * Set the amount of threads running event listeners, before login
+     * @param {uint} count amount of threads (0 for hardware threads)
+     */
+    inline void listenerThreads(io::uint count) {
+      executor.threads(count);
+    }
+
+    /**
+     * Stop the client without closing the gateway sessions,
+     * so another process can resume them from the session file
+     */
+    void handoff();
+
+    /**
+     * Find a cached guild
+     * @param {snowflake} id the guild id
+     * @return {Guild} the guild or nullptr if not cached
+     */
+    inline std::shared_ptr<Guild> getGuild(snowflake id) {
+      return cda::Find(id, guilds);
+    }
+
+    /**
+     * Wait for an event from a coroutine
+     * ex: auto m = co_await client.waitFor<Signals::MemberAdd>(pred, 5000);
+     * @param {Predicate} predicate filter on the event arguments
+     * @param {long} timeout milliseconds to wait (0 to wait forever)
+     * @return {SignalWait} resolves to the event arguments or nullopt
+     */
+    template <typename Sig>
+    inline io::SignalWait<Sig> waitFor(
+      typename Sig::Filter predicate = nullptr, long timeout = 0) {
+      return io::SignalWait<Sig>(&events, loop, predicate, timeout);
+    }
+
+    /** Typed event listeners, each returns the listener id */
+    inline io::uint onReady(ReadyCallback cb) {
+      return events.on<Signals::Ready>(cb);
+    }
+    inline io::uint onResumed(ReadyCallback cb) {
+      return events.on<Signals::Resumed>(cb);
+    }
+    inline io::uint onGuildCreate(GuildCallback cb) {
+      return events.on<Signals::GuildCreate>(cb);
+    }
+    inline io::uint onGuildUpdate(GuildCallback cb) {
+      return events.on<Signals::GuildUpdate>(cb);
+    }
+    inline io::uint onGuildDelete(GuildCallback cb) {
+      return events.on<Signals::GuildDelete>(cb);
+    }
+    inline io::uint onChannelCreate(ChannelCallback cb) {
+      return events.on<Signals::ChannelCreate>(cb);
+    }
+    inline io::uint onChannelUpdate(ChannelCallback cb) {
+      return events.on<Signals::ChannelUpdate>(cb);
+    }
+    inline io::uint onChannelDelete(ChannelCallback cb) {
+      return events.on<Signals::ChannelDelete>(cb);
+    }
+    inline io::uint onMemberAdd(MemberCallback cb) {
+      return events.on<Signals::MemberAdd>(cb);
+    }
+    inline io::uint onMemberUpdate(MemberCallback cb) {
+      return events.on<Signals::MemberUpdate>(cb);
+    }
+    inline io::uint onMemberRemove(MemberCallback cb) {
+      return events.on<Signals::MemberRemove>(cb);
+    }
+    inline io::uint onRoleCreate(RoleCallback cb) {
+      return events.on<Signals::RoleCreate>(cb);
+    }
+    inline io::uint onRoleUpdate(RoleCallback cb) {
+      return events.on<Signals::RoleUpdate>(cb);
+    }
+    inline io::uint onRoleDelete(RoleCallback cb) {
+      return events.on<Signals::RoleDelete>(cb);
+    }
+    inline io::uint onUserUpdate(UserCallback cb) {
+      return events.on<Signals::UserUpdate>(cb);
+    }
   };
 }
\ No newline at end of file
@@ -0,0 +1,631 @@
+#include "cluster.hh"
+#include <fstream>
+#include <csignal>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <sys/prctl.h>
+
+extern char **environ;
+
+// environment handed to worker processes
+#define WORKER_ENV "CDA_CLUSTER_WORKER"
+#define SOCKET_ENV "CDA_CLUSTER_IPC"
+
+// ms a stopping worker gets before it is killed
+#define SHUTDOWN_GRACE 10000
+
+/**
+ * Send a json message over a channel
+ * @param {IpcChannel} channel the channel to send over
+ * @param {json} message the message to send
+ */
+static inline void SendJson(io::IpcChannel *channel, const io::json &message) {
+  if (channel != nullptr && channel->isOpen())
+    channel->Send(message.dump());
+}
+
+/**
+ * Parse a received message, ignoring garbage
+ * @param {string} text the received message
+ * @param {json} out the parsed message
+ * @return {bool} if the message is a json object with an op
+ */
+static inline bool ParseJson(const std::string &text, io::json &out) {
+  try {
+    out = io::json::parse(text);
+  } catch (const std::exception &e) {
+    return false;
+  }
+  return out.is_object() && out.find("op") != out.end();
+}
+
+/**
+ * Read the arguments this process was started with
+ * @return {vector} the arguments
+ */
+static std::vector<std::string> CommandLine() {
+  std::vector<std::string> args;
+  std::ifstream file("/proc/self/cmdline", std::ios::binary);
+  std::string arg;
+  while (std::getline(file, arg, '\0'))
+    args.push_back(arg);
+  return args;
+}
+
+/****************************** Worker ******************************/
+
+/**
+ * Create the worker
+ * @param {uint} index the worker index given by the supervisor
+ */
+cda::ClusterWorker::ClusterWorker(io::uint index) : index(index) {
+  cda::ClusterWorker *self = this;
+  handle("stats", [self](io::json &data) {
+    io::json shards = io::json::array();
+    for (auto &shard : self->client.shards)
+      shards.push_back({
+        {"id", shard->id},
+        {"latency", shard->latency},
+        {"queued", shard->outbox.depth()},
+        {"connected", shard->hello}
+      });
+    return io::json({
+      {"worker", self->index},
+      {"pid", (long)getpid()},
+      {"shards", shards},
+      {"ready", self->client.launcher.launched()},
+      {"guilds", self->client.guilds.size()},
+      {"users", self->client.users.size()},
+      {"pending", self->client.executor.pending()}
+    });
+  });
+}
+
+/**
+ * Register a command other processes can broadcast
+ * @param {string} name the command name
+ * @param {CommandHandler} handler computes the result on the loop
+ */
+void cda::ClusterWorker::handle(const std::string &name,
+  cda::CommandHandler handler)
+{
+  if (!handler)
+    throw std::invalid_argument("No command handler given");
+  handlers[name] = handler;
+}
+
+/**
+ * Send a message to the supervisor
+ * @param {json} message the message to send
+ */
+void cda::ClusterWorker::send(const io::json &message) {
+  SendJson(channel.get(), message);
+}
+
+/**
+ * Run a command on every worker of the cluster
+ * @param {string} name the command name
+ * @param {json} data the command argument
+ * @param {BroadcastCallback} callback the results, indexed by worker
+ */
+void cda::ClusterWorker::broadcast(const std::string &name,
+  io::json data, cda::BroadcastCallback callback)
+{
+  replies[++nonce] = callback;
+  send({{"op", "broadcast"}, {"nonce", nonce}, {"name", name}, {"d", data}});
+}
+
+/**
+ * Ask the supervisor for a coordinated restart
+ * @param {int} worker the worker to restart (-1 for every worker)
+ */
+void cda::ClusterWorker::restart(int worker) {
+  io::json target = worker < 0 ? io::json(nullptr) : io::json(worker);
+  send({{"op", "restart"}, {"d", target}});
+}
+
+/**
+ * Handle a message from the supervisor
+ * @param {json} message the received message
+ */
+void cda::ClusterWorker::receive(io::json &message) {
+  const std::string op = message["op"];
+
+  // start the assigned shard range
+  if (op == "launch") {
+    first = message["first"];
+    count = message["count"];
+    if (message["limit"].is_object())
+      client.launcher.configure({{"session_start_limit", message["limit"]}});
+
+    // tell the supervisor once every shard is ready
+    cda::ClusterWorker *self = this;
+    cda::ProgressCallback progress = client.launcher.progress;
+    client.launcher.progress = [self, progress](io::uint done, io::uint all) {
+      if (progress) progress(done, all);
+      if (done == self->count) self->send({{"op", "ready"}});
+    };
+    client.launch(message["url"], message["total"], first, count);
+    if (count == 0) send({{"op", "ready"}});
+
+  // run a command and reply with the result
+  } else if (op == "command") {
+    io::json reply = {{"op", "reply"}, {"nonce", message["nonce"]}};
+    auto handler = handlers.find(message["name"].get<std::string>());
+    if (handler == handlers.end()) {
+      reply["error"] = "Unknown command";
+    } else {
+      try {
+        reply["d"] = handler->second(message["d"]);
+      } catch (const std::exception &e) {
+        reply["error"] = e.what();
+      }
+    }
+    send(reply);
+
+  // results of a broadcast started here
+  } else if (op == "reply") {
+    auto reply = replies.find(message["nonce"].get<io::uint>());
+    if (reply == replies.end()) return;
+    BroadcastCallback callback = reply->second;
+    replies.erase(reply);
+    callback(message["d"]);
+
+  // stop for a restart
+  } else if (op == "shutdown") {
+    std::cerr << "[cda] Worker " << index << " shutting down" << std::endl;
+    client.handoff();
+  }
+}
+
+/**
+ * Connect to the supervisor and run until told to stop
+ * @param {string} token the bot token
+ * @param {string} path the supervisor socket path
+ * @return {int} the process exit code
+ */
+int cda::ClusterWorker::run(const std::string &token, const std::string &path) {
+  client.token = token;
+  client.api.token = token;
+
+  io::Socket *sock = client.loop->spawnLocal(path);
+  if (sock == nullptr) {
+    std::cerr << "[cda] Worker " << index
+      << " could not reach the supervisor at " << path << std::endl;
+    return 1;
+  }
+
+  // the supervisor going away stops the worker
+  cda::ClusterWorker *self = this;
+  channel = std::make_shared<io::IpcChannel>(sock);
+  channel->onMessage([self](std::string &text) {
+    io::json message;
+    if (ParseJson(text, message)) self->receive(message);
+  });
+  channel->onClose([self]() {
+    self->client.loop->quit();
+  });
+
+  send({{"op", "hello"}, {"worker", index}, {"pid", (long)getpid()}});
+  return client.loop->run();
+}
+
+/**************************** Supervisor ****************************/
+
+/**
+ * Create the cluster
+ * @param {uint} workers amount of worker processes
+ * @param {uint} shards total shards (0 for the recommended amount)
+ * @param {string} path the supervisor socket path
+ */
+cda::Cluster::Cluster(io::uint workers, io::uint shards,
+  const std::string &path) : workers(workers), shards(shards), path(path)
+{
+  if (workers == 0)
+    throw std::invalid_argument("A cluster needs at least one worker");
+}
+
+/** If this process was started as a cluster worker */
+bool cda::Cluster::isWorker() {
+  return std::getenv(WORKER_ENV) != nullptr;
+}
+
+/**
+ * Run the supervisor, or the worker when started by one
+ * @param {string} token the bot token
+ * @param {WorkerMain} main sets up each worker
+ * @return {int} the process exit code
+ */
+int cda::Cluster::run(const std::string &token, cda::WorkerMain main) {
+  // worker processes only run their client
+  if (isWorker()) {
+    const char *socket = std::getenv(SOCKET_ENV);
+    cda::ClusterWorker worker(std::atoi(std::getenv(WORKER_ENV)));
+    if (main) main(worker);
+    return worker.run(token, socket != nullptr ? socket : path);
+  }
+  api.token = token;
+  cda::Cluster *self = this;
+
+  // accept the worker connections
+  io::Socket *listener = api.loop->listenLocal(path);
+  if (listener == nullptr)
+    throw std::runtime_error("Could not listen on " + path);
+  listener->onAccept([self](io::Socket *sock) {
+    std::shared_ptr<io::IpcChannel> channel =
+      std::make_shared<io::IpcChannel>(sock);
+    std::weak_ptr<io::IpcChannel> weak = channel;
+    channel->onMessage([self, weak](std::string &text) {
+      io::json message;
+      std::shared_ptr<io::IpcChannel> channel = weak.lock();
+      if (channel.get() == nullptr || !ParseJson(text, message)) return;
+
+      // a bad worker message must not take the supervisor down
+      try {
+        self->receive(channel, message);
+      } catch (const std::exception &e) {
+        std::cerr << "[cda] Dropped worker message: " << e.what()
+          << std::endl;
+      }
+    });
+    channel->onClose([self, weak]() {
+      self->api.loop->post([self, weak]() {
+        std::shared_ptr<io::IpcChannel> channel = weak.lock();
+        auto &list = self->unknown;
+        list.erase(std::remove(list.begin(), list.end(), channel), list.end());
+      });
+    });
+    self->unknown.push_back(channel);
+  });
+
+  // use the given gateway or ask discord
+  if (!gateway.empty()) {
+    plan(gateway, shards > 0 ? shards : workers, io::json());
+  } else {
+    api.get("/gateway/bot", {}, [self](io::json &resp) {
+      io::uint total = self->shards > 0 ?
+        self->shards : resp["shards"].get<io::uint>();
+      self->plan(resp["url"], total, resp["session_start_limit"]);
+    });
+  }
+
+  reap();
+  return api.loop->run();
+}
+
+/**
+ * Split the shards over the workers and start them
+ * @param {string} url the gateway url
+ * @param {uint} total the amount of shards of the bot
+ * @param {json} limit the session start limits
+ */
+void cda::Cluster::plan(const std::string &url,
+  io::uint total, const io::json &limit)
+{
+  this->url = url;
+  this->total = total;
+  this->limit = limit;
+
+  // contiguous ranges, the first workers take the remainder
+  procs.resize(workers);
+  io::uint first = 0;
+  for (io::uint i = 0; i < workers; i++) {
+    procs[i].first = first;
+    procs[i].count = total / workers + (i < total % workers ? 1 : 0);
+    first += procs[i].count;
+  }
+
+  std::cerr << "[cda] Running " << total << " shards on "
+    << workers << " workers" << std::endl;
+  for (io::uint i = 0; i < workers; i++)
+    spawn(i);
+}
+
+/**
+ * Start a worker process running the current executable
+ * @param {uint} index the worker to start
+ */
+void cda::Cluster::spawn(io::uint index) {
+  // build everything before forking
+  std::vector<std::string> args = CommandLine();
+  if (args.empty()) args.push_back("/proc/self/exe");
+  std::vector<std::string> env;
+  for (char **var = environ; *var != nullptr; var++)
+    if (std::strncmp(*var, WORKER_ENV "=", sizeof(WORKER_ENV)) != 0
+      && std::strncmp(*var, SOCKET_ENV "=", sizeof(SOCKET_ENV)) != 0)
+      env.push_back(*var);
+  env.push_back(WORKER_ENV "=" + std::to_string(index));
+  env.push_back(SOCKET_ENV "=" + path);
+
+  std::vector<char*> argv, envp;
+  for (std::string &arg : args) argv.push_back(&arg[0]);
+  for (std::string &var : env) envp.push_back(&var[0]);
+  argv.push_back(nullptr);
+  envp.push_back(nullptr);
+
+  pid_t pid = fork();
+  if (pid < 0) {
+    std::cerr << "[cda] Could not start worker " << index << std::endl;
+    cda::Cluster *self = this;
+    api.loop->later(restartDelay, [self, index](){ self->spawn(index); });
+    return;
+  }
+
+  // workers die with the supervisor
+  if (pid == 0) {
+    prctl(PR_SET_PDEATHSIG, SIGTERM);
+    execve("/proc/self/exe", argv.data(), envp.data());
+    _exit(127);
+  }
+
+  procs[index].pid = pid;
+  procs[index].ready = false;
+  std::cerr << "[cda] Started worker " << index << " (pid " << pid
+    << ") for shards " << procs[index].first << "-"
+    << (procs[index].first + procs[index].count) << std::endl;
+}
+
+/**
+ * Collect exited workers, checking again every second
+ */
+void cda::Cluster::reap() {
+  // only wait on our workers, other children belong to the host
+  int status;
+  for (io::uint i = 0; i < procs.size(); i++)
+    if (procs[i].pid > 0 && waitpid(procs[i].pid, &status, WNOHANG) > 0)
+      exited(i, status);
+
+  cda::Cluster *self = this;
+  api.loop->later(1000, [self](){ self->reap(); });
+}
+
+/**
+ * Clean up after a worker process exited and start it again
+ * @param {uint} index the worker that exited
+ * @param {int} status the wait status
+ */
+void cda::Cluster::exited(io::uint index, int status) {
+  Process &proc = procs[index];
+  std::cerr << "[cda] Worker " << index << " exited with status "
+    << (WIFEXITED(status) ? WEXITSTATUS(status) : -1) << std::endl;
+  proc.pid = 0;
+  proc.ready = false;
+
+  // drop the channel outside of its own callbacks
+  std::shared_ptr<io::IpcChannel> channel = proc.channel;
+  proc.channel = nullptr;
+  if (channel.get() != nullptr)
+    api.loop->post([channel](){ channel->Close(); });
+
+  // the worker will not answer running broadcasts
+  std::vector<io::uint> nonces;
+  for (auto &entry : pending)
+    if (entry.second.waiting[index]) nonces.push_back(entry.first);
+  for (io::uint n : nonces)
+    answer(n, index, nullptr);
+
+  // let the next worker identify
+  launches.erase(std::remove(launches.begin(), launches.end(), index),
+    launches.end());
+  if (launching == (int)index) {
+    launching = -1;
+    launchNext();
+  }
+
+  // coordinated restarts start again right away
+  cda::Cluster *self = this;
+  long delay = proc.restarting ? 0 : restartDelay;
+  api.loop->later(delay, [self, index](){ self->spawn(index); });
+}
+
+/**
+ * Hand the next waiting worker its shard range. Workers launch one
+ * at a time so their identifies do not compete for the same buckets.
+ */
+void cda::Cluster::launchNext() {
+  while (launching < 0 && !launches.empty()) {
+    io::uint index = launches.front();
+    launches.pop_front();
+    Process &proc = procs[index];
+    if (proc.channel.get() == nullptr) continue;
+
+    launching = index;
+    SendJson(proc.channel.get(), {
+      {"op", "launch"},
+      {"url", url},
+      {"total", total},
+      {"first", proc.first},
+      {"count", proc.count},
+      {"limit", limit}
+    });
+  }
+}
+
+/**
+ * Restart a worker once the restarts queued before it are ready
+ * @param {uint} index the worker to restart
+ */
+void cda::Cluster::restart(io::uint index) {
+  if (index >= procs.size())
+    throw std::invalid_argument("Invalid worker index");
+  restarts.push_back(index);
+  pumpRestart();
+}
+
+/**
+ * Restart every worker, one at a time
+ */
+void cda::Cluster::restartAll() {
+  for (io::uint i = 0; i < procs.size(); i++)
+    restarts.push_back(i);
+  pumpRestart();
+}
+
+/**
+ * Stop the next worker of the restart queue
+ */
+void cda::Cluster::pumpRestart() {
+  if (restarting >= 0 || restarts.empty()) return;
+  io::uint index = restarts.front();
+  restarts.pop_front();
+  Process &proc = procs[index];
+  if (proc.pid == 0) return pumpRestart();
+
+  std::cerr << "[cda] Restarting worker " << index << std::endl;
+  restarting = index;
+  proc.restarting = true;
+  SendJson(proc.channel.get(), {{"op", "shutdown"}});
+
+  // kill workers that do not stop in time
+  cda::Cluster *self = this;
+  pid_t pid = proc.pid;
+  api.loop->later(SHUTDOWN_GRACE, [self, index, pid](){
+    if (self->procs[index].pid == pid) kill(pid, SIGKILL);
+  });
+}
+
+/**
+ * Run a command on every worker
+ * @param {string} name the command name
+ * @param {json} data the command argument
+ * @param {BroadcastCallback} callback the results, indexed by worker
+ */
+void cda::Cluster::broadcast(const std::string &name,
+  io::json data, cda::BroadcastCallback callback)
+{
+  Pending request;
+  request.callback = callback;
+  request.results = io::json::array();
+  request.waiting.resize(procs.size(), false);
+  for (io::uint i = 0; i < procs.size(); i++) {
+    request.results.push_back(nullptr);
+    if (procs[i].channel.get() == nullptr) continue;
+    request.waiting[i] = true;
+    request.left++;
+  }
+
+  // nobody to ask
+  if (request.left == 0) {
+    if (callback) callback(request.results);
+    return;
+  }
+
+  const io::uint id = ++nonce;
+  pending[id] = request;
+  io::json message = {{"op", "command"}, {"nonce", id},
+    {"name", name}, {"d", data}};
+  for (io::uint i = 0; i < procs.size(); i++)
+    if (request.waiting[i]) SendJson(procs[i].channel.get(), message);
+}
+
+/**
+ * Record the answer of a worker to a broadcast
+ * @param {uint} id the broadcast id
+ * @param {uint} index the worker answering
+ * @param {json} result the result (null if the worker left)
+ */
+void cda::Cluster::answer(io::uint id, io::uint index, const io::json &result) {
+  auto entry = pending.find(id);
+  if (entry == pending.end()) return;
+  Pending &request = entry->second;
+  if (index >= request.waiting.size() || !request.waiting[index]) return;
+
+  request.results[index] = result;
+  request.waiting[index] = false;
+  if (--request.left > 0) return;
+
+  Pending done = std::move(request);
+  pending.erase(entry);
+  if (done.callback) done.callback(done.results);
+}
+
+/**
+ * Log a worker message missing the fields its op needs
+ * @param {uint} index the worker that sent it
+ * @param {string} op the message op
+ */
+static inline void Dropped(io::uint index, const std::string &op) {
+  std::cerr << "[cda] Dropped bad " << op << " message from worker "
+    << index << std::endl;
+}
+
+/**
+ * Handle a message from a worker
+ * @param {IpcChannel} channel the channel it came from
+ * @param {json} message the received message
+ */
+void cda::Cluster::receive(std::shared_ptr<io::IpcChannel> channel,
+  io::json &message)
+{
+  if (!message["op"].is_string()) return;
+  const std::string op = message["op"];
+
+  // a worker introduced itself
+  if (op == "hello") {
+    if (!message["worker"].is_number_unsigned()) return;
+    io::uint index = message["worker"];
+    if (index >= procs.size()) return;
+    unknown.erase(std::remove(unknown.begin(), unknown.end(), channel),
+      unknown.end());
+    procs[index].channel = channel;
+    launches.push_back(index);
+    launchNext();
+    return;
+  }
+
+  // find the worker of the channel
+  io::uint index = 0;
+  while (index < procs.size() && procs[index].channel != channel) index++;
+  if (index == procs.size()) return;
+  Process &proc = procs[index];
+
+  // every shard of the worker is ready
+  if (op == "ready") {
+    std::cerr << "[cda] Worker " << index << " ready" << std::endl;
+    proc.ready = true;
+    if (launching == (int)index) {
+      launching = -1;
+      launchNext();
+    }
+    if (restarting == (int)index) {
+      proc.restarting = false;
+      restarting = -1;
+      pumpRestart();
+    }
+
+  // a worker answered a broadcast
+  } else if (op == "reply") {
+    if (!message["nonce"].is_number_unsigned()) {
+      Dropped(index, op);
+      return;
+    }
+    io::json result = message.find("error") != message.end() ?
+      io::json({{"error", message["error"]}}) : message["d"];
+    answer(message["nonce"], index, result);
+
+  // a worker started a broadcast
+  } else if (op == "broadcast") {
+    if (!message["name"].is_string() || message["nonce"].is_null()) {
+      Dropped(index, op);
+      return;
+    }
+    std::weak_ptr<io::IpcChannel> weak = channel;
+    io::json nonce = message["nonce"];
+    broadcast(message["name"], message["d"], [weak, nonce](io::json &results) {
+      std::shared_ptr<io::IpcChannel> origin = weak.lock();
+      SendJson(origin.get(), {{"op", "reply"}, {"nonce", nonce},
+        {"d", results}});
+    });
+
+  // a worker asked for a restart
+  } else if (op == "restart") {
+    const io::json &target = message["d"];
+    if (target.is_null())
+      restartAll();
+    else if (target.is_number_integer() && target >= 0
+        && target < procs.size())
+      restart(target.get<io::uint>());
+    else
+      Dropped(index, op);
+  }
+}
@@ -0,0 +1,177 @@
+#pragma once
+
+#include "client.hh"
+#include <map>
+#include <sys/types.h>
+
+namespace cda {
+
+  // runs a named cluster command on a worker and returns its result
+  typedef std::function<io::json(io::json&)> CommandHandler;
+
+  // receives the results of every worker (null for workers that left)
+  typedef std::function<void(io::json&)> BroadcastCallback;
+
+  class ClusterWorker {
+  /**
+   * Worker process of a cluster: a Client running a range of shards
+   * with a channel to the supervisor for commands and stats.
+   */
+  public:
+    io::uint index;     // the worker index
+    io::uint first = 0; // first shard id of this worker
+    io::uint count = 0; // amount of shards of this worker
+    Client client;      // the client running the shards
+
+    /**
+     * Create the worker
+     * @param {uint} index the worker index given by the supervisor
+     */
+    ClusterWorker(io::uint index);
+
+    /**
+     * Register a command other processes can broadcast
+     * @param {string} name the command name
+     * @param {CommandHandler} handler computes the result on the loop
+     */
+    void handle(const std::string &name, CommandHandler handler);
+
+    /**
+     * Run a command on every worker of the cluster
+     * @param {string} name the command name
+     * @param {json} data the command argument
+     * @param {BroadcastCallback} callback the results, indexed by worker
+     */
+    void broadcast(const std::string &name,
+      io::json data, BroadcastCallback callback);
+
+    /**
+     * Ask the supervisor for a coordinated restart
+     * @param {int} worker the worker to restart (-1 for every worker)
+     */
+    void restart(int worker = -1);
+
+    /**
+     * Connect to the supervisor and run until told to stop
+     * @param {string} token the bot token
+     * @param {string} path the supervisor socket path
+     * @return {int} the process exit code
+     */
+    int run(const std::string &token, const std::string &path);
+
+  private:
+    void send(const io::json &message);
+    void receive(io::json &message);
+
+    io::uint nonce = 0; // last broadcast id
+    std::shared_ptr<io::IpcChannel> channel;
+    std::map<std::string, CommandHandler> handlers;
+    std::map<io::uint, BroadcastCallback> replies;
+  };
+
+  // sets up a worker (listeners, commands) before it starts its shards
+  typedef std::function<void(ClusterWorker&)> WorkerMain;
+
+  class Cluster {
+  /**
+   * Splits the shards of a bot over worker processes. The supervisor
+   * re-runs the current executable once per worker, hands out shard
+   * ranges one worker at a time and keeps a unix socket open to each
+   * for broadcast commands, stats and coordinated restarts.
+   */
+  public:
+    io::uint workers;         // amount of worker processes
+    io::uint shards;          // total shards (0 for the recommended amount)
+    std::string path;         // the supervisor socket path
+    std::string gateway;      // gateway url to use instead of /gateway/bot
+    long restartDelay = 5000; // ms before respawning a crashed worker
+    ApiController api;        // the supervisor api handler and loop
+
+    /**
+     * Create the cluster
+     * @param {uint} workers amount of worker processes
+     * @param {uint} shards total shards (0 for the recommended amount)
+     * @param {string} path the supervisor socket path
+     */
+    Cluster(io::uint workers, io::uint shards = 0,
+      const std::string &path = "/tmp/cda-cluster.sock");
+
+    /**
+     * Run the supervisor, or the worker when started by one
+     * @param {string} token the bot token
+     * @param {WorkerMain} main sets up each worker
+     * @return {int} the process exit code
+     */
+    int run(const std::string &token, WorkerMain main);
+
+    /**
+     * Run a command on every worker
+     * @param {string} name the command name
+     * @param {json} data the command argument
+     * @param {BroadcastCallback} callback the results, indexed by worker
+     */
+    void broadcast(const std::string &name,
+      io::json data, BroadcastCallback callback);
+
+    /**
+     * Collect the stats of every worker
+     * @param {BroadcastCallback} callback the stats, indexed by worker
+     */
+    inline void stats(BroadcastCallback callback) {
+      broadcast("stats", Jempty, callback);
+    }
+
+    /**
+     * Restart a worker once the restarts queued before it are ready
+     * @param {uint} index the worker to restart
+     */
+    void restart(io::uint index);
+
+    /**
+     * Restart every worker, one at a time
+     */
+    void restartAll();
+
+    /** If this process was started as a cluster worker */
+    static bool isWorker();
+
+  private:
+    struct Process {
+      pid_t pid = 0;           // process id (0 when not running)
+      io::uint first = 0;      // first shard id
+      io::uint count = 0;      // amount of shards
+      bool ready = false;      // if every shard received READY
+      bool restarting = false; // if stopped for a coordinated restart
+      std::shared_ptr<io::IpcChannel> channel;
+    };
+
+    struct Pending {
+      io::json results;            // result of each worker
+      std::vector<bool> waiting;   // workers yet to reply
+      io::uint left = 0;           // amount of workers yet to reply
+      BroadcastCallback callback;  // receives the results
+    };
+
+    void plan(const std::string &url, io::uint total, const io::json &limit);
+    void spawn(io::uint index);
+    void reap();
+    void exited(io::uint index, int status);
+    void launchNext();
+    void pumpRestart();
+    void answer(io::uint nonce, io::uint index, const io::json &result);
+    void receive(std::shared_ptr<io::IpcChannel> channel, io::json &message);
+
+    std::string url;                 // gateway url handed to workers
+    io::uint total = 0;              // total shards of the bot
+    io::json limit;                  // session start limits for workers
+    io::uint nonce = 0;              // last broadcast id
+    int launching = -1;              // worker identifying its shards
+    int restarting = -1;             // worker in a coordinated restart
+    std::vector<Process> procs;      // the worker processes
+    std::deque<io::uint> launches;   // workers waiting to launch
+    std::deque<io::uint> restarts;   // workers waiting to restart
+    std::map<io::uint, Pending> pending; // running broadcasts
+    std::vector<std::shared_ptr<io::IpcChannel>> unknown; // before hello
+  };
+
+}
@@ -0,0 +1,230 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+
+namespace cda {
+
+  struct Event {
+    enum Type : unsigned int {
+      READY = 0,
+      RESUMED,
+      GUILD_CREATE,
+      GUILD_UPDATE,
+      GUILD_DELETE,
+      CHANNEL_CREATE,
+      CHANNEL_UPDATE,
+      CHANNEL_DELETE,
+      GUILD_MEMBER_ADD,
+      GUILD_MEMBER_UPDATE,
+      GUILD_MEMBER_REMOVE,
+      GUILD_ROLE_CREATE,
+      GUILD_ROLE_UPDATE,
+      GUILD_ROLE_DELETE,
+      USER_UPDATE,
+      CHANNEL_PINS_UPDATE,
+      GUILD_BAN_ADD,
+      GUILD_BAN_REMOVE,
+      GUILD_EMOJIS_UPDATE,
+      GUILD_INTEGRATIONS_UPDATE,
+      GUILD_MEMBERS_CHUNK,
+      MESSAGE_CREATE,
+      MESSAGE_UPDATE,
+      MESSAGE_DELETE,
+      MESSAGE_DELETE_BULK,
+      MESSAGE_REACTION_ADD,
+      MESSAGE_REACTION_REMOVE,
+      MESSAGE_REACTION_REMOVE_ALL,
+      PRESENCE_UPDATE,
+      PRESENCES_REPLACE,
+      TYPING_START,
+      VOICE_STATE_UPDATE,
+      VOICE_SERVER_UPDATE,
+      WEBHOOKS_UPDATE,
+      COUNT,          // amount of known events
+      UNKNOWN = COUNT // event name not recognised
+    };
+  };
+
+  // gateway event names, indexed by Event::Type
+  static constexpr const char *EventNames[Event::COUNT] = {
+    "READY",
+    "RESUMED",
+    "GUILD_CREATE",
+    "GUILD_UPDATE",
+    "GUILD_DELETE",
+    "CHANNEL_CREATE",
+    "CHANNEL_UPDATE",
+    "CHANNEL_DELETE",
+    "GUILD_MEMBER_ADD",
+    "GUILD_MEMBER_UPDATE",
+    "GUILD_MEMBER_REMOVE",
+    "GUILD_ROLE_CREATE",
+    "GUILD_ROLE_UPDATE",
+    "GUILD_ROLE_DELETE",
+    "USER_UPDATE",
+    "CHANNEL_PINS_UPDATE",
+    "GUILD_BAN_ADD",
+    "GUILD_BAN_REMOVE",
+    "GUILD_EMOJIS_UPDATE",
+    "GUILD_INTEGRATIONS_UPDATE",
+    "GUILD_MEMBERS_CHUNK",
+    "MESSAGE_CREATE",
+    "MESSAGE_UPDATE",
+    "MESSAGE_DELETE",
+    "MESSAGE_DELETE_BULK",
+    "MESSAGE_REACTION_ADD",
+    "MESSAGE_REACTION_REMOVE",
+    "MESSAGE_REACTION_REMOVE_ALL",
+    "PRESENCE_UPDATE",
+    "PRESENCES_REPLACE",
+    "TYPING_START",
+    "VOICE_STATE_UPDATE",
+    "VOICE_SERVER_UPDATE",
+    "WEBHOOKS_UPDATE"
+  };
+
+  // gateway intents, each one subscribes to a group of events
+  struct Intent {
+    static const uint32_t GUILDS                   = 1 << 0;
+    static const uint32_t GUILD_MEMBERS            = 1 << 1;  // privileged
+    static const uint32_t GUILD_BANS               = 1 << 2;
+    static const uint32_t GUILD_EMOJIS             = 1 << 3;
+    static const uint32_t GUILD_INTEGRATIONS       = 1 << 4;
+    static const uint32_t GUILD_WEBHOOKS           = 1 << 5;
+    static const uint32_t GUILD_INVITES            = 1 << 6;
+    static const uint32_t GUILD_VOICE_STATES       = 1 << 7;
+    static const uint32_t GUILD_PRESENCES          = 1 << 8;  // privileged
+    static const uint32_t GUILD_MESSAGES           = 1 << 9;
+    static const uint32_t GUILD_MESSAGE_REACTIONS  = 1 << 10;
+    static const uint32_t GUILD_MESSAGE_TYPING     = 1 << 11;
+    static const uint32_t DIRECT_MESSAGES          = 1 << 12;
+    static const uint32_t DIRECT_MESSAGE_REACTIONS = 1 << 13;
+    static const uint32_t DIRECT_MESSAGE_TYPING    = 1 << 14;
+
+    // intents that have to be enabled for the bot by discord
+    static const uint32_t PRIVILEGED = GUILD_MEMBERS | GUILD_PRESENCES;
+  };
+
+  // intents needed to receive each event, indexed by Event::Type
+  static constexpr uint32_t EventIntents[Event::COUNT] = {
+    0,                                                   // READY
+    0,                                                   // RESUMED
+    Intent::GUILDS,                                      // GUILD_CREATE
+    Intent::GUILDS,                                      // GUILD_UPDATE
+    Intent::GUILDS,                                      // GUILD_DELETE
+    Intent::GUILDS,                                      // CHANNEL_CREATE
+    Intent::GUILDS,                                      // CHANNEL_UPDATE
+    Intent::GUILDS,                                      // CHANNEL_DELETE
+    Intent::GUILD_MEMBERS,                               // GUILD_MEMBER_ADD
+    Intent::GUILD_MEMBERS,                               // GUILD_MEMBER_UPDATE
+    Intent::GUILD_MEMBERS,                               // GUILD_MEMBER_REMOVE
+    Intent::GUILDS,                                      // GUILD_ROLE_CREATE
+    Intent::GUILDS,                                      // GUILD_ROLE_UPDATE
+    Intent::GUILDS,                                      // GUILD_ROLE_DELETE
+    0,                                                   // USER_UPDATE
+    Intent::GUILDS | Intent::DIRECT_MESSAGES,            // CHANNEL_PINS_UPDATE
+    Intent::GUILD_BANS,                                  // GUILD_BAN_ADD
+    Intent::GUILD_BANS,                                  // GUILD_BAN_REMOVE
+    Intent::GUILD_EMOJIS,                                // GUILD_EMOJIS_UPDATE
+    Intent::GUILD_INTEGRATIONS,                          // GUILD_INTEGRATIONS_UPDATE
+    0,                                                   // GUILD_MEMBERS_CHUNK
+    Intent::GUILD_MESSAGES | Intent::DIRECT_MESSAGES,    // MESSAGE_CREATE
+    Intent::GUILD_MESSAGES | Intent::DIRECT_MESSAGES,    // MESSAGE_UPDATE
+    Intent::GUILD_MESSAGES | Intent::DIRECT_MESSAGES,    // MESSAGE_DELETE
+    Intent::GUILD_MESSAGES,                              // MESSAGE_DELETE_BULK
+    Intent::GUILD_MESSAGE_REACTIONS
+      | Intent::DIRECT_MESSAGE_REACTIONS,                // MESSAGE_REACTION_ADD
+    Intent::GUILD_MESSAGE_REACTIONS
+      | Intent::DIRECT_MESSAGE_REACTIONS,                // MESSAGE_REACTION_REMOVE
+    Intent::GUILD_MESSAGE_REACTIONS
+      | Intent::DIRECT_MESSAGE_REACTIONS,                // MESSAGE_REACTION_REMOVE_ALL
+    Intent::GUILD_PRESENCES,                             // PRESENCE_UPDATE
+    Intent::GUILD_PRESENCES,                             // PRESENCES_REPLACE
+    Intent::GUILD_MESSAGE_TYPING
+      | Intent::DIRECT_MESSAGE_TYPING,                   // TYPING_START
+    Intent::GUILD_VOICE_STATES,                          // VOICE_STATE_UPDATE
+    0,                                                   // VOICE_SERVER_UPDATE
+    Intent::GUILD_WEBHOOKS                               // WEBHOOKS_UPDATE
+  };
+
+  // amount of perfect hash slots (power of two)
+  static const unsigned int EVENT_SLOTS = 512;
+
+  /**
+   * Seeded FNV-1a hash used for the event name perfect hash
+   * @param {const char*} name the event name
+   * @param {size_t} len the length of the name
+   * @param {uint32_t} seed the perfect hash seed
+   * @return {uint32_t} the hash of the name
+   */
+  static inline constexpr uint32_t
+  EventHash(const char *name, std::size_t len, uint32_t seed) {
+    uint32_t hash = 2166136261u ^ (seed * 0x9e3779b9u);
+    for (std::size_t i = 0; i < len; i++) {
+      hash ^= (unsigned char)name[i];
+      hash *= 16777619u;
+    }
+    hash ^= hash >> 15;
+    hash *= 0x2c1b3c6du;
+    hash ^= hash >> 12;
+    return hash;
+  }
+
+  // name length helper usable at compile time
+  static inline constexpr std::size_t EventNameLen(const char *name) {
+    std::size_t len = 0;
+    while (name[len] != '\0') len++;
+    return len;
+  }
+
+  // slot to event lookup table of the perfect hash
+  struct EventTable {
+    uint32_t seed;
+    unsigned char slots[EVENT_SLOTS];
+    unsigned char lengths[Event::COUNT];
+  };
+
+  /**
+   * Find a seed for which every event name hashes to a unique slot
+   * @return {EventTable} the collision free lookup table
+   */
+  static inline constexpr EventTable BuildEventTable() {
+    EventTable table = {};
+    for (unsigned int e = 0; e < Event::COUNT; e++)
+      table.lengths[e] = (unsigned char)EventNameLen(EventNames[e]);
+    for (uint32_t seed = 0;; seed++) {
+      bool unique = true;
+      for (unsigned int i = 0; i < EVENT_SLOTS; i++)
+        table.slots[i] = Event::UNKNOWN;
+      for (unsigned int e = 0; e < Event::COUNT && unique; e++) {
+        const uint32_t slot = EventHash(EventNames[e],
+          table.lengths[e], seed) & (EVENT_SLOTS - 1);
+        if (table.slots[slot] != Event::UNKNOWN) unique = false;
+        else table.slots[slot] = (unsigned char)e;
+      }
+      if (unique) {
+        table.seed = seed;
+        return table;
+      }
+    }
+  }
+
+  static constexpr EventTable EventLookup = BuildEventTable();
+  static_assert(Event::COUNT < 0xff, "Event ids must fit the slot table");
+
+  /**
+   * Map a gateway event name to its event id with a single hash
+   * @param {const char*} name the event name
+   * @param {size_t} len the length of the name
+   * @return {Event::Type} the event id or Event::UNKNOWN
+   */
+  static inline Event::Type EventFromName(const char *name, std::size_t len) {
+    const unsigned char e = EventLookup.slots[
+      EventHash(name, len, EventLookup.seed) & (EVENT_SLOTS - 1)];
+    if (e == Event::UNKNOWN || EventLookup.lengths[e] != len ||
+        std::memcmp(EventNames[e], name, len) != 0)
+      return Event::UNKNOWN;
+    return (Event::Type)e;
+  }
+}
@@ -0,0 +1,331 @@
+#include "fake.hh"
+#include "info.hh"
+#include <algorithm>
+#include <cstdlib>
+#include <arpa/inet.h>
+#include <openssl/sha.h>
+
+// appended to the client key before hashing it for the handshake
+static const char *WebsockGuid = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+
+/**
+ * Build an unmasked server frame
+ * @param {unsigned} opcode the frame opcode
+ * @param {string} payload the frame payload
+ * @return {Data} the frame
+ */
+static inline io::Data ServerFrame(unsigned opcode, const std::string &payload) {
+  io::Data frame;
+  const std::size_t len = payload.size();
+  frame.push_back((char)(0x80 | opcode));
+  if (len < 126) {
+    frame.push_back((char)len);
+  } else if (len <= 0xffff) {
+    frame.push_back((char)126);
+    frame.push_back((char)(len >> 8));
+    frame.push_back((char)len);
+  } else {
+    frame.push_back((char)127);
+    for (int shift = 56; shift >= 0; shift -= 8)
+      frame.push_back((char)(len >> shift));
+  }
+  frame.insert(frame.end(), payload.begin(), payload.end());
+  return frame;
+}
+
+/**
+ * Compute the Sec-WebSocket-Accept value of a handshake
+ * @param {string} request the http upgrade request
+ * @return {string} the accept value, empty if the key is missing
+ */
+static inline std::string AcceptKey(const std::string &request) {
+  std::string lower = request;
+  std::transform(lower.begin(), lower.end(), lower.begin(), ::tolower);
+  const std::size_t at = lower.find("sec-websocket-key:");
+  if (at == std::string::npos) return "";
+  const std::size_t start = request.find_first_not_of(" ", at + 18);
+  const std::size_t end = request.find("\r\n", start);
+  const std::string key = request.substr(start, end - start) + WebsockGuid;
+
+  unsigned char digest[SHA_DIGEST_LENGTH];
+  SHA1((const unsigned char*)key.data(), key.size(), digest);
+  char *encoded = io::b64_encode(digest, SHA_DIGEST_LENGTH);
+  const std::string accept = encoded != nullptr ? encoded : "";
+  free(encoded);
+  return accept;
+}
+
+/**
+ * Close a session with a status, like discord closing a shard
+ * @param {Socket} sock the session socket
+ * @param {int} status the close code
+ */
+static inline void CloseSocket(io::Socket *sock, int status) {
+  std::string payload;
+  payload.push_back((char)(status >> 8));
+  payload.push_back((char)status);
+  sock->Write(ServerFrame(io::Opcode::CLOSE, payload));
+  sock->End();
+}
+
+/**
+ * Start accepting shard connections
+ * @param {int} port the tcp port (0 picks a free one)
+ * @param {string} host the address to bind
+ * @return {bool} if listening
+ */
+bool cda::FakeGateway::listen(int port, const std::string &host) {
+  io::Socket *server = loop->listen(host, port);
+  if (server == nullptr) return false;
+
+  // find the port picked by the system
+  struct sockaddr_in addr;
+  socklen_t len = sizeof(addr);
+  if (getsockname(server->fd, (struct sockaddr*)&addr, &len) != 0)
+    return false;
+  this->host = host;
+  this->port = ntohs(addr.sin_port);
+
+  cda::FakeGateway *self = this;
+  server->onAccept([self](io::Socket *sock) {
+    std::shared_ptr<Session> session = std::make_shared<Session>();
+    session->sock = sock;
+    self->connections.push_back(session);
+
+    sock->onRead([self, session](io::Data &data) {
+      session->buffer.append(data.begin(), data.end());
+      self->receive(session);
+    });
+    sock->onClose([self, session](int err) {
+      session->sock = nullptr;
+      self->connections.erase(std::remove(self->connections.begin(),
+        self->connections.end(), session), self->connections.end());
+    });
+  });
+  return true;
+}
+
+/**
+ * Get the url shards connect to
+ * @return {string} the ws:// url
+ */
+std::string cda::FakeGateway::url() const {
+  return "ws://" + host + ":" + std::to_string(port) + "/";
+}
+
+/**
+ * Upgrade the connection and handle every complete frame received
+ * @param {Session} session the shard connection
+ */
+void cda::FakeGateway::receive(std::shared_ptr<Session> session) {
+  std::string &buffer = session->buffer;
+
+  // answer the upgrade request and greet with HELLO
+  if (!session->upgraded) {
+    const std::size_t end = buffer.find("\r\n\r\n");
+    if (end == std::string::npos) return;
+    const std::string accept = AcceptKey(buffer.substr(0, end + 2));
+    buffer.erase(0, end + 4);
+    if (accept.empty()) {
+      session->sock->Write("HTTP/1.1 400 Bad Request\r\n\r\n");
+      session->sock->End();
+      return;
+    }
+    session->sock->Write("HTTP/1.1 101 Switching Protocols\r\n"
+      "Upgrade: websocket\r\nConnection: Upgrade\r\n"
+      "Sec-WebSocket-Accept: " + accept + "\r\n\r\n");
+    session->upgraded = true;
+    send(*session, {{"op", (io::uint)cda::Op::HELLO},
+      {"d", {{"heartbeat_interval", heartbeat}}}});
+  }
+
+  // client frames are always masked
+  while (session->sock != nullptr && !session->sock->ending) {
+    const unsigned char *b = (const unsigned char*)buffer.data();
+    if (buffer.size() < 2) return;
+    const bool fin = b[0] & 0x80;
+    const unsigned opcode = b[0] & 0x0f;
+    std::size_t pos = 2;
+    uint64_t len = b[1] & 0x7f;
+    if (len == 126) {
+      if (buffer.size() < 4) return;
+      len = (b[2] << 8) | b[3];
+      pos = 4;
+    } else if (len == 127) {
+      if (buffer.size() < 10) return;
+      len = 0;
+      for (int i = 2; i < 10; i++) len = (len << 8) | b[i];
+      pos = 10;
+    }
+    const bool masked = b[1] & 0x80;
+    const std::size_t mask = pos;
+    if (masked) pos += 4;
+    if (buffer.size() < pos + len) return;
+
+    std::string payload = buffer.substr(pos, len);
+    if (masked)
+      for (std::size_t i = 0; i < payload.size(); i++)
+        payload[i] ^= buffer[mask + i % 4];
+    buffer.erase(0, pos + len);
+
+    switch (opcode) {
+      case io::Opcode::CLOSE: {
+        session->sock->Write(ServerFrame(io::Opcode::CLOSE, payload));
+        session->sock->End();
+        return;
+      }
+      case io::Opcode::PING: {
+        session->sock->Write(ServerFrame(io::Opcode::PONG, payload));
+        break;
+      }
+      case io::Opcode::PONG: break;
+      default: {
+        session->message += payload;
+        if (!fin) break;
+        std::string text;
+        text.swap(session->message);
+        handle(session, text);
+      }
+    }
+  }
+}
+
+/**
+ * Answer a gateway command the way discord does
+ * @param {Session} session the shard connection
+ * @param {string} text the received message
+ */
+void cda::FakeGateway::handle(std::shared_ptr<Session> session,
+  const std::string &text)
+{
+  io::json packet;
+  try {
+    packet = io::json::parse(text);
+  } catch (const std::exception &e) {
+    return CloseSocket(session->sock, cda::CloseCode::DECODE_ERROR);
+  }
+  if (!packet.is_object() || !packet["op"].is_number())
+    return CloseSocket(session->sock, cda::CloseCode::UNKNOWN_OPCODE);
+  io::json &data = packet["d"];
+
+  switch (packet["op"].get<io::uint>()) {
+    case cda::Op::HEARTBEAT: {
+      send(*session, {{"op", (io::uint)cda::Op::HEARTBEAT_ACK}});
+      break;
+    }
+
+    // start a session, listing the guilds of the shard
+    case cda::Op::IDENTIFY: {
+      if (session->shard >= 0)
+        return CloseSocket(session->sock,
+          cda::CloseCode::ALREADY_AUTHENTICATED);
+      io::uint shard = 0, total = 1;
+      if (data.is_object() && data["shard"].is_array()) {
+        shard = data["shard"][0];
+        total = std::max<io::uint>(1, data["shard"][1]);
+      }
+      identifies++;
+      session->shard = (int)shard;
+      session->id = "fake-" + std::to_string(++counter);
+      shards[session->id] = (int)shard;
+
+      io::json available = io::json::array();
+      for (cda::snowflake gid : guilds)
+        if ((gid >> 22) % total == shard)
+          available.push_back({{"id", std::to_string(gid)},
+            {"unavailable", true}});
+      event(*session, "READY", {
+        {"v", 10},
+        {"session_id", session->id},
+        {"user", {{"id", "1"}, {"username", "fake"},
+          {"discriminator", "0000"}, {"bot", true}}},
+        {"guilds", available},
+        {"shard", {shard, total}}
+      });
+      break;
+    }
+
+    // continue a session of an earlier connection
+    case cda::Op::RESUME: {
+      const std::string id = data.is_object() && data["session_id"].is_string()
+        ? data["session_id"].get<std::string>() : "";
+      auto known = shards.find(id);
+      if (known == shards.end()) {
+        send(*session, {{"op", (io::uint)cda::Op::INVALID_SESSION},
+          {"d", false}});
+        break;
+      }
+      resumes++;
+      session->shard = known->second;
+      session->id = id;
+      if (data["seq"].is_number()) session->seq = data["seq"];
+      event(*session, "RESUMED", io::json::object());
+      break;
+    }
+
+    default: {
+      if (session->shard < 0)
+        return CloseSocket(session->sock, cda::CloseCode::NOT_AUTHENTICATED);
+      commands++;
+    }
+  }
+}
+
+/**
+ * Send a gateway packet to a session
+ * @param {Session} session the shard connection
+ * @param {json} packet the packet
+ */
+void cda::FakeGateway::send(Session &session, const io::json &packet) {
+  if (session.sock == nullptr || session.sock->ending) return;
+  session.sock->Write(ServerFrame(io::Opcode::TEXT, packet.dump()));
+}
+
+/**
+ * Send a DISPATCH with the next sequence
+ * @param {Session} session the shard connection
+ * @param {string} name the event name
+ * @param {json} data the d field
+ */
+void cda::FakeGateway::event(Session &session, const std::string &name,
+  io::json data)
+{
+  send(session, {{"op", (io::uint)cda::Op::DISPATCH}, {"t", name},
+    {"s", ++session.seq}, {"d", std::move(data)}});
+}
+
+/**
+ * Send a DISPATCH to every session of a shard
+ * @param {uint} shard the shard id
+ * @param {string} name the event name, ex: GUILD_CREATE
+ * @param {json} data the d field
+ */
+void cda::FakeGateway::dispatch(io::uint shard, const std::string &name,
+  const io::json &data)
+{
+  for (std::shared_ptr<Session> &session : connections)
+    if (session->shard == (int)shard) event(*session, name, data);
+}
+
+/**
+ * Close the connections of a shard
+ * @param {uint} shard the shard id
+ * @param {int} status the close code
+ */
+void cda::FakeGateway::close(io::uint shard, int status) {
+  for (std::shared_ptr<Session> &session : connections)
+    if (session->shard == (int)shard && !session->sock->ending)
+      CloseSocket(session->sock, status);
+}
+
+/**
+ * Count the identified or resumed sessions of a shard
+ * @param {uint} shard the shard id
+ * @return {uint} the amount of live sessions
+ */
+io::uint cda::FakeGateway::sessions(io::uint shard) const {
+  io::uint count = 0;
+  for (const std::shared_ptr<Session> &session : connections)
+    if (session->shard == (int)shard && !session->sock->ending) count++;
+  return count;
+}
@@ -0,0 +1,89 @@
+#pragma once
+
+#include "cluster.hh"
+
+namespace cda {
+
+  class FakeGateway {
+  /**
+   * Local stand-in for the discord gateway, to run shards and clusters
+   * without a token or network. Point Client::launch or the cluster
+   * gateway at url(). It answers HELLO, IDENTIFY, RESUME and heartbeats
+   * like discord does and lets the caller dispatch events and close
+   * shards. Json encoding only, without compression.
+   */
+  public:
+    io::uint heartbeat = 41250;        // heartbeat interval sent in HELLO
+    std::vector<snowflake> guilds;     // guild ids, listed in READY by shard
+    io::uint identifies = 0;           // IDENTIFY commands received
+    io::uint resumes = 0;              // RESUME commands received
+    io::uint commands = 0;             // other commands received
+
+    /**
+     * Create the fake gateway
+     * @param {Loop} loop the loop to serve on
+     */
+    inline FakeGateway(io::Loop *loop) : loop(loop) {}
+
+    /**
+     * Start accepting shard connections
+     * @param {int} port the tcp port (0 picks a free one)
+     * @param {string} host the address to bind
+     * @return {bool} if listening
+     */
+    bool listen(int port = 0, const std::string &host = "127.0.0.1");
+
+    /**
+     * Get the url shards connect to
+     * @return {string} the ws:// url
+     */
+    std::string url() const;
+
+    /**
+     * Send a DISPATCH to every session of a shard
+     * @param {uint} shard the shard id
+     * @param {string} event the event name, ex: GUILD_CREATE
+     * @param {json} data the d field
+     */
+    void dispatch(io::uint shard, const std::string &event,
+      const io::json &data);
+
+    /**
+     * Close the connections of a shard, ex: with a CloseCode to test
+     * reconnects or fatal closes
+     * @param {uint} shard the shard id
+     * @param {int} status the close code
+     */
+    void close(io::uint shard, int status);
+
+    /**
+     * Count the identified or resumed sessions of a shard
+     * @param {uint} shard the shard id
+     * @return {uint} the amount of live sessions
+     */
+    io::uint sessions(io::uint shard) const;
+
+  private:
+    struct Session {
+      io::Socket *sock = nullptr;
+      std::string buffer;   // received bytes not forming a frame yet
+      std::string message;  // fragments of the current message
+      bool upgraded = false;
+      int shard = -1;       // shard id once identified
+      int seq = 0;          // last sequence sent
+      std::string id;       // the session id
+    };
+
+    void receive(std::shared_ptr<Session> session);
+    void handle(std::shared_ptr<Session> session, const std::string &text);
+    void send(Session &session, const io::json &packet);
+    void event(Session &session, const std::string &name, io::json data);
+
+    io::Loop *loop;
+    std::string host;                                // the bound address
+    int port = 0;                                    // the bound port
+    io::uint counter = 0;                            // session ids given
+    std::map<std::string, int> shards;               // shard by session id
+    std::vector<std::shared_ptr<Session>> connections;
+  };
+}
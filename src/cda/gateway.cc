@@ -1,29 +1,193 @@
 #include "gateway.hh"
 #include "client.hh"
 #include "info.hh"
+#include <random>
+#include <optional>
+
+// jitter source for the first heartbeat
+static std::random_device RNG;
+static std::mt19937 Rand(RNG());
 
 /** packet event handler declaration */
-void handleEvent(cda::Gateway* shard, io::json &packet);
+void handleEvent(cda::Gateway* shard, const std::string &name,
+  io::LazyJson &data);
+
+/**
+ * Build the tree of a payload, logging the ones that are not valid json
+ * @param {Gateway} shard the shard that received it
+ * @param {string} name the event or opcode name for the log
+ * @param {LazyJson} data the payload (the d field)
+ * @return {json*} the payload tree or nullptr
+ */
+static io::json *Payload(cda::Gateway *shard, const std::string &name,
+  io::LazyJson &data)
+{
+  try {
+    return &data.get();
+  } catch (const std::exception &e) {
+    std::cerr << "[cda] Shard " << shard->id << " bad " << name
+      << " payload: " << e.what() << std::endl;
+    return nullptr;
+  }
+}
+
+/**
+ * Check for an opcode or sequence, etf sends small ones as signed integers
+ * @param {json} value the packet field
+ * @return {bool} whether it is a non negative integer
+ */
+static inline bool Counter(const io::json &value) {
+  return value.is_number_integer() && value.get<int64_t>() >= 0;
+}
 
 /**
  * Initialize a websocket client as well as store client
  */
-cda::Gateway::Gateway(io::uint id, io::uint shards, cda::Client *c) {
+cda::Gateway::Gateway(io::uint id, io::uint shards, cda::Client *c) :
+  outbox(this, c->loop), backoff(&c->reconnects)
+{
   this->id = id;
   this->client = c;
   this->shards = shards;
   this->conn = std::make_shared<io::WebsockClient>(client->loop);
+
+  // register the shard metrics, events are added as they arrive
+  io::Metrics &m = client->metrics;
+  const std::string shard = io::Metrics::Labels({{"shard", std::to_string(id)}});
+  metrics.received = &m.counter("cda_gateway_received_bytes_total",
+    "Bytes of gateway messages received", shard);
+  metrics.sent = &m.counter("cda_gateway_sent_bytes_total",
+    "Bytes of gateway messages sent", shard);
+  metrics.reconnects = &m.counter("cda_gateway_reconnects_total",
+    "Gateway reconnects scheduled", shard);
+  metrics.identifies = &m.counter("cda_gateway_sessions_total",
+    "Gateway sessions started or resumed", shard + ",kind=\"identify\"");
+  metrics.resumes = &m.counter("cda_gateway_sessions_total",
+    "Gateway sessions started or resumed", shard + ",kind=\"resume\"");
+  metrics.heartbeat = &m.histogram("cda_gateway_heartbeat_seconds",
+    "Gateway heartbeat round trip time", shard, 1e-6);
+  metrics.events.resize(cda::Event::COUNT, nullptr);
+}
+
+// packet prefixes up to the d value, the value is appended after them
+static const char JsonPrefix[] = "{\"op\":";
+static const char JsonData[] = ",\"d\":";
+static const unsigned char EtfPrefix[] = {
+  io::Etf::VERSION, io::Etf::MAP_EXT, 0, 0, 0, 2,
+  io::Etf::BINARY_EXT, 0, 0, 0, 2, 'o', 'p'
+};
+static const unsigned char EtfData[] = {
+  io::Etf::BINARY_EXT, 0, 0, 0, 1, 'd'
+};
+
+// prebuilt heartbeat packets, only the sequence is appended
+static const char JsonHeartbeat[] = "{\"op\":1,\"d\":";
+static const unsigned char EtfHeartbeat[] = {
+  io::Etf::VERSION, io::Etf::MAP_EXT, 0, 0, 0, 2,
+  io::Etf::BINARY_EXT, 0, 0, 0, 2, 'o', 'p',
+  io::Etf::SMALL_INTEGER_EXT, cda::Op::HEARTBEAT,
+  io::Etf::BINARY_EXT, 0, 0, 0, 1, 'd'
+};
+static const unsigned char EtfNil[] = {io::Etf::ATOM_EXT, 0, 3, 'n', 'i', 'l'};
+
+/**
+ * Send a frame built in a Buffer(), counting the bytes sent
+ * @param {Gateway} shard the shard sending the frame
+ * @param {Data&&} frame the frame
+ * @param {unsigned} opcode the websocket opcode
+ */
+static inline void Transmit(cda::Gateway *shard, io::Data &&frame,
+  unsigned opcode)
+{
+  shard->metrics.sent->add(frame.size() - io::FRAME_HEADROOM);
+  shard->conn->Send(std::move(frame), opcode);
+}
+
+// append bytes to a frame buffer
+template <typename T, std::size_t N>
+static inline void Append(io::Data &frame, const T (&bytes)[N]) {
+  const std::size_t len = std::is_same<T, char>::value ? N - 1 : N;
+  frame.insert(frame.end(), (const char*)bytes, (const char*)bytes + len);
+}
+
+// append an ETF integer term
+static inline void AppendEtfInt(io::Data &frame, int32_t value) {
+  if (value >= 0 && value <= 0xff) {
+    frame.push_back((char)io::Etf::SMALL_INTEGER_EXT);
+    frame.push_back((char)value);
+    return;
+  }
+  frame.push_back((char)io::Etf::INTEGER_EXT);
+  for (int i = 24; i >= 0; i -= 8)
+    frame.push_back((char)(((uint32_t)value >> i) & 0xff));
 }
 
 /**
- * Send a gateway message
+ * Send a gateway message, priority ones skip the outbox
  * @param {uint} op the gateway opcode
  * @param {json} data the data to send
  */
-void cda::Gateway::send(io::uint op, io::json data) {
-  io::json packet = {{"op", op}, {"d", data}};
-  if (conn->isConnected())
-    conn->Send(packet.dump());
+void cda::Gateway::send(io::uint op, const io::json &data) {
+  if (op == cda::Op::HEARTBEAT || op == cda::Op::IDENTIFY
+      || op == cda::Op::RESUME) {
+    outbox.take();
+    write(op, data);
+  } else outbox.push(op, data);
+}
+
+/**
+ * Append the start of a gateway message, up to the d value
+ * @param {Data&} frame the buffer to append to
+ * @param {bool} etf if the message is ETF encoded
+ * @param {uint} op the gateway opcode
+ */
+static inline void AppendHead(io::Data &frame, bool etf, io::uint op) {
+  if (etf) {
+    Append(frame, EtfPrefix);
+    AppendEtfInt(frame, (int32_t)op);
+    Append(frame, EtfData);
+  } else {
+    const std::string code = std::to_string(op);
+    Append(frame, JsonPrefix);
+    frame.insert(frame.end(), code.begin(), code.end());
+    Append(frame, JsonData);
+  }
+}
+
+/**
+ * Write a gateway message, serialized straight into the frame buffer.
+ * With fragmentSize set it is serialized into a stream instead, which
+ * sends every full fragment while the rest is still being written.
+ * @param {uint} op the gateway opcode
+ * @param {json} data the data to send
+ */
+void cda::Gateway::write(io::uint op, const io::json &data) {
+  if (!conn->isConnected()) return;
+  const bool etf = client->etf;
+  const unsigned opcode = etf ? io::Opcode::BIN : io::Opcode::TEXT;
+  if (conn->fragmentSize > 0) {
+    io::Data head;
+    AppendHead(head, etf, op);
+    io::WebsockStream stream = conn->Stream(opcode);
+    stream.write(head.data(), head.size());
+    if (etf) io::EtfEncode(data, stream, false);
+    else {
+      io::JsonWrite(data, stream);
+      stream.put('}');
+    }
+    stream.end();
+    metrics.sent->add(stream.size());
+    return;
+  }
+
+  io::Data frame = io::WebsockClient::Buffer(256);
+  AppendHead(frame, etf, op);
+  if (etf) io::EtfEncode(data, frame, false);
+  else {
+    io::JsonWrite(data, frame);
+    frame.push_back('}');
+  }
+  Transmit(this, std::move(frame), opcode);
 }
 
 /**
@@ -31,19 +195,53 @@ void cda::Gateway::send(io::uint op, io::json data) {
  * @param {Gateway} shard the gateway thats trying to connect
  */
 static inline void Connect(cda::Gateway* shard) {
+  const std::string url = shard->url +
+    (shard->client->etf ? cda::ApiVersionEtf : cda::ApiVersion);
   std::cerr << "[cda] Shard " << shard->id << " connecting to: "
-    << (shard->url + cda::ApiVersion) << std::endl;
-  if (!shard->conn->Connect(shard->url + cda::ApiVersion)) {
+    << url << std::endl;
+  if (!shard->conn->Connect(url)) {
+    const long delay = shard->backoff.next();
+    shard->metrics.reconnects->add();
     std::cerr << "[cda] Shard " << shard->id << 
       " failed to connect to gateway!" << std::endl;
     std::cerr << "[cda] Shard " << shard->id << 
-      " retrying in 5 seconds" << std::endl;
-    shard->client->loop->later(5000, [shard](){
+      " retrying in " << delay << "ms" << std::endl;
+    shard->client->loop->later(delay, [shard](){
       Connect(shard);
     });
   }
 }
 
+// how a shard comes back after its connection closed
+enum class CloseAction { RESUME, IDENTIFY, STOP };
+
+/**
+ * Decide how a shard comes back from a close
+ * @param {int} status the close status
+ * @return {CloseAction} resume the session, start a new one or give up
+ */
+static inline CloseAction Classify(int status) {
+  switch (status) {
+    // the session cannot be resumed
+    case cda::CloseCode::INVALID_SEQ:
+    case cda::CloseCode::SESSION_TIMED_OUT:
+      return CloseAction::IDENTIFY;
+
+    // reconnecting would fail the same way
+    case cda::CloseCode::AUTHENTICATION_FAILED:
+    case cda::CloseCode::INVALID_SHARD:
+    case cda::CloseCode::SHARDING_REQUIRED:
+    case cda::CloseCode::INVALID_API_VERSION:
+    case cda::CloseCode::INVALID_INTENTS:
+    case cda::CloseCode::DISALLOWED_INTENTS:
+      return CloseAction::STOP;
+
+    // anything else keeps the session
+    default:
+      return CloseAction::RESUME;
+  }
+}
+
 /**
  * Start the gateway client
  * @param {string} url the base url to connect to
@@ -58,49 +256,156 @@ void cda::Gateway::start(const std::string &_url) {
   });
 
   // respawn connection when killed
-  conn->onClose([self, _url](int status, std::string reason){
-    std::cerr << "Shard " << self->id  << " disconnected" << std::endl;
-    self->client->loop->later(1000, [self](){
+  conn->onClose([self](int status, std::string reason){
+    std::cerr << "[cda] Shard " << self->id  << " disconnected with "
+      << status << (reason.empty() ? "" : ": " + reason) << std::endl;
+    self->closed = status;
+    self->hello = false;
+    self->outbox.close();
+    self->client->launcher.abort(self);
+
+    // fatal codes need a configuration change first
+    const CloseAction action = Classify(status);
+    if (action == CloseAction::STOP) {
+      std::cerr << "[cda] Shard " << self->id
+        << " closed with a fatal code, not reconnecting" << std::endl;
+      self->reconnect = false;
+      self->client->launcher.stopped(self,
+        (io::uint)self->client->shards.size());
+    }
+    if (!self->reconnect) return;
+
+    // resume the session unless it was invalidated
+    if (action == CloseAction::IDENTIFY) {
+      self->session_id.clear();
+      if (self->client->sessions.get() != nullptr)
+        self->client->sessions->clear(self->id);
+    }
+    self->resume = !self->session_id.empty();
+    const long delay = self->backoff.next();
+    self->metrics.reconnects->add();
+    std::cerr << "[cda] Shard " << self->id << " reconnecting in "
+      << delay << "ms (attempt " << self->backoff.attempts << ")" << std::endl;
+    self->client->loop->later(delay, [self](){
       Connect(self);
     });
   });
   
-  // start connection
+  // resume a stored session right away or wait for an identify slot
+  if (client->sessions.get() != nullptr && client->sessions->load(this)) {
+    std::cerr << "[cda] Shard " << id << " resuming stored session" << std::endl;
+    connect();
+  } else client->launcher.request(this);
+}
+
+/**
+ * Open the websocket connection
+ */
+void cda::Gateway::connect() {
   Connect(this);
 }
 
 /**
- * Start heartbeat
+ * Send a heartbeat then schedule the next one. Heartbeats use the
+ * urgent timer lane so a backlog of dispatches cannot delay them.
+ * @param {Gateway} shard the gateway to heartbeat
+ * @param {uint} gen the schedule the timer belongs to
  */
-void cda::Gateway::beat() {
-  // check if connected
-  if (!conn->isConnected()) return;
+static void Heartbeat(cda::Gateway *shard, io::uint gen) {
+  // check if the schedule was replaced or disconnected
+  if (gen != shard->beatGen) return;
+  if (!shard->conn->isConnected()) return;
+
+  // reconnect if heartbeat was not acknowledged (the ack may still be
+  // unread while throttled, but only give it a couple of intervals)
+  const bool waiting = shard->throttled && io::Clock::now() -
+    shard->throttledAt < std::chrono::milliseconds(2 * shard->beatInter);
+  if (!shard->acked && !waiting) {
+    std::cerr << "[cda] Shard " << shard->id
+      << " missed a heartbeat ack, reconnecting" << std::endl;
+    shard->resume = true;
+    shard->beatGen++;
 
-  // exit if heartbeat was not acknowledged
-  if (!acked) {
-    resume = true;
-    conn->Close(1000, "");
+    // drop the dead connection without a close handshake, a 1000
+    // close would also end the session
+    shard->client->loop->post([shard](){
+      shard->conn->Close(1006, "heartbeat ack missed");
+    });
     return;
   }
 
-  // create data to send in heartbeat
-  io::json data;
-  if (seq >= 0)
-    data = io::json::parse(std::to_string(seq));
-  else
-    data = io::json::parse("null");
-  
-  // send data and reset ack
-  send(cda::Op::HEARTBEAT, data);
-  acked = false;
+  shard->beat();
+  shard->client->loop->urgent(shard->beatInter, [shard, gen](){
+    Heartbeat(shard, gen);
+  });
+}
 
-  // continue heartbeat
+/**
+ * Start heartbeating after a random fraction of the interval,
+ * replacing any previous heartbeat schedule
+ */
+void cda::Gateway::startBeat() {
+  const io::uint gen = ++beatGen;
+  std::uniform_int_distribution<io::uint> jitter(0, beatInter);
   cda::Gateway *self = this;
-  client->loop->later(beatInter, [self](){
-    self->beat();
+  acked = true;
+  client->loop->urgent(jitter(Rand), [self, gen](){
+    Heartbeat(self, gen);
   });
 }
 
+/**
+ * Send a heartbeat right away, from the prebuilt packet
+ */
+void cda::Gateway::beat() {
+  if (!conn->isConnected()) return;
+  outbox.take();
+  io::Data frame = io::WebsockClient::Buffer(sizeof(EtfHeartbeat) + 16);
+  if (client->etf) {
+    Append(frame, EtfHeartbeat);
+    if (seq >= 0) AppendEtfInt(frame, seq);
+    else Append(frame, EtfNil);
+    Transmit(this, std::move(frame), io::Opcode::BIN);
+  } else {
+    const std::string sequence = seq >= 0 ? std::to_string(seq) : "null";
+    Append(frame, JsonHeartbeat);
+    frame.insert(frame.end(), sequence.begin(), sequence.end());
+    frame.push_back('}');
+    Transmit(this, std::move(frame), io::Opcode::TEXT);
+  }
+
+  // reset ack
+  beatSent = io::Clock::now();
+  acked = false;
+}
+
+/**
+ * Resume reading once the executor drained below half its capacity
+ * @param {Gateway} shard the throttled gateway
+ */
+static inline void Unthrottle(cda::Gateway *shard) {
+  io::Executor &executor = shard->client->executor;
+  if (executor.pending() > executor.capacity / 2) {
+    shard->client->loop->later(10, [shard](){
+      Unthrottle(shard);
+    });
+    return;
+  }
+  shard->throttled = false;
+  shard->conn->Resume();
+}
+
+/**
+ * Pause reading until the client executor catches up
+ */
+void cda::Gateway::throttle() {
+  if (throttled) return;
+  throttled = true;
+  throttledAt = io::Clock::now();
+  conn->Pause();
+  Unthrottle(this);
+}
+
 /**
  * Identify the shard with info
  */
@@ -109,12 +414,19 @@ void cda::Gateway::identify() {
   io::json data;
   
   // create inital identify packet
-  if (!resume) {
+  if (!resume || session_id.empty()) {
     op = cda::Op::IDENTIFY;
+    granted = false;
+    metrics.identifies->add();
+    client->launcher.identified(this);
+    const uint32_t intents = client->intents();
     data = {
       {"token", client->token},
       {"compress", false},
       {"large_threshold", 250},
+      {"intents", intents},
+      {"guild_subscriptions", (intents & (cda::Intent::GUILD_PRESENCES
+        | cda::Intent::GUILD_MESSAGE_TYPING)) != 0},
       {"shard", io::json::array({id, shards})},
       {"properties", {
         {"$os", cda::OSName()},
@@ -128,6 +440,7 @@ void cda::Gateway::identify() {
   // create resume packet
   } else {
     op = cda::Op::RESUME;
+    metrics.resumes->add();
     data = {
       {"seq", seq},
       {"token", client->token},
@@ -144,44 +457,116 @@ void cda::Gateway::identify() {
  * @param {Frame} frame the incoming websocket frame
  */
 void cda::Gateway::handle(io::Frame &frame) {
-  // dont parse json!
-  if (frame.data[0] != '{') return;
-  char end = frame.data[std::strlen(frame.data)-1];
-  if (end != '}') return;
-
-  // extract data from frame
-  io::json data = io::json::parse(frame.data);
-  if (data.find("s") != data.end())
-    if (!data["s"].is_null())
-      seq = data["s"].get<io::uint>();
-  std::cerr << data.dump(2) << std::endl;
+  uint64_t op = 0, s = 0;
+  bool sequenced = false;
+  std::string event;
+  io::LazyJson data;
+  std::optional<io::JsonDocument> doc;
+  metrics.received->add(frame.len);
+
+  // decode binary etf payloads
+  if (frame.opcode == io::Opcode::BIN) {
+    io::json packet;
+    try {
+      packet = io::EtfDecode(frame.data, frame.len);
+    } catch (const std::invalid_argument &e) {
+      std::cerr << "[cda] Shard " << id << " bad ETF payload: "
+        << e.what() << std::endl;
+      return;
+    }
+    if (!packet.is_object() || !Counter(packet["op"])) return;
+    op = packet["op"].get<uint64_t>();
+    if ((sequenced = Counter(packet["s"])))
+      s = packet["s"].get<uint64_t>();
+    if (packet["t"].is_string())
+      event = *packet["t"].get_ptr<const std::string*>();
+    data = io::LazyJson(std::move(packet["d"]));
+
+  // index the json text, d is only parsed once something reads it
+  } else {
+    try {
+      doc.emplace(frame.data, frame.len);
+    } catch (const std::invalid_argument &e) {
+      std::cerr << "[cda] Shard " << id << " bad JSON payload: "
+        << e.what() << std::endl;
+      return;
+    }
+    io::JsonView packet = doc->root();
+    if (!packet["op"].get(op)) return;
+    sequenced = packet["s"].get(s);
+    packet["t"].get(event);
+    data = io::LazyJson(packet["d"]);
+  }
+  if (sequenced) {
+    seq = (int)s;
+    if (client->sessions.get() != nullptr)
+      client->sessions->sequence(id, seq);
+  }
 
   // handle discord opcodes
-  switch (data["op"].get<io::uint>()) {
+  switch (op) {
 
     // handle hello packets
     case cda::Op::HELLO: {
-      beatInter = data["d"]["heartbeat_interval"];
-      beatInter -= 100; // go under the limit
-      identify();
+      io::json *d = Payload(this, "HELLO", data);
+      if (d == nullptr) return;
+      const io::json *interval = d->is_object()
+        && d->find("heartbeat_interval") != d->end()
+        ? &(*d)["heartbeat_interval"] : nullptr;
+      if (interval == nullptr || !interval->is_number_integer()
+          || interval->get<int64_t>() <= 0) {
+        std::cerr << "[cda] Shard " << id << " HELLO without a heartbeat"
+          << " interval" << std::endl;
+        return;
+      }
+      beatInter = interval->get<io::uint>();
+      if (beatInter > 100) beatInter -= 100; // go under the limit
+      hello = true;
+      startBeat();
+
+      // resumes skip the identify queue
+      if (granted || (resume && !session_id.empty()))
+        identify();
+      else
+        client->launcher.request(this);
+      break;
+    }
+
+    // handle heartbeat requests
+    case cda::Op::HEARTBEAT: {
+      beat();
       break;
     }
 
     // handle gateway events
     case cda::Op::DISPATCH: {
-      handleEvent(this, data);
+      handleEvent(this, event, data);
+      client->loop->poll(); // big payloads must not stall heartbeats
+      if (client->executor.saturated())
+        throttle();
       break;
     }
 
     // handle heartbeat acks
     case cda::Op::HEARTBEAT_ACK: {
+      if (!acked) {
+        const io::Duration rtt = io::Clock::now() - beatSent;
+        latency = std::chrono::duration_cast<std::chrono::milliseconds>(
+          rtt).count();
+        metrics.heartbeat->record((uint64_t)(rtt.count() * 1e6));
+      }
       acked = true;
       break;
     }
 
     // handle invalid sessions
     case cda::Op::INVALID_SESSION: {
-      resume = false;
+      // d tells if the session can still be resumed
+      io::json *d = Payload(this, "INVALID_SESSION", data);
+      resume = d != nullptr && d->is_boolean() && d->get<bool>();
+      if (!resume) session_id.clear();
+      if (!resume && client->sessions.get() != nullptr)
+        client->sessions->clear(id);
       cda::Gateway *self = this;
       client->loop->later(5000, [self](){
         self->conn->Close(1011, "");
@@ -189,30 +574,409 @@ void cda::Gateway::handle(io::Frame &frame) {
       break;
     }
 
-    // handle reconnect
+    // reconnect and resume when the gateway asks for it
     case cda::Op::RECONNECT: {
+      conn->Close(cda::CloseCode::UNKNOWN_ERROR, "reconnect");
       break;
     }
   }
 }
 
 /**
- * Handle DISPATCH event packets for gateway
- * @param {Gateway} shard the gateway shard to handle from
- * @param {json} packet the packet to handle or use
- */
-void handleEvent(cda::Gateway *shard, io::json &packet) {
-  std::string event = packet["t"];
-  io::json &data    = packet["d"];
- 
-  if (event == "RESUMED") {
-    shard->resume = false;
-    shard->beat();
-
-  } else if (event == "READY") {
-    shard->beat();
-    for (io::json &guild : data["guilds"]) {
-      
-    }
+ * Hand an event to its listeners on the client executor. Events with
+ * the same key (guild) reach listeners in the order they arrived.
+ * Cache entities must be passed as copies taken on the loop, since
+ * later events patch and erase the cached ones in place.
+ * @param {Client} client the client owning the listeners
+ * @param {snowflake} key the ordering key of the event
+ * @param {Args} args the event arguments (copied for the worker)
+ */
+template <typename Sig, typename ...Args>
+static inline void Post(cda::Client *client,
+  cda::snowflake key, const Args&... args)
+{
+  if (!client->events.has(Sig::id)) return;
+  client->executor.post(key, [client, args...]() {
+    client->events.emit<Sig>(args...);
+  });
+}
+
+/**
+ * If a typed signal has listeners, worth copying the entities for
+ * @param {Client} client the client owning the listeners
+ * @return {bool} whether posting would invoke anything
+ */
+template <typename Sig>
+static inline bool Listened(cda::Client *client) {
+  return client->events.has(Sig::id);
+}
+
+/**
+ * Copy a guild entity for listeners, pointing it to a copy of the guild
+ * attributes that the returned pointer keeps alive
+ * @param {Guild} guild the cached guild
+ * @param {T} entity the cached member or channel
+ * @return {T} the detached copy
+ */
+template <typename T>
+static std::shared_ptr<T> Detach(const std::shared_ptr<cda::Guild> &guild,
+  const std::shared_ptr<T> &entity)
+{
+  typedef std::pair<std::shared_ptr<cda::Guild>, std::shared_ptr<T>> Pinned;
+  std::shared_ptr<T> copy = std::static_pointer_cast<T>(entity->copy());
+  std::shared_ptr<Pinned> pinned =
+    std::make_shared<Pinned>(guild->copy(false), copy);
+  copy->guild = pinned->first.get();
+  return std::shared_ptr<T>(pinned, copy.get());
+}
+
+/** DISPATCH event handler signature */
+typedef void (*EventHandler)(cda::Gateway *shard, io::json &data);
+
+/** DISPATCH handler reading a scanned payload without building a tree */
+typedef void (*ViewHandler)(cda::Gateway *shard, const io::JsonView &data);
+
+/**
+ * Get the guild an event payload belongs to
+ * @param {Client} client the client holding the cache
+ * @param {json} data the event payload with a guild_id
+ * @return {Guild} the cached guild or nullptr
+ */
+static inline std::shared_ptr<cda::Guild>
+EventGuild(cda::Client *client, io::json &data) {
+  if (data.find("guild_id") == data.end()) return nullptr;
+  return client->getGuild(cda::toId(data["guild_id"]));
+}
+static inline std::shared_ptr<cda::Guild>
+EventGuild(cda::Client *client, const io::JsonView &data) {
+  io::JsonView gid = data["guild_id"];
+  if (!gid) return nullptr;
+  return client->getGuild(cda::toId(gid));
+}
+
+static void onReady(cda::Gateway *shard, io::json &data) {
+  cda::Client *client = shard->client;
+  shard->session_id = data["session_id"];
+  client->launcher.ready(shard, (io::uint)client->shards.size());
+  shard->outbox.open();
+  shard->backoff.reset();
+  if (client->sessions.get() != nullptr)
+    client->sessions->save(shard);
+
+  // cache the bot user
+  if (client->user.get() == nullptr)
+    client->user = std::make_shared<cda::User>();
+  client->user->parse(data["user"]);
+
+  // cache unavailable guilds until their GUILD_CREATE arrives
+  std::vector<cda::snowflake> ids;
+  for (io::json &g : data["guilds"]) {
+    const cda::snowflake gid = cda::toId(g["id"]);
+    ids.push_back(gid);
+    if (client->getGuild(gid).get() == nullptr)
+      client->guilds.push_back(
+        std::make_shared<cda::Guild>(gid, client));
   }
-}
\ No newline at end of file
+
+  // drop snapshot guilds of this shard the bot is no longer in
+  const cda::snowflake shards = std::max<cda::snowflake>(1, shard->shards);
+  client->guilds.erase(std::remove_if(client->guilds.begin(),
+    client->guilds.end(), [&ids, shard, shards](std::shared_ptr<cda::Guild> &g) {
+      return g->stale && (g->id >> 22) % shards == shard->id
+        && std::find(ids.begin(), ids.end(), g->id) == ids.end();
+    }), client->guilds.end());
+  Post<cda::Signals::Ready>(client, 0);
+}
+
+static void onResumed(cda::Gateway *shard, io::json &data) {
+  cda::Client *client = shard->client;
+  shard->resume = false;
+
+  // a session handed over from an earlier process counts as launched
+  client->launcher.ready(shard, (io::uint)client->shards.size());
+  shard->outbox.open();
+  shard->backoff.reset();
+  Post<cda::Signals::Resumed>(client, 0);
+}
+
+template <typename Payload>
+static void onGuildCreate(cda::Gateway *shard, Payload &data) {
+  cda::Client *client = shard->client;
+  const cda::snowflake gid = cda::toId(data["id"]);
+  std::shared_ptr<cda::Guild> guild = client->getGuild(gid);
+  if (guild.get() == nullptr) {
+    guild = std::make_shared<cda::Guild>(gid, client);
+    client->guilds.push_back(guild);
+  }
+  guild->unavailable = false;
+  guild->stale = false;
+  guild->parse(data);
+  if (Listened<cda::Signals::GuildCreate>(client))
+    Post<cda::Signals::GuildCreate>(client, gid, guild->copy());
+}
+
+static void onGuildUpdate(cda::Gateway *shard, io::json &data) {
+  cda::Client *client = shard->client;
+  std::shared_ptr<cda::Guild> guild = client->getGuild(cda::toId(data["id"]));
+  if (guild.get() == nullptr) return;
+  guild->parse(data);
+  if (Listened<cda::Signals::GuildUpdate>(client))
+    Post<cda::Signals::GuildUpdate>(client, guild->id, guild->copy());
+}
+
+static void onGuildDelete(cda::Gateway *shard, io::json &data) {
+  cda::Client *client = shard->client;
+  std::shared_ptr<cda::Guild> guild = client->getGuild(cda::toId(data["id"]));
+  if (guild.get() == nullptr) return;
+
+  // outages only mark the guild as unavailable
+  if (data.find("unavailable") != data.end() && data["unavailable"] == true)
+    guild->unavailable = true;
+  else
+    client->guilds.erase(std::find(
+      client->guilds.begin(), client->guilds.end(), guild));
+  if (Listened<cda::Signals::GuildDelete>(client))
+    Post<cda::Signals::GuildDelete>(client, guild->id, guild->copy());
+}
+
+static void onChannelCreate(cda::Gateway *shard, io::json &data) {
+  std::shared_ptr<cda::Guild> guild = EventGuild(shard->client, data);
+  if (guild.get() == nullptr) return;
+  std::shared_ptr<cda::Channel> channel =
+    guild->getChannel(cda::toId(data["id"]));
+  if (channel.get() == nullptr) {
+    channel = cda::Channel::create(data["type"]);
+    if (channel.get() == nullptr) return;
+    channel->client = shard->client;
+    channel->guild = guild.get();
+    guild->channels.push_back(channel);
+  }
+  channel->parse(data);
+  if (Listened<cda::Signals::ChannelCreate>(shard->client))
+    Post<cda::Signals::ChannelCreate>(shard->client, guild->id,
+      Detach(guild, channel));
+}
+
+static void onChannelUpdate(cda::Gateway *shard, io::json &data) {
+  std::shared_ptr<cda::Guild> guild = EventGuild(shard->client, data);
+  if (guild.get() == nullptr) return;
+  std::shared_ptr<cda::Channel> channel =
+    guild->getChannel(cda::toId(data["id"]));
+  if (channel.get() == nullptr) return;
+  channel->parse(data);
+  if (Listened<cda::Signals::ChannelUpdate>(shard->client))
+    Post<cda::Signals::ChannelUpdate>(shard->client, guild->id,
+      Detach(guild, channel));
+}
+
+static void onChannelDelete(cda::Gateway *shard, io::json &data) {
+  std::shared_ptr<cda::Guild> guild = EventGuild(shard->client, data);
+  if (guild.get() == nullptr) return;
+  std::shared_ptr<cda::Channel> channel =
+    guild->getChannel(cda::toId(data["id"]));
+  if (channel.get() == nullptr) return;
+  guild->channels.erase(std::find(
+    guild->channels.begin(), guild->channels.end(), channel));
+  if (Listened<cda::Signals::ChannelDelete>(shard->client))
+    Post<cda::Signals::ChannelDelete>(shard->client, guild->id,
+      Detach(guild, channel));
+}
+
+template <typename Payload>
+static void onMemberAdd(cda::Gateway *shard, Payload &data) {
+  std::shared_ptr<cda::Guild> guild = EventGuild(shard->client, data);
+  if (guild.get() == nullptr) return;
+  const cda::snowflake uid = cda::toId(data["user"]["id"]);
+  std::shared_ptr<cda::Member> member = guild->getMember(uid);
+  if (member.get() == nullptr) {
+    member = std::make_shared<cda::Member>();
+    member->guild = guild.get();
+    member->client = shard->client;
+    guild->members[uid] = member;
+    guild->member_count++;
+  }
+  member->parse(data);
+  if (Listened<cda::Signals::MemberAdd>(shard->client))
+    Post<cda::Signals::MemberAdd>(shard->client, guild->id,
+      Detach(guild, member));
+}
+
+template <typename Payload>
+static void onMemberUpdate(cda::Gateway *shard, Payload &data) {
+  std::shared_ptr<cda::Guild> guild = EventGuild(shard->client, data);
+  if (guild.get() == nullptr) return;
+  std::shared_ptr<cda::Member> member =
+    guild->getMember(cda::toId(data["user"]["id"]));
+  if (member.get() == nullptr) return;
+  member->parse(data);
+  if (Listened<cda::Signals::MemberUpdate>(shard->client))
+    Post<cda::Signals::MemberUpdate>(shard->client, guild->id,
+      Detach(guild, member));
+}
+
+static void onMemberRemove(cda::Gateway *shard, io::json &data) {
+  std::shared_ptr<cda::Guild> guild = EventGuild(shard->client, data);
+  if (guild.get() == nullptr) return;
+  std::shared_ptr<cda::Member> member =
+    guild->getMember(cda::toId(data["user"]["id"]));
+  if (member.get() == nullptr) return;
+  guild->members.erase(member->id);
+  if (guild->member_count > 0) guild->member_count--;
+  if (Listened<cda::Signals::MemberRemove>(shard->client))
+    Post<cda::Signals::MemberRemove>(shard->client, guild->id,
+      Detach(guild, member));
+}
+
+static void onRoleCreate(cda::Gateway *shard, io::json &data) {
+  std::shared_ptr<cda::Guild> guild = EventGuild(shard->client, data);
+  if (guild.get() == nullptr) return;
+  std::shared_ptr<cda::Role> role =
+    guild->getRole(cda::toId(data["role"]["id"]));
+  if (role.get() == nullptr) {
+    role = std::make_shared<cda::Role>();
+    role->guild = guild.get();
+    role->client = shard->client;
+    guild->roles.push_back(role);
+  }
+  role->parse(data["role"]);
+  if (Listened<cda::Signals::RoleCreate>(shard->client)) {
+    std::shared_ptr<cda::Guild> copy = guild->copy(false);
+    Post<cda::Signals::RoleCreate>(shard->client, guild->id,
+      copy, *copy->getRole(role->id));
+  }
+}
+
+static void onRoleUpdate(cda::Gateway *shard, io::json &data) {
+  std::shared_ptr<cda::Guild> guild = EventGuild(shard->client, data);
+  if (guild.get() == nullptr) return;
+  std::shared_ptr<cda::Role> role =
+    guild->getRole(cda::toId(data["role"]["id"]));
+  if (role.get() == nullptr) return;
+  role->parse(data["role"]);
+  if (Listened<cda::Signals::RoleUpdate>(shard->client)) {
+    std::shared_ptr<cda::Guild> copy = guild->copy(false);
+    Post<cda::Signals::RoleUpdate>(shard->client, guild->id,
+      copy, *copy->getRole(role->id));
+  }
+}
+
+static void onRoleDelete(cda::Gateway *shard, io::json &data) {
+  std::shared_ptr<cda::Guild> guild = EventGuild(shard->client, data);
+  if (guild.get() == nullptr) return;
+  const cda::snowflake rid = cda::toId(data["role_id"]);
+  std::shared_ptr<cda::Role> role = guild->getRole(rid);
+  if (role.get() == nullptr) return;
+
+  // copy before the role is erased from the guild
+  if (Listened<cda::Signals::RoleDelete>(shard->client)) {
+    std::shared_ptr<cda::Guild> copy = guild->copy(false);
+    Post<cda::Signals::RoleDelete>(shard->client, guild->id,
+      copy, *copy->getRole(rid));
+  }
+  guild->roles.erase(std::find(
+    guild->roles.begin(), guild->roles.end(), role));
+  for (auto &entry : guild->members)
+    entry.second->roles.erase(std::remove(entry.second->roles.begin(),
+      entry.second->roles.end(), rid), entry.second->roles.end());
+}
+
+static void onUserUpdate(cda::Gateway *shard, io::json &data) {
+  cda::Client *client = shard->client;
+  if (client->user.get() == nullptr) return;
+  client->user->parse(data);
+  if (Listened<cda::Signals::UserUpdate>(client))
+    Post<cda::Signals::UserUpdate>(client, 0,
+      std::make_shared<cda::User>(*client->user));
+}
+
+/** DISPATCH event handler table indexed by event id */
+static const std::array<EventHandler, cda::Event::COUNT> Handlers = []() {
+  std::array<EventHandler, cda::Event::COUNT> table = {};
+  table[cda::Event::READY]               = onReady;
+  table[cda::Event::RESUMED]             = onResumed;
+  table[cda::Event::GUILD_CREATE]        = onGuildCreate<io::json>;
+  table[cda::Event::GUILD_UPDATE]        = onGuildUpdate;
+  table[cda::Event::GUILD_DELETE]        = onGuildDelete;
+  table[cda::Event::CHANNEL_CREATE]      = onChannelCreate;
+  table[cda::Event::CHANNEL_UPDATE]      = onChannelUpdate;
+  table[cda::Event::CHANNEL_DELETE]      = onChannelDelete;
+  table[cda::Event::GUILD_MEMBER_ADD]    = onMemberAdd<io::json>;
+  table[cda::Event::GUILD_MEMBER_UPDATE] = onMemberUpdate<io::json>;
+  table[cda::Event::GUILD_MEMBER_REMOVE] = onMemberRemove;
+  table[cda::Event::GUILD_ROLE_CREATE]   = onRoleCreate;
+  table[cda::Event::GUILD_ROLE_UPDATE]   = onRoleUpdate;
+  table[cda::Event::GUILD_ROLE_DELETE]   = onRoleDelete;
+  table[cda::Event::USER_UPDATE]         = onUserUpdate;
+  return table;
+}();
+
+/** handlers of the biggest payloads, reading json frames in place */
+static const std::array<ViewHandler, cda::Event::COUNT> ViewHandlers = []() {
+  std::array<ViewHandler, cda::Event::COUNT> table = {};
+  table[cda::Event::GUILD_CREATE]        = onGuildCreate<const io::JsonView>;
+  table[cda::Event::GUILD_MEMBER_ADD]    = onMemberAdd<const io::JsonView>;
+  table[cda::Event::GUILD_MEMBER_UPDATE] = onMemberUpdate<const io::JsonView>;
+  return table;
+}();
+
+/**
+ * Hand an event without a cache handler to its raw listeners
+ * @param {Client} client the client owning the listeners
+ * @param {json} data the event payload
+ */
+template <cda::Event::Type E>
+static void EmitRaw(cda::Client *client, io::json &data) {
+  cda::snowflake key = 0;
+  if (data.is_object() && data.find("guild_id") != data.end())
+    key = cda::toId(data["guild_id"]);
+  Post<cda::Signals::Raw<E>>(client, key, data);
+}
+
+/** raw event emitters indexed by event id - FIRST_RAW_EVENT */
+typedef void (*RawEmitter)(cda::Client *client, io::json &data);
+template <std::size_t ...I>
+static constexpr auto RawEmitters(std::index_sequence<I...>) {
+  return std::array<RawEmitter, sizeof...(I)>{{
+    EmitRaw<(cda::Event::Type)(cda::FIRST_RAW_EVENT + I)>...
+  }};
+}
+static const auto RawHandlers = RawEmitters(
+  std::make_index_sequence<cda::Event::COUNT - cda::FIRST_RAW_EVENT>());
+
+/**
+ * Handle DISPATCH event packets for gateway. Payloads nobody reads (no
+ * listeners and not cached) are skipped without being parsed.
+ * @param {Gateway} shard the gateway shard to handle from
+ * @param {string} name the event name (the t field)
+ * @param {LazyJson} data the event data (the d field)
+ */
+void handleEvent(cda::Gateway *shard, const std::string &name,
+  io::LazyJson &data)
+{
+  cda::Client *client = shard->client;
+  const cda::Event::Type event = cda::EventFromName(name.data(), name.size());
+  if (event == cda::Event::UNKNOWN) return;
+
+  // count every dispatch, also the skipped ones
+  io::Counter *&count = shard->metrics.events[event];
+  if (count == nullptr)
+    count = &client->metrics.counter("cda_gateway_events_total",
+      "Gateway dispatches received by event type", io::Metrics::Labels({
+        {"shard", std::to_string(shard->id)}, {"event", name}}));
+  count->add();
+  const bool cached = Handlers[event] != nullptr && client->caches(event);
+  if (!cached && !client->events.has(event)) return;
+
+  // json frames of cached entities are read from the index, no tree
+  if (!data.isParsed() && ViewHandlers[event] != nullptr
+    && data.source().isObject())
+    return ViewHandlers[event](shard, data.source());
+
+  // first access parses the payload
+  io::json *payload = Payload(shard, name, data);
+  if (payload == nullptr) return;
+  if (Handlers[event] != nullptr)
+    Handlers[event](shard, *payload);
+  else if (event >= cda::FIRST_RAW_EVENT)
+    RawHandlers[event - cda::FIRST_RAW_EVENT](client, *payload);
+}
@@ -1,9 +1,20 @@
 #pragma once
 
-#include "rest.hh"
+#include "outbox.hh"
 
 namespace cda {
 
+  // the metrics of a shard, registered in Client::metrics
+  struct ShardMetrics {
+    io::Counter *received = nullptr;     // bytes of incoming messages
+    io::Counter *sent = nullptr;         // bytes of outgoing messages
+    io::Counter *reconnects = nullptr;   // reconnects scheduled
+    io::Counter *identifies = nullptr;   // sessions started with IDENTIFY
+    io::Counter *resumes = nullptr;      // sessions continued with RESUME
+    io::Histogram *heartbeat = nullptr;  // heartbeat round trips in us
+    std::vector<io::Counter*> events;    // dispatches by event type
+  };
+
   class Gateway {
   public:
     io::uint id;     // the shard id
@@ -14,10 +25,21 @@ namespace cda {
 
     int seq = -1;           // the latest packet sequence
     io::uint beatInter;     // gateway heartbeat interval
+    io::uint beatGen = 0;   // current heartbeat schedule
+    io::TimeStamp beatSent; // when the last heartbeat was sent
+    long latency = -1;      // last heartbeat round trip in ms (-1 if none)
     bool acked = true;      // if heartbet was acknowledged
     bool resume = false;    // if shard should idetify via resume
     bool reconnect = true;  // if shard should reconnect
+    int closed = 0;         // status of the last close (0 if none)
+    bool throttled = false; // if reading paused for slow listeners
+    io::TimeStamp throttledAt; // when reading was paused
+    bool hello = false;     // if HELLO arrived on this connection
+    bool granted = false;   // if holding an identify slot
     std::string session_id; // session id for shard connection
+    Outbox outbox;          // paces commands within the gateway limit
+    ReconnectPolicy backoff; // delays between reconnects
+    ShardMetrics metrics;   // counters of this shard
 
     /**
      * Initialize a gateway connection
@@ -28,28 +50,52 @@ namespace cda {
     Gateway(io::uint id, io::uint shards, Client *c);
 
     /**
-     * Start heartbeat
+     * Start heartbeating after a random fraction of the interval,
+     * replacing any previous heartbeat schedule
+     */
+    void startBeat();
+
+    /**
+     * Send a heartbeat right away
      */
     void beat();
 
+    /**
+     * Pause reading until the client executor catches up
+     */
+    void throttle();
+
     /**
      * Identify the shard with info
      */
     void identify();
 
     /**
-     * Send a gateway message
+     * Send a gateway message. Heartbeats, IDENTIFY and RESUME go out
+     * right away, other commands through the rate limited outbox.
      * @param {uint} op the gateway opcode
      * @param {json} data the data to send
      */
-    void send(io::uint op, io::json data);
+    void send(io::uint op, const io::json &data);
 
     /**
-     * Start the gateway connection
+     * Write a gateway message to the connection, bypassing the outbox
+     * @param {uint} op the gateway opcode
+     * @param {json} data the data to send
+     */
+    void write(io::uint op, const io::json &data);
+
+    /**
+     * Start the gateway connection once the launcher allows it
      * @param {string} _url the base url to connect to
      */
     void start(const std::string &_url);
 
+    /**
+     * Open the websocket connection
+     */
+    void connect();
+
     /**
      * Handle incoming messages
      * @param {Frame} frame the incoming websocket frame
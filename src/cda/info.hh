@@ -29,6 +29,7 @@ namespace cda {
 
   static const std::string Lib = "cda";
   static const std::string ApiVersion = "?v=6&encoding=json";
+  static const std::string ApiVersionEtf = "?v=6&encoding=etf";
   static const std::string Endpoint = "https://discordapp.com/api";
   static const std::string Url = "http://github.com/king1600/cda";
 
@@ -47,6 +48,23 @@ namespace cda {
     static const unsigned int HEARTBEAT_ACK      = 11;
   };
 
+  struct CloseCode {
+    static const int UNKNOWN_ERROR         = 4000;
+    static const int UNKNOWN_OPCODE        = 4001;
+    static const int DECODE_ERROR          = 4002;
+    static const int NOT_AUTHENTICATED     = 4003;
+    static const int AUTHENTICATION_FAILED = 4004;
+    static const int ALREADY_AUTHENTICATED = 4005;
+    static const int INVALID_SEQ           = 4007;
+    static const int RATE_LIMITED          = 4008;
+    static const int SESSION_TIMED_OUT     = 4009;
+    static const int INVALID_SHARD         = 4010;
+    static const int SHARDING_REQUIRED     = 4011;
+    static const int INVALID_API_VERSION   = 4012;
+    static const int INVALID_INTENTS       = 4013;
+    static const int DISALLOWED_INTENTS    = 4014;
+  };
+
   static inline const std::string OSName() {
     #ifdef _WIN32
       return "win32";
@@ -0,0 +1,161 @@
+#include "launcher.hh"
+#include "client.hh"
+
+// time between identifies of the same bucket
+#define IDENTIFY_WINDOW 5000
+
+/**
+ * Read the limits from a /gateway/bot response
+ * @param {json} resp the response body
+ */
+void cda::ShardLauncher::configure(const io::json &resp) {
+  if (resp.find("session_start_limit") == resp.end()) return;
+  const io::json &limit = resp["session_start_limit"];
+  if (limit.find("total") != limit.end())
+    total = limit["total"].get<io::uint>();
+  if (limit.find("remaining") != limit.end())
+    remaining = limit["remaining"].get<io::uint>();
+  if (limit.find("reset_after") != limit.end())
+    resetAfter = limit["reset_after"].get<long>();
+  if (limit.find("max_concurrency") != limit.end())
+    concurrency = std::max(1u, limit["max_concurrency"].get<io::uint>());
+  buckets.resize(concurrency);
+
+  std::cerr << "[cda] Session starts: " << remaining << "/" << total
+    << " remaining, identify concurrency " << concurrency << std::endl;
+}
+
+/**
+ * Queue a shard for an IDENTIFY slot
+ * @param {Gateway} shard the shard to identify
+ */
+void cda::ShardLauncher::request(cda::Gateway *shard) {
+  Bucket &b = bucket(shard);
+  if (b.holder == shard) return;
+  if (std::find(b.waiting.begin(), b.waiting.end(), shard) != b.waiting.end())
+    return;
+  b.waiting.push_back(shard);
+  pump(shard->id % concurrency);
+}
+
+/**
+ * Give the next shard of a bucket its IDENTIFY slot
+ * @param {uint} index the bucket index
+ */
+void cda::ShardLauncher::pump(io::uint index) {
+  Bucket &b = buckets[index];
+  if (b.busy || b.waiting.empty() || waitingReset) return;
+
+  // wait for the session starts to reset
+  if (remaining == 0) {
+    std::cerr << "[cda] Out of session starts, waiting "
+      << resetAfter << "ms" << std::endl;
+    waitingReset = true;
+    cda::ShardLauncher *self = this;
+    loop->later(resetAfter, [self](){
+      self->waitingReset = false;
+      self->remaining = self->total;
+      for (io::uint i = 0; i < self->buckets.size(); i++)
+        self->pump(i);
+    });
+    return;
+  }
+
+  Gateway *shard = b.waiting.front();
+  b.waiting.pop_front();
+  b.busy = true;
+  b.holder = shard;
+  shard->granted = true;
+
+  // identify now if the shard already said hello, else connect it
+  if (shard->hello)
+    shard->identify();
+  else if (!shard->conn->isConnected())
+    shard->connect();
+}
+
+/**
+ * Mark that a shard sent its IDENTIFY
+ * @param {Gateway} shard the shard that identified
+ */
+void cda::ShardLauncher::identified(cda::Gateway *shard) {
+  Bucket &b = bucket(shard);
+  if (b.holder != shard) return;
+  b.holder = nullptr;
+  if (remaining > 0) remaining--;
+
+  // the bucket opens again once the window passed
+  const io::uint index = shard->id % concurrency;
+  cda::ShardLauncher *self = this;
+  loop->later(IDENTIFY_WINDOW, [self, index](){
+    self->release(index);
+  });
+}
+
+/**
+ * Open a bucket for the next shard
+ * @param {uint} index the bucket index
+ */
+void cda::ShardLauncher::release(io::uint index) {
+  buckets[index].busy = false;
+  pump(index);
+}
+
+/**
+ * Drop a shard from the queue
+ * @param {Gateway} shard the shard that disconnected
+ */
+void cda::ShardLauncher::abort(cda::Gateway *shard) {
+  Bucket &b = bucket(shard);
+  shard->granted = false;
+  b.waiting.erase(std::remove(b.waiting.begin(), b.waiting.end(), shard),
+    b.waiting.end());
+
+  // the slot was never used so the next shard can go
+  if (b.holder == shard) {
+    b.holder = nullptr;
+    release(shard->id % concurrency);
+  }
+}
+
+/**
+ * Record that a shard received READY
+ * @param {Gateway} shard the shard that is ready
+ * @param {uint} shards the amount of shards launched
+ */
+void cda::ShardLauncher::ready(cda::Gateway *shard, io::uint shards) {
+  if (std::find(readied.begin(), readied.end(), shard->id) != readied.end())
+    return;
+  readied.push_back(shard->id);
+  halted.erase(std::remove(halted.begin(), halted.end(), shard->id),
+    halted.end());
+  std::cerr << "[cda] Shard " << shard->id << " ready ("
+    << readied.size() << "/" << shards << ")" << std::endl;
+  if (progress) progress(settled(), shards);
+}
+
+/**
+ * Record that a shard stopped on a fatal close before it was ready
+ * @param {Gateway} shard the shard that stopped
+ * @param {uint} shards the amount of shards launched
+ */
+void cda::ShardLauncher::stopped(cda::Gateway *shard, io::uint shards) {
+  if (std::find(readied.begin(), readied.end(), shard->id) != readied.end())
+    return;
+  if (std::find(halted.begin(), halted.end(), shard->id) != halted.end())
+    return;
+  halted.push_back(shard->id);
+  std::cerr << "[cda] Shard " << shard->id << " stopped before ready ("
+    << settled() << "/" << shards << " launched)" << std::endl;
+  if (progress) progress(settled(), shards);
+}
+
+/**
+ * Amount of shards waiting for an IDENTIFY slot
+ */
+std::size_t cda::ShardLauncher::queued() const {
+  std::size_t count = 0;
+  for (const Bucket &b : buckets)
+    count += b.waiting.size();
+  return count;
+}
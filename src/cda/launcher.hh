@@ -0,0 +1,104 @@
+#pragma once
+
+#include "session.hh"
+
+namespace cda {
+
+  // reports shards done launching (ready or stopped) out of the total
+  typedef std::function<void(io::uint, io::uint)> ProgressCallback;
+
+  class ShardLauncher {
+  /**
+   * Schedules shard IDENTIFYs within Discord's session start limits.
+   * Shards are split into max_concurrency buckets (shard id modulo
+   * max_concurrency) and each bucket identifies one shard per window.
+   * RESUMEs do not use a session start so they never wait here.
+   */
+  public:
+    io::uint total = 1000;      // session starts allowed per reset
+    io::uint remaining = 1000;  // session starts left before the reset
+    long resetAfter = 0;        // ms until the session starts reset
+    io::uint concurrency = 1;   // identify buckets (max_concurrency)
+    ProgressCallback progress;  // called when a shard is done launching
+
+    /**
+     * Create the launcher
+     * @param {Loop} loop the loop the shards run on
+     */
+    inline ShardLauncher(io::Loop *loop) : loop(loop) {}
+
+    /**
+     * Read the limits from a /gateway/bot response
+     * @param {json} resp the response body
+     */
+    void configure(const io::json &resp);
+
+    /**
+     * Queue a shard for an IDENTIFY slot. The shard is connected (if
+     * needed) and identified once its bucket is free.
+     * @param {Gateway} shard the shard to identify
+     */
+    void request(Gateway *shard);
+
+    /**
+     * Mark that a shard sent its IDENTIFY with the slot it was given
+     * @param {Gateway} shard the shard that identified
+     */
+    void identified(Gateway *shard);
+
+    /**
+     * Drop a shard from the queue, giving back a slot it did not use
+     * @param {Gateway} shard the shard that disconnected
+     */
+    void abort(Gateway *shard);
+
+    /**
+     * Record that a shard received READY
+     * @param {Gateway} shard the shard that is ready
+     * @param {uint} shards the amount of shards launched
+     */
+    void ready(Gateway *shard, io::uint shards);
+
+    /**
+     * Record that a shard stopped on a fatal close before it was ready,
+     * so waiting for the others is not blocked by it
+     * @param {Gateway} shard the shard that stopped
+     * @param {uint} shards the amount of shards launched
+     */
+    void stopped(Gateway *shard, io::uint shards);
+
+    /** Amount of shards waiting for an IDENTIFY slot */
+    std::size_t queued() const;
+
+    /** Amount of shards that have been ready at least once */
+    inline io::uint launched() const {
+      return (io::uint)readied.size();
+    }
+
+    /** Amount of shards done launching, ready or stopped */
+    inline io::uint settled() const {
+      return (io::uint)(readied.size() + halted.size());
+    }
+
+  private:
+    struct Bucket {
+      bool busy = false;            // slot given out or window running
+      Gateway *holder = nullptr;    // shard holding the slot
+      std::deque<Gateway*> waiting; // shards in identify order
+    };
+
+    void pump(io::uint index);
+    void release(io::uint index);
+    inline Bucket &bucket(Gateway *shard) {
+      if (buckets.size() < concurrency) buckets.resize(concurrency);
+      return buckets[shard->id % concurrency];
+    }
+
+    io::Loop *loop;
+    bool waitingReset = false;        // out of session starts
+    std::vector<Bucket> buckets;      // identify buckets
+    std::vector<io::uint> readied;    // shards that were ready
+    std::vector<io::uint> halted;     // shards stopped before ready
+  };
+
+}
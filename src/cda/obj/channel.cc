@@ -1,19 +1,32 @@
 #include "channel.hh"
+#include "user.hh"
 
 static inline void Parse(cda::Channel& channel, io::json& data) {
   if (data.find("id") != data.end())
-    channel.id = data["id"];
+    channel.id = cda::toId(data["id"]);
   if (data.find("name") != data.end())
-    channel.name = data["name"];
+    channel.name = cda::intern(data["name"]);
   if (data.find("position") != data.end())
     channel.position = data["position"];
 }
 
+std::shared_ptr<cda::Channel> cda::Channel::create(io::uint type) {
+  std::shared_ptr<cda::Channel> channel;
+  if (type == cda::Channel::Type::Text)
+    channel = std::make_shared<cda::TextChannel>();
+  else if (type == cda::Channel::Type::Voice)
+    channel = std::make_shared<cda::VoiceChannel>();
+  if (channel.get() != nullptr)
+    channel->type = type;
+  return channel;
+}
+
 void cda::TextChannel::parse(io::json &data) {
   Parse(*this, data);
   if (data.find("topic") != data.end())
     topic = data["topic"];
   if (data.find("permission_overwrites") != data.end()) {
+    overwrites.clear();
     for (io::json &perm : data["permission_overwrites"]) {
       Overwrites overwrite;
       if (perm.find("allow") != perm.end())
@@ -21,9 +34,9 @@ void cda::TextChannel::parse(io::json &data) {
       if (perm.find("deny") != perm.end())
         overwrite.deny = perm["deny"];
       if (perm.find("id") != perm.end())
-        overwrite.id = perm["id"];
+        overwrite.id = cda::toId(perm["id"]);
       if (perm.find("type") != perm.end())
-        overwrite.type = perm["type"];
+        overwrite.type = cda::intern(perm["type"]);
       overwrites.push_back(overwrite);
     }
   }
@@ -34,8 +47,9 @@ void cda::VoiceChannel::parse(io::json &data) {
   if (data.find("bitrate") != data.end())
     bitrate = data["bitrate"];
   if (data.find("user_limit") != data.end())
-    bitrate = data["user_limit"];
+    user_limit = data["user_limit"];
   if (data.find("permission_overwrites") != data.end()) {
+    overwrites.clear();
     for (io::json &perm : data["permission_overwrites"]) {
       Overwrites overwrite;
       if (perm.find("allow") != perm.end())
@@ -43,10 +57,55 @@ void cda::VoiceChannel::parse(io::json &data) {
       if (perm.find("deny") != perm.end())
         overwrite.deny = perm["deny"];
       if (perm.find("id") != perm.end())
-        overwrite.id = perm["id"];
+        overwrite.id = cda::toId(perm["id"]);
       if (perm.find("type") != perm.end())
-        overwrite.type = perm["type"];
+        overwrite.type = cda::intern(perm["type"]);
       overwrites.push_back(overwrite);
     }
   }
-}
\ No newline at end of file
+}
+
+static inline void Parse(cda::Channel& channel, const io::JsonView &data) {
+  io::JsonView value;
+  if ((value = data["id"]))
+    channel.id = cda::toId(value);
+  if ((value = data["name"]))
+    channel.name = cda::intern(value);
+  cda::read(data["position"], channel.position);
+}
+
+static inline void ParseOverwrites(std::vector<cda::Overwrites> &overwrites,
+  const io::JsonView &data)
+{
+  if (!data.isArray()) return;
+  overwrites.clear();
+  data.each([&overwrites](std::string_view, io::JsonView perm) {
+    cda::Overwrites overwrite;
+    cda::read(perm["allow"], overwrite.allow);
+    cda::read(perm["deny"], overwrite.deny);
+    overwrite.id = cda::toId(perm["id"]);
+    overwrite.type = cda::intern(perm["type"]);
+    overwrites.push_back(overwrite);
+  });
+}
+
+void cda::TextChannel::parse(const io::JsonView &data) {
+  Parse(*this, data);
+  cda::read(data["topic"], topic);
+  ParseOverwrites(overwrites, data["permission_overwrites"]);
+}
+
+void cda::VoiceChannel::parse(const io::JsonView &data) {
+  Parse(*this, data);
+  cda::read(data["bitrate"], bitrate);
+  cda::read(data["user_limit"], user_limit);
+  ParseOverwrites(overwrites, data["permission_overwrites"]);
+}
+
+std::shared_ptr<cda::Channel> cda::DMChannel::copy() const {
+  std::shared_ptr<cda::DMChannel> channel =
+    std::make_shared<cda::DMChannel>(*this);
+  for (std::shared_ptr<cda::User> &user : channel->recipients)
+    user = std::make_shared<cda::User>(*user);
+  return channel;
+}
@@ -14,16 +14,33 @@ namespace cda {
       static const io::uint Voice = 2;
     };
 
-    Guild *guild;
-    std::string name;
+    Guild *guild = nullptr;
+    io::Symbol name;
     io::uint position = 0;
     io::uint type = Type::Text;
     virtual void parse(io::json& data) {}
+    virtual void parse(const io::JsonView &data) {}
+
+    /**
+     * Copy the channel for listeners off the loop
+     * @return {Channel} a copy of the same channel type
+     */
+    virtual std::shared_ptr<Channel> copy() const {
+      return std::make_shared<Channel>(*this);
+    }
+
+    /**
+     * Create an empty channel object for a channel type
+     * @param {uint} type the discord channel type
+     * @return {Channel} the channel or nullptr if unsupported
+     */
+    static std::shared_ptr<Channel> create(io::uint type);
   };
 
   class DMChannel : public Channel {
   public:
     std::vector<std::shared_ptr<User>> recipients;
+    std::shared_ptr<Channel> copy() const;
   };
 
   class TextChannel : public Channel {
@@ -33,6 +50,10 @@ namespace cda {
     std::string topic;
     std::vector<Overwrites> overwrites;
     void parse(io::json &data);
+    void parse(const io::JsonView &data);
+    inline std::shared_ptr<Channel> copy() const {
+      return std::make_shared<TextChannel>(*this);
+    }
   };
 
   class VoiceChannel : public Channel {
@@ -43,5 +64,9 @@ namespace cda {
     io::uint user_limit = 0;
     std::vector<Overwrites> overwrites;
     void parse(io::json &data);
+    void parse(const io::JsonView &data);
+    inline std::shared_ptr<Channel> copy() const {
+      return std::make_shared<VoiceChannel>(*this);
+    }
   };
 }
\ No newline at end of file
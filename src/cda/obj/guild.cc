@@ -1,52 +1,63 @@
 #include "guild.hh"
 #include "user.hh"
 #include "channel.hh"
+#include <unordered_set>
 
-class Role : public Item {
-  public:
-    inline Role() = default;
-    inline ~Role() = default;
-    Color color;
-    Guild *guild;
-    bool hoist;
-    bool managed;
-    bool mentionable;
-    std::string name;
-    Permissions perms;
-    unsigned int position;
-    void parse(io::json &data);
-  };
-
-  class Emoji : public Item {
-  public:
-    inline Emoji() = default;
-    inline ~Emoji() = default;
-    Guild *guild;
-    bool managed;
-    std::string name;
-    bool require_colons;
-    std::vector<Role> roles;
-    void parse(io::json &data);
-  };
+/**
+ * Drop the members a full member list did not include
+ * @param {unordered_map} members the cached members by user id
+ * @param {unordered_set} seen the user ids of the list
+ */
+static inline void Prune(
+  std::unordered_map<cda::snowflake, std::shared_ptr<cda::Member>> &members,
+  const std::unordered_set<cda::snowflake> &seen)
+{
+  for (auto it = members.begin(); it != members.end();) {
+    if (seen.count(it->first) == 0) it = members.erase(it);
+    else it++;
+  }
+}
 
 void cda::Emoji::parse(io::json &data) {
-
+  if (data.find("id") != data.end())
+    id = cda::toId(data["id"]);
+  if (data.find("name") != data.end())
+    name = cda::intern(data["name"]);
+  if (data.find("managed") != data.end())
+    managed = data["managed"];
+  if (data.find("require_colons") != data.end())
+    require_colons = data["require_colons"];
 }
 
 void cda::Role::parse(io::json &data) {
-
+  if (data.find("id") != data.end())
+    id = cda::toId(data["id"]);
+  if (data.find("name") != data.end())
+    name = cda::intern(data["name"]);
+  if (data.find("color") != data.end())
+    color = cda::Color::from(data["color"].get<int>());
+  if (data.find("hoist") != data.end())
+    hoist = data["hoist"];
+  if (data.find("managed") != data.end())
+    managed = data["managed"];
+  if (data.find("mentionable") != data.end())
+    mentionable = data["mentionable"];
+  if (data.find("permissions") != data.end())
+    perms = cda::Permissions(data["permissions"].get<unsigned int>());
+  if (data.find("position") != data.end())
+    position = data["position"];
 }
 
 void cda::Guild::parse(io::json &data) {
   // load basic attributes
   if (data.find("id") != data.end())
-    id = data["id"];
+    id = cda::toId(data["id"]);
   if (data.find("name") != data.end())
-    name = data["name"];
+    name = cda::intern(data["name"]);
   if (data.find("large") != data.end())
     large = data["large"];
   if (data.find("region") != data.end())
-    region = data["region"];
+    region = cda::intern(data["region"]);
   if (data.find("joined_at") != data.end())
     joined = io::Date(data["joined_at"].get<std::string>());
   if (data.find("mfa_level") != data.end())
@@ -65,19 +76,20 @@ void cda::Guild::parse(io::json &data) {
   // load nullable attributes
   if (data.find("icon") != data.end())
     if (!data["icon"].is_null())
-      icon = data["icon"];
+      icon = cda::intern(data["icon"]);
   if (data.find("splash") != data.end())
     if (!data["splash"].is_null())
-      splash = data["splash"];
+      splash = cda::intern(data["splash"]);
   if (data.find("afk_channel_id") != data.end())
     if (!data["afk_channel_id"].is_null())
-      afk_channel_id = data["afk_channel_id"];
+      afk_channel_id = cda::toId(data["afk_channel_id"]);
   if (data.find("afk_timeout") != data.end())
     if (!data["afk_timeout"].is_null())
       afk_timeout = data["afk_timeout"];
 
-  // load emojies
+  // load emojies (always the full list)
   if (data.find("emojis") != data.end()) {
+    emojis.clear();
     for (io::json& e : data["emojis"]) {
       cda::Emoji emoji;
       emoji.parse(e);
@@ -86,48 +98,249 @@ void cda::Guild::parse(io::json &data) {
     }
   }
 
-  // load roles
+  // load roles, patching known roles in place
   if (data.find("roles") != data.end()) {
+    std::unordered_set<cda::snowflake> seen;
     for (io::json& r : data["roles"]) {
-      cda::Role role;
-      role.parse(r);
-      role.guild = this;
-      roles.push_back(role);
+      std::shared_ptr<cda::Role> role = getRole(cda::toId(r["id"]));
+      if (role.get() == nullptr) {
+        role = std::make_shared<cda::Role>();
+        role->guild = this;
+        role->client = client;
+        roles.push_back(role);
+      }
+      role->parse(r);
+      seen.insert(role->id);
     }
+    roles.erase(std::remove_if(roles.begin(), roles.end(),
+      [&seen](std::shared_ptr<cda::Role> &role) {
+        return seen.count(role->id) == 0;
+      }), roles.end());
   }
 
-  // load members
+  // load members, patching known members in place
   if (data.find("members") != data.end()) {
+    std::unordered_set<cda::snowflake> seen;
     for (io::json &m : data["members"]) {
-      std::shared_ptr<cda::Member> member 
-        = std::make_shared<cda::Member>();
-      member->guild = this;
-      member->client = client;
+      const cda::snowflake uid = m.find("user") != m.end()
+        ? cda::toId(m["user"]["id"]) : 0;
+      std::shared_ptr<cda::Member> &member = members[uid];
+      if (member.get() == nullptr) {
+        member = std::make_shared<cda::Member>();
+        member->guild = this;
+        member->client = client;
+      }
       member->parse(m);
-      members.push_back(member);
+      seen.insert(uid);
     }
+
+    // small guilds send every member, so the rest left
+    if (!large) Prune(members, seen);
   }
 
   // Get member owner
-  if (data.find("owner_id") != data.end()) {
-    const std::string oid = data["owner_id"];
-    std::shared_ptr<cda::Member> owner = 
-      cda::Find<cda::Member>(cda::toId(oid), members);
-  }
+  if (data.find("owner_id") != data.end())
+    owner = getMember(cda::toId(data["owner_id"]));
 
-  // load channels
+  // load channels, patching known channels in place
   if (data.find("channels") != data.end()) {
+    std::unordered_set<cda::snowflake> seen;
     for (io::json& chan : data["channels"]) {
-      io::uint type = chan["type"];
-      std::shared_ptr<Channel> channel;
-      if (type == cda::Channel::Type::Text)
-        channel = std::make_shared<cda::TextChannel>();
-      else if (type == cda::Channel::Type::Voice)
-        channel = std::make_shared<cda::VoiceChannel>();
-      channel->client = client;
-      channel->guild = this;
+      std::shared_ptr<Channel> channel =
+        cda::Find(cda::toId(chan["id"]), channels);
+      if (channel.get() == nullptr) {
+        channel = cda::Channel::create(chan["type"]);
+        if (channel.get() == nullptr) continue;
+        channel->client = client;
+        channel->guild = this;
+        channels.push_back(channel);
+      }
       channel->parse(chan);
-      channels.push_back(channel);
+      seen.insert(channel->id);
     }
+    channels.erase(std::remove_if(channels.begin(), channels.end(),
+      [&seen](std::shared_ptr<cda::Channel> &channel) {
+        return seen.count(channel->id) == 0;
+      }), channels.end());
+  }
+}
+
+void cda::Emoji::parse(const io::JsonView &data) {
+  io::JsonView value;
+  if ((value = data["id"]))
+    id = cda::toId(value);
+  if ((value = data["name"]))
+    name = cda::intern(value);
+  cda::read(data["managed"], managed);
+  cda::read(data["require_colons"], require_colons);
+}
+
+void cda::Role::parse(const io::JsonView &data) {
+  io::JsonView value;
+  int64_t number;
+  if ((value = data["id"]))
+    id = cda::toId(value);
+  if ((value = data["name"]))
+    name = cda::intern(value);
+  if (data["color"].get(number))
+    color = cda::Color::from((int)number);
+  cda::read(data["hoist"], hoist);
+  cda::read(data["managed"], managed);
+  cda::read(data["mentionable"], mentionable);
+  if (data["permissions"].get(number))
+    perms = cda::Permissions((unsigned int)number);
+  cda::read(data["position"], position);
+}
+
+void cda::Guild::parse(const io::JsonView &data) {
+  io::JsonView value;
+
+  // load basic attributes
+  if ((value = data["id"]))
+    id = cda::toId(value);
+  if ((value = data["name"]))
+    name = cda::intern(value);
+  cda::read(data["large"], large);
+  if ((value = data["region"]))
+    region = cda::intern(value);
+  cda::read(data["joined_at"], joined);
+  cda::read(data["mfa_level"], mfa_level);
+  cda::read(data["member_count"], member_count);
+  cda::read(data["verification_level"], verify_level);
+  cda::read(data["unavailable"], unavailable);
+  cda::read(data["explicit_content_filter"], explicit_filter);
+  cda::read(data["default_message_notifications"], default_notifs);
+
+  // load nullable attributes
+  if ((value = data["icon"]) && !value.isNull())
+    icon = cda::intern(value);
+  if ((value = data["splash"]) && !value.isNull())
+    splash = cda::intern(value);
+  if ((value = data["afk_channel_id"]) && !value.isNull())
+    afk_channel_id = cda::toId(value);
+  cda::read(data["afk_timeout"], afk_timeout);
+
+  // load emojies (always the full list)
+  if ((value = data["emojis"])) {
+    emojis.clear();
+    value.each([this](std::string_view, io::JsonView e) {
+      cda::Emoji emoji;
+      emoji.parse(e);
+      emoji.guild = this;
+      emojis.push_back(emoji);
+    });
+  }
+
+  // load roles, patching known roles in place
+  if ((value = data["roles"])) {
+    std::unordered_set<cda::snowflake> seen;
+    value.each([this, &seen](std::string_view, io::JsonView r) {
+      std::shared_ptr<cda::Role> role = getRole(cda::toId(r["id"]));
+      if (role.get() == nullptr) {
+        role = std::make_shared<cda::Role>();
+        role->guild = this;
+        role->client = client;
+        roles.push_back(role);
+      }
+      role->parse(r);
+      seen.insert(role->id);
+    });
+    roles.erase(std::remove_if(roles.begin(), roles.end(),
+      [&seen](std::shared_ptr<cda::Role> &role) {
+        return seen.count(role->id) == 0;
+      }), roles.end());
+  }
+
+  // load members, patching known members in place
+  if ((value = data["members"])) {
+    std::unordered_set<cda::snowflake> seen;
+    value.each([this, &seen](std::string_view, io::JsonView m) {
+      io::JsonView user = m["user"];
+      const cda::snowflake uid = user ? cda::toId(user["id"]) : 0;
+      std::shared_ptr<cda::Member> &member = members[uid];
+      if (member.get() == nullptr) {
+        member = std::make_shared<cda::Member>();
+        member->guild = this;
+        member->client = client;
+      }
+      member->parse(m);
+      seen.insert(uid);
+    });
+
+    // small guilds send every member, so the rest left
+    if (!large) Prune(members, seen);
+  }
+
+  // Get member owner
+  if ((value = data["owner_id"]))
+    owner = getMember(cda::toId(value));
+
+  // load channels, patching known channels in place
+  if ((value = data["channels"])) {
+    std::unordered_set<cda::snowflake> seen;
+    value.each([this, &seen](std::string_view, io::JsonView chan) {
+      std::shared_ptr<Channel> channel =
+        cda::Find(cda::toId(chan["id"]), channels);
+      if (channel.get() == nullptr) {
+        uint64_t type;
+        if (!chan["type"].get(type)) return;
+        channel = cda::Channel::create((io::uint)type);
+        if (channel.get() == nullptr) return;
+        channel->client = client;
+        channel->guild = this;
+        channels.push_back(channel);
+      }
+      channel->parse(chan);
+      seen.insert(channel->id);
+    });
+    channels.erase(std::remove_if(channels.begin(), channels.end(),
+      [&seen](std::shared_ptr<cda::Channel> &channel) {
+        return seen.count(channel->id) == 0;
+      }), channels.end());
   }
-}
\ No newline at end of file
+}
+
+std::shared_ptr<cda::Guild> cda::Guild::copy(bool entities) const {
+  std::shared_ptr<cda::Guild> guild = std::make_shared<cda::Guild>(id, client);
+  guild->joined = joined;
+  guild->icon = icon;
+  guild->name = name;
+  guild->splash = splash;
+  guild->large = large;
+  guild->unavailable = unavailable;
+  guild->stale = stale;
+  guild->mfa_level = mfa_level;
+  guild->region = region;
+  guild->verify_level = verify_level;
+  guild->default_notifs = default_notifs;
+  guild->explicit_filter = explicit_filter;
+  guild->afk_timeout = afk_timeout;
+  guild->afk_channel_id = afk_channel_id;
+  guild->member_count = member_count;
+  guild->emojis = emojis;
+  guild->roles.reserve(roles.size());
+  for (const std::shared_ptr<cda::Role> &r : roles) {
+    std::shared_ptr<cda::Role> role = std::make_shared<cda::Role>(*r);
+    role->guild = guild.get();
+    guild->roles.push_back(role);
+  }
+  for (cda::Emoji &emoji : guild->emojis)
+    emoji.guild = guild.get();
+  if (!entities) return guild;
+
+  // the owner stays one of the members
+  guild->members.reserve(members.size());
+  for (const auto &entry : members) {
+    std::shared_ptr<cda::Member> member = entry.second->copy();
+    member->guild = guild.get();
+    if (entry.second == owner) guild->owner = member;
+    guild->members.emplace(entry.first, member);
+  }
+  guild->channels.reserve(channels.size());
+  for (const std::shared_ptr<cda::Channel> &c : channels) {
+    std::shared_ptr<cda::Channel> channel = c->copy();
+    channel->guild = guild.get();
+    guild->channels.push_back(channel);
+  }
+  return guild;
+}
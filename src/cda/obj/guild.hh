@@ -7,11 +7,20 @@ namespace cda {
   class Guild : public Item {
   public:
     io::Date joined;
-    std::string icon;
-    std::string name;
-    std::string splash;
+    io::Symbol icon;
+    io::Symbol name;
+    io::Symbol splash;
 
     void parse(io::json &data);
+    void parse(const io::JsonView &data);
+
+    /**
+     * Copy the guild for listeners off the loop, nothing in the copy
+     * points back into the cache
+     * @param {bool} entities also copy the members and channels
+     * @return {Guild} the copy
+     */
+    std::shared_ptr<Guild> copy(bool entities = true) const;
     inline Guild(snowflake id, Client *client) : Item(id) {
       this->client = client;
       unavailable  = true;
@@ -19,8 +28,9 @@ namespace cda {
     
     bool large;
     bool unavailable;
+    bool stale = false; // loaded from a snapshot, awaiting GUILD_CREATE
     int mfa_level = 0;
-    std::string region;
+    io::Symbol region;
     int verify_level = 0;
     int default_notifs = 0;
     int explicit_filter = 0;
@@ -30,13 +40,25 @@ namespace cda {
     //std::vector<> voice_states;
 
     io::uint member_count = 0;
-    std::vector<Role> roles;
+    std::vector<std::shared_ptr<Role>> roles;
     std::vector<Emoji> emojis;
     //std::vector<> features;
 
     std::shared_ptr<Member> owner;
-    std::vector<std::shared_ptr<Member>> members;
+    std::unordered_map<snowflake, std::shared_ptr<Member>> members;
     std::vector<std::shared_ptr<Channel>> channels;
+
+    // cached entity lookups by id
+    inline std::shared_ptr<Role> getRole(snowflake rid) {
+      return cda::Find(rid, roles);
+    }
+    inline std::shared_ptr<Member> getMember(snowflake uid) {
+      auto member = members.find(uid);
+      return member == members.end() ? nullptr : member->second;
+    }
+    inline std::shared_ptr<Channel> getChannel(snowflake cid) {
+      return cda::Find(cid, channels);
+    }
   };
 
 }
\ No newline at end of file
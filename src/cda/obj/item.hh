@@ -9,11 +9,56 @@ namespace cda {
   static const snowflake EPOCH = 1420070400000;
   static inline const snowflake toId(const std::string &str) {
     snowflake result;
-    std::istringstream stream(str.c_str());
-    if (!(stream >> result)) return 0;
+    if (!io::ParseUint(str.data(), str.size(), result)) return 0;
     return result;
   }
 
+  // snowflakes are sent as strings but accept numbers too
+  static inline const snowflake toId(const io::json &value) {
+    if (value.is_string())
+      return toId(*value.get_ptr<const std::string*>());
+    if (value.is_number_unsigned() || value.is_number_integer())
+      return value.get<snowflake>();
+    return 0;
+  }
+
+  // snowflakes read straight from a scanned document
+  static inline const snowflake toId(const io::JsonView &value) {
+    snowflake result;
+    if (!value.get(result)) return 0;
+    return result;
+  }
+
+  // repeated strings are shared through the global pool
+  static inline io::Symbol intern(const io::json &value) {
+    if (!value.is_string()) return io::Symbol();
+    return io::StringPool::global().get(
+      *value.get_ptr<const std::string*>());
+  }
+  static inline io::Symbol intern(const io::JsonView &value) {
+    std::string text;
+    if (!value.get(text)) return io::Symbol();
+    return io::StringPool::global().get(text);
+  }
+
+  // fields read from a scanned document, mistyped values are skipped
+  template <typename T>
+  static inline void read(const io::JsonView &value, T &out) {
+    int64_t number;
+    if (value.get(number)) out = (T)number;
+  }
+  static inline void read(const io::JsonView &value, bool &out) {
+    value.get(out);
+  }
+  static inline void read(const io::JsonView &value, std::string &out) {
+    if (value.isNull()) out.clear();
+    else value.get(out);
+  }
+  static inline void read(const io::JsonView &value, io::Date &out) {
+    std::string text;
+    if (value.get(text)) out = io::Date(text);
+  }
+
   // basic discord object
   class Client;
   class Item {
@@ -23,6 +68,11 @@ namespace cda {
     inline Item() {}
     inline Item(snowflake id) : id(id) {}
 
+    // creation time encoded in the snowflake
+    inline const io::Date created() const {
+      return io::Date::fromMillis((int64_t)((id >> 22) + EPOCH));
+    }
+
     // compare using id
     inline virtual bool operator!=(const Item& other) {
       return this->id != other.id;
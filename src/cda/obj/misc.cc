@@ -11,17 +11,17 @@ const int cda::Color::val() const {
 
 void cda::Game::parse(io::json &data) {
   if (data.find("name") != data.end())
-    name = data["name"];
+    name = cda::intern(data["name"]);
   if (data.find("type") != data.end())
     type = data["type"];
   if (data.find("url") != data.end())
-    type = data["url"];
+    url = cda::intern(data["url"]);
 }
 
 void cda::Status::parse(io::json &data) {
   if (data.find("user") != data.end())
     if (data["user"].find("id") != data["user"].end())
-      user_id = data["user"]["id"];
+      user_id = cda::toId(data["user"]["id"]);
   if (data.find("game") != data.end())
     if (!data["game"].is_null())
       game.parse(data["game"]);
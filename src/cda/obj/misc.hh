@@ -14,8 +14,8 @@ namespace cda {
   };
 
   struct Game {
-    std::string url;
-    std::string name;
+    io::Symbol url;
+    io::Symbol name;
     unsigned char type;
     void parse(io::json &data);
   };
@@ -115,10 +115,11 @@ namespace cda {
     bool hoist;
     bool managed;
     bool mentionable;
-    std::string name;
+    io::Symbol name;
     Permissions perms;
     unsigned int position;
     void parse(io::json &data);
+    void parse(const io::JsonView &data);
   };
 
   class Emoji : public Item {
@@ -127,15 +128,16 @@ namespace cda {
     inline ~Emoji() = default;
     Guild *guild;
     bool managed;
-    std::string name;
+    io::Symbol name;
     bool require_colons;
     std::vector<Role> roles;
     void parse(io::json &data);
+    void parse(const io::JsonView &data);
   };
 
   struct Overwrites {
     snowflake id;
-    std::string type;
+    io::Symbol type;
     unsigned char deny;
     unsigned char allow;
   };
@@ -4,7 +4,7 @@
   
 void cda::User::parse(io::json &data) {
   if (data.find("id") != data.end())
-    id = data["id"];
+    id = cda::toId(data["id"]);
   if (data.find("bot") != data.end())
     bot = data["bot"];
   if (data.find("verified") != data.end())
@@ -14,42 +14,91 @@ void cda::User::parse(io::json &data) {
   if (data.find("email") != data.end())
     email = data["email"];
   if (data.find("avatar") != data.end())
-    avatar = data["avatar"];
+    avatar = cda::intern(data["avatar"]);
   if (data.find("username") != data.end())
-    username = data["username"];
+    username = cda::intern(data["username"]);
   if (data.find("discriminator") != data.end())
-    discrim = data["discriminator"];
+    discrim = (unsigned short)cda::toId(data["discriminator"]);
 }
 
 void cda::Member::parse(io::json &data) {
-  if (data.find("id") != data.end())
-    id = data["id"];
   if (data.find("deaf") != data.end())
     deaf = data["deaf"];
   if (data.find("mute") != data.end())
     mute = data["mute"];
   if (data.find("joined_at") != data.end())
     joined = io::Date(data["joined_at"].get<std::string>());
+  if (data.find("nick") != data.end()) {
+    if (data["nick"].is_null()) nick.clear();
+    else nick = data["nick"];
+  }
 
-  // find the roles from guild
+  // store the role ids (roles are looked up from the guild)
   if (data.find("roles") != data.end()) {
-    cda::snowflake rid;
-    for (const io::json role_id : data["roles"]) {
-      rid = role_id;
-      auto it = std::find_if(
-        guild->roles.begin(), guild->roles.end(),
-        [rid](cda::Role& role) { return role.id == rid; });
-      if (it != guild->roles.end()) roles.push_back(*it);
-    }
+    roles.clear();
+    for (const io::json &role_id : data["roles"])
+      roles.push_back(cda::toId(role_id));
   }
 
-  // find the user in db
+  // find the user in db or cache a new one
   if (data.find("user") != data.end()) {
-    cda::snowflake uid = data["user"]["id"];
-    user = cda::Find(uid, client->users);
-    if (user.get() == nullptr) {
-      user = std::make_shared<cda::User>();
-      user->parse(data["user"]);
+    id = cda::toId(data["user"]["id"]);
+    if (user.get() == nullptr || user->id != id) {
+      std::shared_ptr<cda::User> &cached = client->users[id];
+      if (cached.get() == nullptr)
+        cached = std::make_shared<cda::User>();
+      user = cached;
     }
+    user->parse(data["user"]);
   }
-}
\ No newline at end of file
+}
+
+void cda::User::parse(const io::JsonView &data) {
+  io::JsonView value;
+  if ((value = data["id"]))
+    id = cda::toId(value);
+  cda::read(data["bot"], bot);
+  cda::read(data["verified"], verified);
+  cda::read(data["mfa_enabled"], mfa_enabled);
+  cda::read(data["email"], email);
+  if ((value = data["avatar"]))
+    avatar = cda::intern(value);
+  if ((value = data["username"]))
+    username = cda::intern(value);
+  if ((value = data["discriminator"]))
+    discrim = (unsigned short)cda::toId(value);
+}
+
+void cda::Member::parse(const io::JsonView &data) {
+  cda::read(data["deaf"], deaf);
+  cda::read(data["mute"], mute);
+  cda::read(data["joined_at"], joined);
+  cda::read(data["nick"], nick);
+
+  // store the role ids (roles are looked up from the guild)
+  if (io::JsonView ids = data["roles"]) {
+    roles.clear();
+    ids.each([this](std::string_view, io::JsonView role_id) {
+      roles.push_back(cda::toId(role_id));
+    });
+  }
+
+  // find the user in db or cache a new one
+  if (io::JsonView u = data["user"]) {
+    id = cda::toId(u["id"]);
+    if (user.get() == nullptr || user->id != id) {
+      std::shared_ptr<cda::User> &cached = client->users[id];
+      if (cached.get() == nullptr)
+        cached = std::make_shared<cda::User>();
+      user = cached;
+    }
+    user->parse(u);
+  }
+}
+
+std::shared_ptr<cda::Member> cda::Member::copy() const {
+  std::shared_ptr<cda::Member> member = std::make_shared<cda::Member>(*this);
+  if (user.get() != nullptr)
+    member->user = std::make_shared<cda::User>(*user);
+  return member;
+}
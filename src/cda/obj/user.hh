@@ -9,12 +9,12 @@ namespace cda {
     bool bot;
     bool verified;
     bool mfa_enabled;
-    io::Date created;
     std::string email;
-    std::string avatar;
-    std::string username;
+    io::Symbol avatar;
+    io::Symbol username;
     unsigned short discrim;
     void parse(io::json &data);
+    void parse(const io::JsonView &data);
   };
 
   class Member : public Item {
@@ -24,8 +24,15 @@ namespace cda {
     Guild* guild;
     io::Date joined;
     std::string nick;
-    std::vector<Role> roles;
+    std::vector<snowflake> roles;
     std::shared_ptr<User> user;
     void parse(io::json &data);
+    void parse(const io::JsonView &data);
+
+    /**
+     * Copy the member and its user for listeners off the loop
+     * @return {Member} the copy, still pointing to the same guild
+     */
+    std::shared_ptr<Member> copy() const;
   };
 }
\ No newline at end of file
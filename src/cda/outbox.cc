@@ -0,0 +1,103 @@
+#include "outbox.hh"
+#include "client.hh"
+#include "info.hh"
+
+/**
+ * Forget the sends that left the window
+ */
+void cda::Outbox::expire() {
+  const io::TimeStamp limit =
+    io::Clock::now() - std::chrono::milliseconds((long)WINDOW);
+  while (used > 0 && sends[oldest] <= limit) {
+    oldest = (oldest + 1) % LIMIT;
+    used--;
+  }
+}
+
+/**
+ * Remember the time of a send, the ring must not be full
+ */
+void cda::Outbox::record() {
+  sends[(oldest + used) % LIMIT] = io::Clock::now();
+  used++;
+}
+
+/**
+ * Queue a command
+ * @param {uint} op the gateway opcode
+ * @param {json} data the command data
+ */
+void cda::Outbox::push(io::uint op, const io::json &data) {
+
+  // only the latest presence matters
+  if (op == cda::Op::STATUS_UPDATE) {
+    for (Command &command : queue) {
+      if (command.op != op) continue;
+      command.data = data;
+      coalesced++;
+      return;
+    }
+  }
+  queue.push_back({op, data});
+  drain();
+}
+
+/**
+ * Count a priority command
+ * @return {bool} if the command fit within the limit
+ */
+bool cda::Outbox::take() {
+  expire();
+  if (used >= LIMIT) return false;
+  record();
+  return true;
+}
+
+/**
+ * Start sending queued commands
+ */
+void cda::Outbox::open() {
+  ready = true;
+  drain();
+}
+
+/**
+ * Stop sending until the next session
+ */
+void cda::Outbox::close() {
+  ready = false;
+  oldest = 0;
+  used = 0;
+}
+
+/**
+ * Send queued commands while slots above the reserve are left
+ */
+void cda::Outbox::drain() {
+  if (!ready) return;
+  expire();
+  while (ready && !queue.empty() && used + RESERVED < LIMIT) {
+    Command command = std::move(queue.front());
+    queue.pop_front();
+    record();
+    sent++;
+    shard->write(command.op, command.data);
+  }
+  if (ready && !queue.empty()) schedule();
+}
+
+/**
+ * Drain again once the oldest send leaves the window
+ */
+void cda::Outbox::schedule() {
+  if (scheduled) return;
+  scheduled = true;
+  const long elapsed = used == 0 ? WINDOW : (long)std::chrono::duration_cast<
+    std::chrono::milliseconds>(io::Clock::now() - sends[oldest]).count();
+  const long wait = std::max(1L, WINDOW - elapsed);
+  cda::Outbox *self = this;
+  loop->later(wait, [self](){
+    self->scheduled = false;
+    self->drain();
+  });
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include "backoff.hh"
+
+namespace cda {
+
+  class Gateway;
+  class Outbox {
+  /**
+   * Paces the commands a shard sends within the gateway limit of 120
+   * per 60 seconds. The send times of the last 120 commands are kept
+   * in a ring and a command only goes out once the oldest of them is
+   * 60 seconds old, so no 60 seconds of a connection ever hold more
+   * than the limit. Heartbeats, IDENTIFY and RESUME skip the queue and
+   * a few slots are always kept for them. A queued presence update is
+   * replaced by newer ones instead of sending both.
+   */
+  public:
+    static const io::uint LIMIT = 120;  // commands per window
+    static const long WINDOW = 60000;   // ms of the sliding window
+    static const io::uint RESERVED = 6; // slots only priority commands use
+
+    uint64_t sent = 0;      // queued commands sent
+    uint64_t coalesced = 0; // presence updates replaced before sending
+
+    /**
+     * Create the queue of a shard
+     * @param {Gateway} shard the shard sending the commands
+     * @param {Loop} loop the loop the shard runs on
+     */
+    inline Outbox(Gateway *shard, io::Loop *loop) :
+      shard(shard), loop(loop) {}
+
+    /**
+     * Queue a command, it is sent right away when the window allows it
+     * @param {uint} op the gateway opcode
+     * @param {json} data the command data
+     */
+    void push(io::uint op, const io::json &data);
+
+    /**
+     * Count a priority command which is sent regardless
+     * @return {bool} if the command fit within the limit
+     */
+    bool take();
+
+    /**
+     * Start sending queued commands (the session is ready)
+     */
+    void open();
+
+    /**
+     * Stop sending until the next session, keeping the queue.
+     * The limit is per connection, so the send times are forgotten.
+     */
+    void close();
+
+    /** Amount of commands waiting to be sent */
+    inline std::size_t depth() const {
+      return queue.size();
+    }
+
+  private:
+    struct Command {
+      io::uint op;
+      io::json data;
+    };
+
+    void expire();
+    void record();
+    void drain();
+    void schedule();
+
+    Gateway *shard;
+    io::Loop *loop;
+    bool ready = false;               // if the session accepts commands
+    bool scheduled = false;           // if a drain timer is pending
+    io::uint oldest = 0;              // ring index of the oldest send
+    io::uint used = 0;                // sends within the window
+    std::array<io::TimeStamp, LIMIT> sends; // ring of the last send times
+    std::deque<Command> queue;        // commands in send order
+  };
+
+}
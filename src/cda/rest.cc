@@ -2,18 +2,75 @@
 #include "info.hh"
 
 /**
- * Perform Discord API Request
+ * Get the route of an endpoint for metrics. Ids, reaction emojis and
+ * webhook or interaction tokens are replaced so routes stay few (and
+ * tokens stay out of the metrics).
+ * @param {string} endpoint the endpoint, ex: /channels/123/messages
+ * @return {string} the route, ex: /channels/:id/messages
+ */
+static std::string Route(const std::string &endpoint) {
+  const std::string path = endpoint.substr(0, endpoint.find('?'));
+  const bool tokens = path.rfind("/webhooks/", 0) == 0 ||
+    path.rfind("/interactions/", 0) == 0;
+  std::string route, previous;
+  std::size_t start = 1;
+  while (start <= path.size()) {
+    std::size_t end = path.find('/', start);
+    if (end == std::string::npos) end = path.size();
+    const std::string segment = path.substr(start, end - start);
+    std::string name = segment;
+    if (!segment.empty() && segment.find_first_not_of("0123456789") ==
+      std::string::npos) name = ":id";
+    else if (previous == "reactions") name = ":emoji";
+    else if (tokens && previous == ":id") name = ":token";
+    route += "/" + name;
+    previous = name;
+    start = end + 1;
+  }
+  return route;
+}
+
+/**
+ * Record a response in the request metrics
+ * @param {Metrics} metrics the registry (nothing is recorded if nullptr)
+ * @param {string} method the HTTP method
+ * @param {string} endpoint the requested endpoint
+ * @param {int} status the response status
+ * @param {TimeStamp} sent when the request was sent
+ */
+static void Record(io::Metrics *metrics, const std::string &method,
+  const std::string &endpoint, int status, io::TimeStamp sent)
+{
+  if (metrics == nullptr) return;
+  const std::string route = io::Metrics::Labels({
+    {"method", method}, {"route", Route(endpoint)}});
+  metrics->counter("cda_api_requests_total",
+    "Discord API responses by route and status",
+    route + ",status=\"" + std::to_string(status) + "\"").add();
+  if (status == 429)
+    metrics->counter("cda_api_rate_limited_total",
+      "Discord API requests answered with 429", route).add();
+  metrics->histogram("cda_api_request_seconds",
+    "Discord API request latency", route, 1e-6).record((uint64_t)
+    std::chrono::duration_cast<std::chrono::microseconds>(
+      io::Clock::now() - sent).count());
+}
+
+/**
+ * Perform Discord API Request, reporting every response status
  * @param {string} method the HTTP Method to perform
  * @param {string} endpoint the discord endpoint to request
  * @param {json} body the json body of the request
- * @param {Callback} the json callback to the request
- * @return {bool} if the request was successful
+ * @param {ResponseCallback} the status and json body callback
+ * @return {bool} if the request was sent
  */
-bool cda::ApiController::request(const std::string &method,
-  const std::string &endpoint, io::json body, cda::ApiCallback callback)
+bool cda::ApiController::fetch(const std::string &method,
+  const std::string &endpoint, io::json body,
+  cda::ApiResponseCallback callback)
 {
   // create Http request
   io::HttpRequest req(cda::Endpoint + endpoint + cda::ApiVersion);
+  req.method = method;
 
   // add headers
   char userAgent[126] = { 0 };
@@ -33,26 +90,83 @@ bool cda::ApiController::request(const std::string &method,
 
   // Perform request and return result
   cda::ApiController *self = this;
-  return http->Request(req, 
-  [self, method, endpoint, callback](io::HttpResponse &resp) {
-    
-    // Extract http response info
-    io::json body = io::json::parse(resp.body());
+  const io::TimeStamp sent = io::Clock::now();
+  return http->Request(req,
+  [self, method, endpoint, body, callback, sent](io::HttpResponse &resp) {
+
+    // Extract http response info, keeping bodies that are not json
+    // (ex: an html 502 page) as a string
+    const std::string text = resp.body();
+    io::json data = io::json::object();
+    if (!text.empty()) {
+      try {
+        data = io::json::parse(text);
+      } catch (const std::exception &e) {
+        data = text;
+      }
+    }
     const int status = resp.status();
+    Record(self->metrics, method, endpoint, status, sent);
 
-    // Do basic http rate limiting
+    // Do basic http rate limiting, retrying with the original body
     if (status == 429) {
-      long delay = body["retry_after"];
-      self->loop->later(delay, 
-      [self, &method, &endpoint, &body, callback](){
-        self->request(method, endpoint, body, callback);
+      long delay = 1000;
+      if (data.is_object() && data["retry_after"].is_number())
+        delay = data["retry_after"];
+      self->loop->later(delay, [self, method, endpoint, body, callback](){
+        if (!self->fetch(method, endpoint, body, callback)) {
+          io::json empty = io::json::object();
+          callback(0, empty);
+        }
       });
 
-    // Perform http callbac
-    } else{
-      if (status >= 200 && status < 300)
-        callback(body);
+    // Perform http callback
+    } else {
+      callback(status, data);
     }
-    
   });
-}
\ No newline at end of file
+}
+
+/**
+ * Perform Discord API Request
+ * @param {string} method the HTTP Method to perform
+ * @param {string} endpoint the discord endpoint to request
+ * @param {json} body the json body of the request
+ * @param {Callback} the json callback to the request
+ * @return {bool} if the request was successful
+ */
+bool cda::ApiController::request(const std::string &method,
+  const std::string &endpoint, io::json body, cda::ApiCallback callback)
+{
+  return fetch(method, endpoint, body, [callback](int status, io::json &data) {
+    if (status >= 200 && status < 300)
+      callback(data);
+  });
+}
+
+/**
+ * Perform an awaitable Discord API Request
+ * @param {string} method the HTTP Method to perform
+ * @param {string} endpoint the discord endpoint to request
+ * @param {json} body the json body of the request
+ * @return {ApiCall} resolves to the json body or throws ApiError
+ */
+cda::ApiCall cda::ApiController::call(const std::string &method,
+  const std::string &endpoint, io::json body)
+{
+  cda::ApiCall call;
+  std::shared_ptr<cda::ApiCall::State> state = call.state;
+  auto complete = [state](int status, io::json &data) {
+    state->done = true;
+    state->status = status;
+    state->body = std::move(data);
+    if (state->waiter) state->waiter.resume();
+  };
+
+  // resolve immediately with status 0 if the request failed to send
+  if (!fetch(method, endpoint, body, complete)) {
+    state->done = true;
+    state->status = 0;
+  }
+  return call;
+}
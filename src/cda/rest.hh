@@ -5,14 +5,51 @@
 namespace cda {
 
   typedef std::function<void(io::json&)> ApiCallback;
+  typedef std::function<void(int, io::json&)> ApiResponseCallback;
   static const io::json Jempty = io::json::parse("{}");
   static const ApiCallback DefaultCallack = [](io::json &j){};
 
+  class ApiError : public std::runtime_error {
+  /** Thrown by awaited api calls that did not succeed */
+  public:
+    int status;   // http status (0 if the request was not answered)
+    io::json body; // the response body
+    inline ApiError(int status, const io::json &body) :
+      std::runtime_error("Discord API request failed with status "
+        + std::to_string(status)), status(status), body(body) {}
+  };
+
+  class ApiCall {
+  /**
+   * Awaitable Discord API request. The request is sent immediately, so
+   * discarding the ApiCall still performs it (fire and forget).
+   */
+  public:
+    struct State {
+      bool done = false;
+      int status = 0;
+      io::json body;
+      std::coroutine_handle<> waiter;
+    };
+    std::shared_ptr<State> state = std::make_shared<State>();
+
+    bool await_ready() const noexcept { return state->done; }
+    void await_suspend(std::coroutine_handle<> waiter) {
+      state->waiter = waiter;
+    }
+    io::json await_resume() {
+      if (state->status < 200 || state->status >= 300)
+        throw ApiError(state->status, state->body);
+      return std::move(state->body);
+    }
+  };
+
   class ApiController {
   public:
     std::string token;
     std::shared_ptr<io::Loop> loop;
     std::shared_ptr<io::HttpClient> http;
+    io::Metrics *metrics = nullptr; // records requests per route when set
 
     // create the IO objects
     inline ApiController() {
@@ -20,6 +57,21 @@ namespace cda {
       http = std::make_shared<io::HttpClient>(loop.get());
     }
 
+    /**
+     * Perform Discord API Request, reporting every response status
+     * @param {string} method the HTTP Method to perform
+     * @param {string} endpoint the discord endpoint to request
+     * @param {json} body the json body of the request
+     * @param {ResponseCallback} the status and json body callback
+     * @return {bool} if the request was sent
+     */
+    bool fetch(
+      const std::string &method,
+      const std::string &endpoint,
+      io::json data,
+      ApiResponseCallback callback
+    );
+
     /**
       * Perform Discord API Request
       * @param {string} method the HTTP Method to perform
@@ -36,43 +88,76 @@ namespace cda {
     );
 
     /**
-     * Perform a Discord GET Request 
+     * Perform an awaitable Discord API Request
+     * @param {string} method the HTTP Method to perform
+     * @param {string} endpoint the discord endpoint to request
+     * @param {json} body the json body of the request
+     * @return {ApiCall} resolves to the json body or throws ApiError
+     */
+    ApiCall call(
+      const std::string &method,
+      const std::string &endpoint,
+      io::json data = Jempty
+    );
+
+    /**
+     * Perform a Discord GET Request
      */
     inline bool get(const std::string &endpoint,
-      io::json data = Jempty, ApiCallback callback = DefaultCallack) {
+      io::json data, ApiCallback callback) {
       return request("GET", endpoint, data, callback);
     }
+    inline ApiCall get(const std::string &endpoint,
+      io::json data = Jempty) {
+      return call("GET", endpoint, data);
+    }
 
     /**
-     * Perform a Discord POST Request 
+     * Perform a Discord POST Request
      */
     inline bool post(const std::string &endpoint,
-      io::json data = Jempty, ApiCallback callback = DefaultCallack) {
+      io::json data, ApiCallback callback) {
       return request("POST", endpoint, data, callback);
     }
+    inline ApiCall post(const std::string &endpoint,
+      io::json data = Jempty) {
+      return call("POST", endpoint, data);
+    }
 
     /**
-     * Perform a Discord PUT Request 
+     * Perform a Discord PUT Request
      */
     inline bool put(const std::string &endpoint,
-      io::json data = Jempty, ApiCallback callback = DefaultCallack) {
+      io::json data, ApiCallback callback) {
       return request("PUT", endpoint, data, callback);
     }
+    inline ApiCall put(const std::string &endpoint,
+      io::json data = Jempty) {
+      return call("PUT", endpoint, data);
+    }
 
     /**
-     * Perform a Discord DELETE Request 
+     * Perform a Discord DELETE Request
      */
     inline bool del(const std::string &endpoint,
-      io::json data = Jempty, ApiCallback callback = DefaultCallack) {
+      io::json data, ApiCallback callback) {
       return request("DELETE", endpoint, data, callback);
     }
+    inline ApiCall del(const std::string &endpoint,
+      io::json data = Jempty) {
+      return call("DELETE", endpoint, data);
+    }
 
     /**
-     * Perform a Discord PATCH Request 
+     * Perform a Discord PATCH Request
      */
     inline bool patch(const std::string &endpoint,
-      io::json data = Jempty, ApiCallback callback = DefaultCallack) {
+      io::json data, ApiCallback callback) {
       return request("PATCH", endpoint, data, callback);
     }
+    inline ApiCall patch(const std::string &endpoint,
+      io::json data = Jempty) {
+      return call("PATCH", endpoint, data);
+    }
   };
-}
\ No newline at end of file
+}
@@ -0,0 +1,104 @@
+#include "session.hh"
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+// layout version of the session file
+#define SESSION_VERSION 1
+static const char SessionMagic[8] = "CDASESS";
+
+/**
+ * Map the session file, creating it if needed
+ * @param {string} path the file path
+ * @param {uint} shards the total amount of shards
+ */
+cda::SessionStore::SessionStore(const std::string &path, io::uint shards) {
+  fd = open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+  if (fd < 0)
+    throw std::runtime_error("Could not open session file " + path);
+
+  // grow the file to fit every shard
+  count = shards;
+  size = sizeof(Header) + sizeof(Record) * shards;
+  const off_t existing = lseek(fd, 0, SEEK_END);
+  if (existing < (off_t)size && ftruncate(fd, size) != 0) {
+    close(fd);
+    throw std::runtime_error("Could not resize session file " + path);
+  }
+
+  void *map = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (map == MAP_FAILED) {
+    close(fd);
+    throw std::runtime_error("Could not map session file " + path);
+  }
+  header = (Header*)map;
+  records = (Record*)((char*)map + sizeof(Header));
+
+  // start over on a new file or another shard layout
+  if (std::memcmp(header->magic, SessionMagic, sizeof(SessionMagic)) != 0
+    || header->version != SESSION_VERSION || header->shards != shards)
+  {
+    std::memset(map, 0, size);
+    std::memcpy(header->magic, SessionMagic, sizeof(SessionMagic));
+    header->version = SESSION_VERSION;
+    header->shards = shards;
+  }
+}
+
+/**
+ * Flush and unmap the file
+ */
+cda::SessionStore::~SessionStore() {
+  flush();
+  munmap(header, size);
+  close(fd);
+}
+
+/**
+ * Write the mapped records to disk now
+ */
+void cda::SessionStore::flush() {
+  msync(header, size, MS_SYNC);
+}
+
+/**
+ * Restore a shard session into the gateway if one is fresh enough
+ * @param {Gateway} shard the gateway to restore
+ * @return {bool} if the shard can resume
+ */
+bool cda::SessionStore::load(cda::Gateway *shard) {
+  if (shard->id >= count) return false;
+  const Record &record = records[shard->id];
+  if (!record.valid || record.shard != shard->id) return false;
+  if (io::Date::now().getMillis() - record.updated > maxAge) return false;
+
+  shard->session_id = std::string(record.session_id,
+    strnlen(record.session_id, sizeof(record.session_id)));
+  shard->seq = (int)record.seq;
+  shard->resume = true;
+  return true;
+}
+
+/**
+ * Store the session of a shard
+ * @param {Gateway} shard the gateway to store
+ */
+void cda::SessionStore::save(const cda::Gateway *shard) {
+  if (shard->id >= count) return;
+  Record &record = records[shard->id];
+  if (shard->session_id.empty()
+    || shard->session_id.size() >= sizeof(record.session_id)) {
+    record.valid = 0;
+    return;
+  }
+
+  // invalidate while the id is rewritten
+  record.valid = 0;
+  record.shard = shard->id;
+  record.seq = shard->seq;
+  record.updated = io::Date::now().getMillis();
+  std::memset(record.session_id, 0, sizeof(record.session_id));
+  std::memcpy(record.session_id, shard->session_id.data(),
+    shard->session_id.size());
+  record.valid = 1;
+}
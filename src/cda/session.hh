@@ -0,0 +1,91 @@
+#pragma once
+
+#include "gateway.hh"
+
+namespace cda {
+
+  class SessionStore {
+  /**
+   * Shard sessions kept in a memory mapped file. Every shard owns a
+   * fixed record that is updated in place as packets arrive, so a new
+   * process (or cluster worker) can RESUME where the old one stopped.
+   */
+  public:
+    // record of a single shard, laid out the same on every build
+    struct Record {
+      uint32_t shard;        // the shard id
+      uint32_t valid;        // if the record holds a session
+      int64_t seq;           // the latest packet sequence
+      int64_t updated;       // unix ms of the last update
+      char session_id[64];   // the session id (nul terminated)
+    };
+    static_assert(sizeof(Record) == 88, "Session record layout changed");
+
+    long maxAge = 5 * 60 * 1000; // ms after which sessions are not resumed
+
+    /**
+     * Map the session file, creating it if needed. A file made for a
+     * different shard count is reset.
+     * @param {string} path the file path
+     * @param {uint} shards the total amount of shards
+     */
+    SessionStore(const std::string &path, io::uint shards);
+
+    // flush and unmap the file
+    ~SessionStore();
+
+    /**
+     * Restore a shard session into the gateway if one is fresh enough
+     * @param {Gateway} shard the gateway to restore
+     * @return {bool} if the shard can resume
+     */
+    bool load(Gateway *shard);
+
+    /**
+     * Store the session of a shard
+     * @param {Gateway} shard the gateway to store
+     */
+    void save(const Gateway *shard);
+
+    /**
+     * Update the sequence of a shard (cheap, called per packet)
+     * @param {uint} shard the shard id
+     * @param {int} seq the latest sequence
+     */
+    inline void sequence(io::uint shard, int seq) {
+      if (shard >= count || !records[shard].valid) return;
+      records[shard].seq = seq;
+      records[shard].updated = io::Date::now().getMillis();
+    }
+
+    /**
+     * Forget the session of a shard
+     * @param {uint} shard the shard id
+     */
+    inline void clear(io::uint shard) {
+      if (shard < count) records[shard].valid = 0;
+    }
+
+    /**
+     * Write the mapped records to disk now (ex: before a handoff)
+     */
+    void flush();
+
+  private:
+    struct Header {
+      char magic[8];     // CDASESS\0
+      uint32_t version;  // layout version
+      uint32_t shards;   // amount of records
+    };
+
+    SessionStore(const SessionStore&) = delete;
+    const SessionStore& operator= (const SessionStore&) = delete;
+
+    int fd = -1;               // the file descriptor
+    std::size_t size = 0;      // the mapped size
+    io::uint count = 0;        // amount of records
+    Header *header = nullptr;  // the mapped file start
+    Record *records = nullptr; // the shard records after the header
+  };
+
+}
@@ -0,0 +1,586 @@
+#include "snapshot.hh"
+#include "client.hh"
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unordered_map>
+
+typedef cda::CacheSnapshot Snap;
+
+// byte order marker, a snapshot only loads on the same byte order
+#define SNAPSHOT_ENDIAN 0x01020304u
+static const char SnapshotMagic[8] = {'C','D','A','C','A','C','H','E'};
+
+// record layouts are part of the file format
+static_assert(sizeof(Snap::Header) == 80, "Snapshot header layout changed");
+static_assert(sizeof(Snap::User) == 32, "Snapshot user layout changed");
+static_assert(sizeof(Snap::Role) == 32, "Snapshot role layout changed");
+static_assert(sizeof(Snap::Emoji) == 24, "Snapshot emoji layout changed");
+static_assert(sizeof(Snap::Overwrite) == 24, "Snapshot overwrite layout changed");
+static_assert(sizeof(Snap::Channel) == 56, "Snapshot channel layout changed");
+static_assert(sizeof(Snap::Member) == 48, "Snapshot member layout changed");
+static_assert(sizeof(Snap::Guild) == 160, "Snapshot guild layout changed");
+
+class SnapshotWriter {
+/** Appends records to an image, strings go to a separate table */
+public:
+  io::Data out;        // header and records
+  std::string strings; // string table
+  std::unordered_map<std::string, Snap::String> seen; // deduped strings
+
+  /**
+   * Reserve an 8 byte aligned run of records
+   * @param {size_t} count the amount of records
+   * @return {Array} the reserved run
+   */
+  template <typename T>
+  inline Snap::Array reserve(std::size_t count) {
+    out.resize((out.size() + 7) & ~(std::size_t)7, 0);
+    Snap::Array array = {out.size(), count};
+    out.resize(out.size() + count * sizeof(T), 0);
+    return array;
+  }
+
+  /**
+   * Store a record into a reserved run
+   * @param {Array} array the run
+   * @param {size_t} index the record index
+   * @param {T} record the record
+   */
+  template <typename T>
+  inline void put(const Snap::Array &array, std::size_t index, const T &record) {
+    std::memcpy(&out[array.offset + index * sizeof(T)], &record, sizeof(T));
+  }
+
+  /**
+   * Add a string to the string table
+   * @param {string} value the string
+   * @return {String} its slice of the table
+   */
+  inline Snap::String str(const std::string &value) {
+    if (value.empty()) return {0, 0};
+    auto found = seen.find(value);
+    if (found != seen.end()) return found->second;
+    Snap::String slice = {(uint32_t)strings.size(), (uint32_t)value.size()};
+    strings += value;
+    seen.emplace(value, slice);
+    return slice;
+  }
+};
+
+/**
+ * Store the permission overwrites of a channel
+ * @param {SnapshotWriter} w the writer
+ * @param {vector} overwrites the overwrites
+ * @return {Array} the written records
+ */
+static inline Snap::Array WriteOverwrites(SnapshotWriter &w,
+  const std::vector<cda::Overwrites> &overwrites)
+{
+  Snap::Array array = w.reserve<Snap::Overwrite>(overwrites.size());
+  for (std::size_t i = 0; i < overwrites.size(); i++) {
+    Snap::Overwrite record = {};
+    record.id = overwrites[i].id;
+    record.type = w.str(overwrites[i].type);
+    record.allow = overwrites[i].allow;
+    record.deny = overwrites[i].deny;
+    w.put(array, i, record);
+  }
+  return array;
+}
+
+class SnapshotBuild {
+/**
+ * Serializes a cache a slice at a time. The user and guild lists are
+ * captured up front and every guild is written whole, so each guild is
+ * consistent even though the cache changes between slices.
+ */
+public:
+  SnapshotWriter w;
+  Snap::Header header = {};
+  std::vector<std::shared_ptr<cda::User>> users;   // users to write
+  std::vector<std::shared_ptr<cda::Guild>> guilds; // guilds to write
+  std::size_t user = 0;                            // next user record
+  std::size_t guild = 0;                           // next guild record
+
+  inline SnapshotBuild(cda::Client *client)
+    : guilds(client->guilds) {
+    users.reserve(client->users.size());
+    for (auto &entry : client->users)
+      users.push_back(entry.second);
+    w.reserve<Snap::Header>(1);
+    std::memcpy(header.magic, SnapshotMagic, sizeof(SnapshotMagic));
+    header.version = Snap::VERSION;
+    header.endian = SNAPSHOT_ENDIAN;
+    header.created = io::Date::now().getMillis();
+    header.users = w.reserve<Snap::User>(users.size());
+    header.guilds = w.reserve<Snap::Guild>(guilds.size());
+  }
+
+  /**
+   * Write records until done or out of time
+   * @param {TimeStamp} deadline when to stop for this slice
+   * @return {bool} if every record was written
+   */
+  bool step(io::TimeStamp deadline);
+
+  /**
+   * Close the image with the string table
+   * @return {Data} the snapshot image
+   */
+  io::Data finish();
+
+private:
+  void writeUser(std::size_t i);
+  void writeGuild(std::size_t i);
+};
+
+/**
+ * Write records until done or out of time
+ * @param {TimeStamp} deadline when to stop for this slice
+ * @return {bool} if every record was written
+ */
+bool SnapshotBuild::step(io::TimeStamp deadline) {
+  // users are small, check the clock every few hundred
+  while (user < users.size()) {
+    writeUser(user++);
+    if ((user & 255) == 0 && io::Clock::now() >= deadline)
+      return false;
+  }
+  while (guild < guilds.size()) {
+    writeGuild(guild++);
+    if (io::Clock::now() >= deadline)
+      return guild == guilds.size();
+  }
+  return true;
+}
+
+/**
+ * Store a user record
+ * @param {size_t} i the user index
+ */
+void SnapshotBuild::writeUser(std::size_t i) {
+  const cda::User &user = *users[i];
+  Snap::User record = {};
+  record.id = user.id;
+  record.username = w.str(user.username);
+  record.avatar = w.str(user.avatar);
+  record.discrim = user.discrim;
+  record.bot = user.bot;
+  record.verified = user.verified;
+  record.mfa_enabled = user.mfa_enabled;
+  w.put(header.users, i, record);
+}
+
+/**
+ * Store a guild record, its records follow the guild table
+ * @param {size_t} i the guild index
+ */
+void SnapshotBuild::writeGuild(std::size_t i) {
+  const cda::Guild &guild = *guilds[i];
+  Snap::Guild record = {};
+  record.id = guild.id;
+  record.joined = guild.joined.getMillis();
+  record.afk_channel_id = guild.afk_channel_id;
+  record.owner = guild.owner.get() != nullptr ? guild.owner->id : 0;
+  record.name = w.str(guild.name);
+  record.icon = w.str(guild.icon);
+  record.splash = w.str(guild.splash);
+  record.region = w.str(guild.region);
+  record.afk_timeout = guild.afk_timeout;
+  record.member_count = guild.member_count;
+  record.mfa_level = guild.mfa_level;
+  record.verify_level = guild.verify_level;
+  record.default_notifs = guild.default_notifs;
+  record.explicit_filter = guild.explicit_filter;
+  record.large = guild.large;
+
+  record.roles = w.reserve<Snap::Role>(guild.roles.size());
+  for (std::size_t j = 0; j < guild.roles.size(); j++) {
+    const cda::Role &role = *guild.roles[j];
+    Snap::Role r = {};
+    r.id = role.id;
+    r.name = w.str(role.name);
+    r.perms = (unsigned int)role.perms;
+    r.position = role.position;
+    r.color = (uint32_t)role.color.val();
+    r.hoist = role.hoist;
+    r.managed = role.managed;
+    r.mentionable = role.mentionable;
+    w.put(record.roles, j, r);
+  }
+
+  record.emojis = w.reserve<Snap::Emoji>(guild.emojis.size());
+  for (std::size_t j = 0; j < guild.emojis.size(); j++) {
+    const cda::Emoji &emoji = guild.emojis[j];
+    Snap::Emoji e = {};
+    e.id = emoji.id;
+    e.name = w.str(emoji.name);
+    e.managed = emoji.managed;
+    e.require_colons = emoji.require_colons;
+    w.put(record.emojis, j, e);
+  }
+
+  record.channels = w.reserve<Snap::Channel>(guild.channels.size());
+  for (std::size_t j = 0; j < guild.channels.size(); j++) {
+    const cda::Channel &channel = *guild.channels[j];
+    Snap::Channel c = {};
+    c.id = channel.id;
+    c.name = w.str(channel.name);
+    c.type = channel.type;
+    c.position = channel.position;
+    if (auto text = dynamic_cast<const cda::TextChannel*>(&channel)) {
+      c.topic = w.str(text->topic);
+      c.overwrites = WriteOverwrites(w, text->overwrites);
+    } else if (auto voice = dynamic_cast<const cda::VoiceChannel*>(&channel)) {
+      c.bitrate = voice->bitrate;
+      c.user_limit = voice->user_limit;
+      c.overwrites = WriteOverwrites(w, voice->overwrites);
+    }
+    w.put(record.channels, j, c);
+  }
+
+  record.members = w.reserve<Snap::Member>(guild.members.size());
+  std::size_t j = 0;
+  for (const auto &entry : guild.members) {
+    const cda::Member &member = *entry.second;
+    Snap::Member m = {};
+    m.user = member.user.get() != nullptr ? member.user->id : member.id;
+    m.joined = member.joined.getMillis();
+    m.nick = w.str(member.nick);
+    m.deaf = member.deaf;
+    m.mute = member.mute;
+    m.roles = w.reserve<uint64_t>(member.roles.size());
+    for (std::size_t k = 0; k < member.roles.size(); k++)
+      w.put(m.roles, k, (uint64_t)member.roles[k]);
+    w.put(record.members, j++, m);
+  }
+
+  w.put(header.guilds, i, record);
+}
+
+/**
+ * Close the image with the string table
+ * @return {Data} the snapshot image
+ */
+io::Data SnapshotBuild::finish() {
+  w.reserve<char>(0);
+  header.strings = w.out.size();
+  header.stringsSize = w.strings.size();
+  w.out.insert(w.out.end(), w.strings.begin(), w.strings.end());
+  header.size = w.out.size();
+  std::memcpy(&w.out[0], &header, sizeof(header));
+  return std::move(w.out);
+}
+
+/**
+ * Run slices of a build on every loop iteration until it is done
+ * @param {Loop} loop the loop of the cache
+ * @param {SnapshotBuild} build the build in progress
+ * @param {long} budget ms of work per slice
+ * @param {SnapshotCallback} done receives the image
+ */
+static void BuildSlice(io::Loop *loop, std::shared_ptr<SnapshotBuild> build,
+  long budget, cda::SnapshotCallback done)
+{
+  const io::TimeStamp deadline = io::Clock::now() +
+    std::chrono::milliseconds(budget);
+  if (!build->step(deadline)) {
+    loop->later(0, [loop, build, budget, done](){
+      BuildSlice(loop, build, budget, done);
+    });
+    return;
+  }
+  io::Data image = build->finish();
+  done(image);
+}
+
+/**
+ * Serialize the cache of a client at once
+ * @param {Client} client the client to snapshot
+ * @return {Data} the snapshot image
+ */
+io::Data cda::CacheSnapshot::build(cda::Client *client) {
+  SnapshotBuild build(client);
+  build.step(io::TimeStamp::max());
+  return build.finish();
+}
+
+/**
+ * Serialize the cache of a client in slices between loop iterations
+ * @param {Client} client the client to snapshot
+ * @param {long} budget ms of work per slice
+ * @param {SnapshotCallback} done receives the image on the loop
+ */
+void cda::CacheSnapshot::build(cda::Client *client, long budget,
+  cda::SnapshotCallback done)
+{
+  BuildSlice(client->loop, std::make_shared<SnapshotBuild>(client),
+    budget, done);
+}
+
+/**
+ * Write an image to a file
+ * @param {Data} image the snapshot image
+ * @param {string} path the file path
+ * @return {bool} if the file was written
+ */
+bool cda::CacheSnapshot::write(const io::Data &image, const std::string &path) {
+  const std::string temp = path + ".tmp";
+  int fd = open(temp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+  if (fd < 0) return false;
+
+  std::size_t written = 0;
+  while (written < image.size()) {
+    ssize_t n = ::write(fd, &image[written], image.size() - written);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) break;
+    written += n;
+  }
+
+  // readers only ever see a complete snapshot
+  bool ok = written == image.size() && fsync(fd) == 0;
+  close(fd);
+  if (ok) ok = rename(temp.c_str(), path.c_str()) == 0;
+  if (!ok) unlink(temp.c_str());
+  return ok;
+}
+
+class SnapshotReader {
+/** Bounds checked access to a mapped snapshot */
+public:
+  const char *base;
+  const Snap::Header *header;
+
+  inline SnapshotReader(const char *base, std::size_t size) : base(base) {
+    if (size < sizeof(Snap::Header))
+      throw std::runtime_error("snapshot is truncated");
+    header = (const Snap::Header*)base;
+    if (std::memcmp(header->magic, SnapshotMagic, sizeof(SnapshotMagic)) != 0)
+      throw std::runtime_error("not a cache snapshot");
+    if (header->endian != SNAPSHOT_ENDIAN)
+      throw std::runtime_error("snapshot has another byte order");
+    if (header->version != Snap::VERSION)
+      throw std::runtime_error("unsupported snapshot version "
+        + std::to_string(header->version));
+    if (header->size != size || header->strings > size
+      || header->stringsSize > size - header->strings)
+      throw std::runtime_error("snapshot is truncated");
+  }
+
+  /**
+   * Get a run of records
+   * @param {Array} array the run
+   * @return {T*} the first record
+   */
+  template <typename T>
+  inline const T *array(const Snap::Array &array) const {
+    if (array.count == 0) return nullptr;
+    if (array.offset % alignof(T) != 0 || array.offset > header->strings
+      || array.count > (header->strings - array.offset) / sizeof(T))
+      throw std::runtime_error("snapshot record out of bounds");
+    return (const T*)(base + array.offset);
+  }
+
+  /**
+   * Get a string of the string table
+   * @param {String} slice the slice
+   * @return {string} the string
+   */
+  inline std::string text(const Snap::String &slice) const {
+    if ((uint64_t)slice.offset + slice.length > header->stringsSize)
+      throw std::runtime_error("snapshot string out of bounds");
+    return std::string(base + header->strings + slice.offset, slice.length);
+  }
+
+  /** Get a pooled string of the string table */
+  inline io::Symbol symbol(const Snap::String &slice) const {
+    if (slice.length == 0) return io::Symbol();
+    if ((uint64_t)slice.offset + slice.length > header->stringsSize)
+      throw std::runtime_error("snapshot string out of bounds");
+    return io::StringPool::global().get(
+      base + header->strings + slice.offset, slice.length);
+  }
+};
+
+/**
+ * Restore the permission overwrites of a channel
+ * @param {SnapshotReader} r the reader
+ * @param {Array} array the overwrite records
+ * @param {vector} out the overwrites to fill
+ */
+static inline void ReadOverwrites(const SnapshotReader &r,
+  const Snap::Array &array, std::vector<cda::Overwrites> &out)
+{
+  const Snap::Overwrite *records = r.array<Snap::Overwrite>(array);
+  for (uint64_t i = 0; i < array.count; i++) {
+    cda::Overwrites overwrite;
+    overwrite.id = records[i].id;
+    overwrite.type = r.symbol(records[i].type);
+    overwrite.allow = records[i].allow;
+    overwrite.deny = records[i].deny;
+    out.push_back(overwrite);
+  }
+}
+
+/**
+ * Fill the client cache from a mapped snapshot
+ * @param {Client} client the client to fill
+ * @param {SnapshotReader} r the reader
+ * @return {size_t} the amount of guilds loaded
+ */
+static std::size_t LoadSnapshot(cda::Client *client, const SnapshotReader &r) {
+  // users, shared by the members of every guild
+  auto &users = client->users;
+  const Snap::User *userRecords = r.array<Snap::User>(r.header->users);
+  for (uint64_t i = 0; i < r.header->users.count; i++) {
+    const Snap::User &record = userRecords[i];
+    std::shared_ptr<cda::User> &user = users[record.id];
+    if (user.get() != nullptr) continue;
+    user = std::make_shared<cda::User>();
+    user->id = record.id;
+    user->client = client;
+    user->username = r.symbol(record.username);
+    user->avatar = r.symbol(record.avatar);
+    user->discrim = record.discrim;
+    user->bot = record.bot;
+    user->verified = record.verified;
+    user->mfa_enabled = record.mfa_enabled;
+  }
+
+  std::size_t loaded = 0;
+  const Snap::Guild *guildRecords = r.array<Snap::Guild>(r.header->guilds);
+  for (uint64_t i = 0; i < r.header->guilds.count; i++) {
+    const Snap::Guild &record = guildRecords[i];
+    if (client->getGuild(record.id).get() != nullptr) continue;
+    std::shared_ptr<cda::Guild> guild =
+      std::make_shared<cda::Guild>(record.id, client);
+    guild->stale = true;
+    guild->unavailable = false;
+    guild->joined = io::Date::fromMillis(record.joined);
+    guild->afk_channel_id = record.afk_channel_id;
+    guild->name = r.symbol(record.name);
+    guild->icon = r.symbol(record.icon);
+    guild->splash = r.symbol(record.splash);
+    guild->region = r.symbol(record.region);
+    guild->afk_timeout = record.afk_timeout;
+    guild->member_count = record.member_count;
+    guild->mfa_level = record.mfa_level;
+    guild->verify_level = record.verify_level;
+    guild->default_notifs = record.default_notifs;
+    guild->explicit_filter = record.explicit_filter;
+    guild->large = record.large;
+
+    const Snap::Role *roles = r.array<Snap::Role>(record.roles);
+    for (uint64_t j = 0; j < record.roles.count; j++) {
+      std::shared_ptr<cda::Role> role = std::make_shared<cda::Role>();
+      role->id = roles[j].id;
+      role->client = client;
+      role->guild = guild.get();
+      role->name = r.symbol(roles[j].name);
+      role->perms = cda::Permissions(roles[j].perms);
+      role->position = roles[j].position;
+      role->color = cda::Color::from((int)roles[j].color);
+      role->hoist = roles[j].hoist;
+      role->managed = roles[j].managed;
+      role->mentionable = roles[j].mentionable;
+      guild->roles.push_back(role);
+    }
+
+    const Snap::Emoji *emojis = r.array<Snap::Emoji>(record.emojis);
+    for (uint64_t j = 0; j < record.emojis.count; j++) {
+      cda::Emoji emoji;
+      emoji.id = emojis[j].id;
+      emoji.client = client;
+      emoji.guild = guild.get();
+      emoji.name = r.symbol(emojis[j].name);
+      emoji.managed = emojis[j].managed;
+      emoji.require_colons = emojis[j].require_colons;
+      guild->emojis.push_back(emoji);
+    }
+
+    const Snap::Channel *channels = r.array<Snap::Channel>(record.channels);
+    for (uint64_t j = 0; j < record.channels.count; j++) {
+      const Snap::Channel &c = channels[j];
+      std::shared_ptr<cda::Channel> channel = cda::Channel::create(c.type);
+      if (channel.get() == nullptr) continue;
+      channel->id = c.id;
+      channel->client = client;
+      channel->guild = guild.get();
+      channel->name = r.symbol(c.name);
+      channel->position = c.position;
+      if (auto text = std::dynamic_pointer_cast<cda::TextChannel>(channel)) {
+        text->topic = r.text(c.topic);
+        ReadOverwrites(r, c.overwrites, text->overwrites);
+      } else if (auto voice =
+        std::dynamic_pointer_cast<cda::VoiceChannel>(channel)) {
+        voice->bitrate = c.bitrate;
+        voice->user_limit = c.user_limit;
+        ReadOverwrites(r, c.overwrites, voice->overwrites);
+      }
+      guild->channels.push_back(channel);
+    }
+
+    const Snap::Member *members = r.array<Snap::Member>(record.members);
+    for (uint64_t j = 0; j < record.members.count; j++) {
+      const Snap::Member &m = members[j];
+      std::shared_ptr<cda::Member> member = std::make_shared<cda::Member>();
+      member->id = m.user;
+      member->client = client;
+      member->guild = guild.get();
+      member->joined = io::Date::fromMillis(m.joined);
+      member->nick = r.text(m.nick);
+      member->deaf = m.deaf;
+      member->mute = m.mute;
+      const uint64_t *roleIds = r.array<uint64_t>(m.roles);
+      member->roles.assign(roleIds, roleIds + m.roles.count);
+      auto user = users.find(m.user);
+      if (user != users.end()) member->user = user->second;
+      guild->members[member->id] = member;
+    }
+
+    if (record.owner != 0)
+      guild->owner = guild->getMember(record.owner);
+    client->guilds.push_back(guild);
+    loaded++;
+  }
+  return loaded;
+}
+
+/**
+ * Load a snapshot file into the cache of a client
+ * @param {Client} client the client to fill
+ * @param {string} path the file path
+ * @return {size_t} the amount of guilds loaded
+ */
+std::size_t cda::CacheSnapshot::load(cda::Client *client,
+  const std::string &path)
+{
+  int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) return 0;
+  struct stat info;
+  if (fstat(fd, &info) != 0 || info.st_size == 0) {
+    close(fd);
+    return 0;
+  }
+
+  // records are read straight from the mapping
+  const std::size_t size = info.st_size;
+  void *map = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) return 0;
+
+  std::size_t loaded = 0;
+  try {
+    SnapshotReader reader((const char*)map, size);
+    loaded = LoadSnapshot(client, reader);
+    std::cerr << "[cda] Loaded " << loaded << " guilds from cache snapshot "
+      << path << std::endl;
+  } catch (const std::exception &e) {
+    std::cerr << "[cda] Ignoring cache snapshot " << path << ": "
+      << e.what() << std::endl;
+  }
+  munmap(map, size);
+  return loaded;
+}
@@ -0,0 +1,136 @@
+#pragma once
+
+#include "launcher.hh"
+
+namespace cda {
+
+  // receives a finished snapshot image
+  typedef std::function<void(io::Data&)> SnapshotCallback;
+
+  class CacheSnapshot {
+  /**
+   * Versioned binary image of the entity cache. Every record has a
+   * fixed layout and refers to others by file offsets (never pointers),
+   * so a snapshot can be mapped and read in place without fixups.
+   *
+   * File layout:
+   *   Header | User[] | Guild[] | Role/Emoji/Channel/Member... | strings
+   */
+  public:
+    static const uint32_t VERSION = 1;
+
+    // slice of the string table
+    struct String {
+      uint32_t offset;  // from the start of the string table
+      uint32_t length;
+    };
+
+    // run of records
+    struct Array {
+      uint64_t offset;  // from the start of the file
+      uint64_t count;
+    };
+
+    struct Header {
+      char magic[8];      // CDACACHE
+      uint32_t version;   // layout version
+      uint32_t endian;    // 0x01020304 as written
+      int64_t created;    // unix ms the snapshot was taken
+      Array users;        // User records
+      Array guilds;       // Guild records
+      uint64_t strings;   // string table offset
+      uint64_t stringsSize;
+      uint64_t size;      // total file size
+    };
+
+    struct User {
+      uint64_t id;
+      String username;
+      String avatar;
+      uint16_t discrim;
+      uint8_t bot, verified, mfa_enabled, pad[3];
+    };
+
+    struct Role {
+      uint64_t id;
+      String name;
+      uint32_t perms, position, color;
+      uint8_t hoist, managed, mentionable, pad;
+    };
+
+    struct Emoji {
+      uint64_t id;
+      String name;
+      uint8_t managed, require_colons, pad[6];
+    };
+
+    struct Overwrite {
+      uint64_t id;
+      String type;
+      uint8_t allow, deny, pad[6];
+    };
+
+    struct Channel {
+      uint64_t id;
+      String name;
+      String topic;
+      uint32_t type, position, bitrate, user_limit;
+      Array overwrites;   // Overwrite records
+    };
+
+    struct Member {
+      uint64_t user;
+      int64_t joined;
+      String nick;
+      Array roles;        // role ids (uint64_t)
+      uint8_t deaf, mute, pad[6];
+    };
+
+    struct Guild {
+      uint64_t id;
+      int64_t joined;
+      uint64_t afk_channel_id;
+      uint64_t owner;
+      String name, icon, splash, region;
+      uint32_t afk_timeout, member_count;
+      int32_t mfa_level, verify_level, default_notifs, explicit_filter;
+      uint8_t large, pad[7];
+      Array roles, emojis, channels, members;
+    };
+
+    /**
+     * Serialize the cache of a client at once. Must run on the loop thread.
+     * @param {Client} client the client to snapshot
+     * @return {Data} the snapshot image
+     */
+    static io::Data build(Client *client);
+
+    /**
+     * Serialize the cache of a client a slice per loop iteration, so big
+     * caches do not stall the loop. Each guild is written whole; guilds
+     * changed during the build are taken as they were when reached.
+     * @param {Client} client the client to snapshot
+     * @param {long} budget ms of work per slice
+     * @param {SnapshotCallback} done receives the image on the loop
+     */
+    static void build(Client *client, long budget, SnapshotCallback done);
+
+    /**
+     * Write an image to a file (through a temporary file and rename)
+     * @param {Data} image the snapshot image
+     * @param {string} path the file path
+     * @return {bool} if the file was written
+     */
+    static bool write(const io::Data &image, const std::string &path);
+
+    /**
+     * Load a snapshot file into the cache of a client. Loaded guilds
+     * are marked stale until their GUILD_CREATE confirms them.
+     * @param {Client} client the client to fill
+     * @param {string} path the file path
+     * @return {size_t} the amount of guilds loaded
+     */
+    static std::size_t load(Client *client, const std::string &path);
+  };
+
+}
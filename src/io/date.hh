@@ -1,82 +1,124 @@
 #pragma once
 
-#include "json.hh"
+#include "parse.hh"
+#include <chrono>
 
 namespace io {
 
   class Date {
-  /** Basic Date object */
+  /** Compact UTC timestamp stored as milliseconds since the unix epoch */
   private:
-    std::tm dtime;
+    int64_t ms = 0;
+
+    /** Split the timestamp into its civil date fields */
+    struct Civil { int year, month, day; };
+    constexpr int64_t days() const {
+      return (ms >= 0 ? ms : ms - 86399999) / 86400000;
+    }
+    constexpr int64_t msOfDay() const {
+      return ms - days() * 86400000;
+    }
+    constexpr Civil civil() const {
+      // http://howardhinnant.github.io/date_algorithms.html
+      const int64_t z = days() + 719468;
+      const int64_t era = (z >= 0 ? z : z - 146096) / 146097;
+      const int64_t doe = z - era * 146097;
+      const int64_t yoe = (doe - doe/1460 + doe/36524 - doe/146096) / 365;
+      const int64_t doy = doe - (365*yoe + yoe/4 - yoe/100);
+      const int64_t mp = (5*doy + 2) / 153;
+      const int d = (int)(doy - (153*mp + 2)/5 + 1);
+      const int m = (int)(mp < 10 ? mp + 3 : mp - 9);
+      return Civil{(int)(yoe + era * 400) + (m <= 2), m, d};
+    }
+
   public:
     /** Date constructors */
-    inline Date() : Date(now()) {}
-    inline Date(const std::time_t _time) {
-      dtime = *std::gmtime(&_time);
-    }
+    constexpr Date() = default;
+    constexpr Date(const std::time_t _time) : ms((int64_t)_time * 1000) {}
     inline Date(const std::string &datetime) {
-      static const char* format = "%Y-%m-%dT%H:%M:%SZ";
-      std::istringstream ss{datetime.c_str()};
-      ss >> std::get_time(&dtime, format);
+      if (!ParseTimestamp(datetime.data(), datetime.size(), ms))
+        ms = 0;
+    }
+
+    /** Create a date from milliseconds since the epoch */
+    static constexpr Date fromMillis(const int64_t millis) {
+      Date d;
+      d.ms = millis;
+      return d;
     }
 
     /** Static function like javascript */
-    inline static std::time_t now() {
-      return std::time(nullptr);
+    inline static Date now() {
+      using namespace std::chrono;
+      return fromMillis(duration_cast<milliseconds>(
+        system_clock::now().time_since_epoch()).count());
     }
-    
+
     /** Date time accessors */
-    inline const int day() const {
-      return dtime.tm_mday;
+    constexpr int day() const {
+      return civil().day;
+    }
+    constexpr int year() const {
+      return civil().year;
+    }
+    constexpr int month() const {
+      return civil().month;
     }
-    inline const int year() const {
-      return dtime.tm_year + 1900;
+    constexpr int millis() const {
+      return (int)(msOfDay() % 1000);
     }
-    inline const int month() const {
-      return dtime.tm_mon + 1;
+    constexpr int secs() const {
+      return (int)(msOfDay() / 1000 % 60);
     }
-    inline const int secs() const {
-      return dtime.tm_sec;
+    constexpr int mins() const {
+      return (int)(msOfDay() / 60000 % 60);
     }
-    inline const int mins() const {
-      return dtime.tm_min;
+    constexpr int hours() const {
+      return (int)(msOfDay() / 3600000);
     }
-    inline const int hours() const {
-      return dtime.tm_hour;
+    constexpr std::time_t getTime() const {
+      return (std::time_t)(days() * 86400 + msOfDay() / 1000);
     }
-    inline const std::time_t getTime() const {
-      return std::mktime((std::tm*)&dtime);
+    constexpr int64_t getMillis() const {
+      return ms;
     }
-    inline std::string toString() {
-      char t[126] = {0};
-      static const char* format = "%Y-%m-%dT%H:%M:%SZ";
-      std::strftime(t, sizeof(t), format, &dtime);
+    inline std::string toString() const {
+      char t[64] = {0};
+      const Civil c = civil();
+      std::snprintf(t, sizeof(t), "%04d-%02d-%02dT%02d:%02d:%02d.%03dZ",
+        c.year, c.month, c.day, hours(), mins(), secs(), millis());
       return std::string(t);
     }
-    
+
     /** Operator overloads */
-    inline Date operator+(const Date& other) {
-      return Date(this->getTime() + other.getTime());
+    constexpr Date operator+(const Date& other) const {
+      return fromMillis(ms + other.ms);
+    }
+    constexpr Date operator-(const Date& other) const {
+      return fromMillis(ms - other.ms);
+    }
+    constexpr bool operator==(const Date& d2) const {
+      return ms == d2.ms;
     }
-    inline Date operator-(const Date& other) {
-      return Date(this->getTime() - other.getTime());
+    constexpr bool operator!=(const Date& d2) const {
+      return ms != d2.ms;
     }
-    inline bool operator> (const Date& d2) {
-      return this->getTime() > d2.getTime();
+    constexpr bool operator> (const Date& d2) const {
+      return ms > d2.ms;
     }
-    inline bool operator<= (const Date& d2) {
-      return this->getTime() <= d2.getTime();
+    constexpr bool operator<= (const Date& d2) const {
+      return ms <= d2.ms;
     }
-    inline bool operator< (const Date& d2) {
-      return this->getTime() < d2.getTime();
+    constexpr bool operator< (const Date& d2) const {
+      return ms < d2.ms;
     }
-    inline bool operator>= (const Date& d2) {
-      return this->getTime() >= d2.getTime();
+    constexpr bool operator>= (const Date& d2) const {
+      return ms >= d2.ms;
     }
-    inline operator const char*() { return this->toString().c_str(); }
-    inline friend std::ostream& operator<<(std::ostream &s, Date& d) {
+    inline friend std::ostream& operator<<(std::ostream &s, const Date& d) {
       s << d.toString(); return s;
     }
   };
 
-}
\ No newline at end of file
+  static_assert(sizeof(Date) == sizeof(int64_t), "Date must stay compact");
+}
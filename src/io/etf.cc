@@ -0,0 +1,376 @@
+#include "etf.hh"
+
+// deepest nesting accepted when decoding
+#define ETF_MAX_DEPTH 256
+
+class EtfReader {
+/** Cursor over an ETF payload, every read is bounds checked */
+public:
+  const unsigned char *data;
+  std::size_t len;
+  std::size_t offset = 0;
+
+  inline EtfReader(const char *data, std::size_t len) :
+    data((const unsigned char*)data), len(len) {}
+
+  // make sure enough bytes remain
+  inline void need(std::size_t count) {
+    if (count > len - offset)
+      throw std::invalid_argument("ETF payload is truncated");
+  }
+
+  // read big endian integers
+  inline uint8_t u8() {
+    need(1);
+    return data[offset++];
+  }
+  inline uint16_t u16() {
+    need(2);
+    uint16_t value = (uint16_t)((data[offset] << 8) | data[offset + 1]);
+    offset += 2;
+    return value;
+  }
+  inline uint32_t u32() {
+    need(4);
+    uint32_t value = ((uint32_t)data[offset] << 24)
+      | ((uint32_t)data[offset + 1] << 16)
+      | ((uint32_t)data[offset + 2] << 8)
+      | (uint32_t)data[offset + 3];
+    offset += 4;
+    return value;
+  }
+
+  // read raw bytes
+  inline const char *bytes(std::size_t count) {
+    need(count);
+    const char *start = (const char*)data + offset;
+    offset += count;
+    return start;
+  }
+
+  /**
+   * Convert an atom into its json value
+   * @param {size_t} length the atom length
+   * @return {json} null, a boolean or the atom name
+   */
+  inline nlohmann::json atom(std::size_t length) {
+    const char *name = bytes(length);
+    if (length == 3 && std::memcmp(name, "nil", 3) == 0) return nullptr;
+    if (length == 4 && std::memcmp(name, "true", 4) == 0) return true;
+    if (length == 5 && std::memcmp(name, "false", 5) == 0) return false;
+    return std::string(name, length);
+  }
+
+  /**
+   * Convert a little endian big integer
+   * @param {size_t} digits the amount of bytes
+   * @return {json} the signed or unsigned number
+   */
+  inline nlohmann::json big(std::size_t digits) {
+    const uint8_t sign = u8();
+    const unsigned char *bytes = (const unsigned char*)this->bytes(digits);
+    if (digits > 8)
+      throw std::invalid_argument("ETF integer wider than 64 bits");
+    uint64_t value = 0;
+    for (std::size_t i = digits; i > 0; i--)
+      value = (value << 8) | bytes[i - 1];
+    if (sign == 0) return value;
+    if (value > (uint64_t)INT64_MAX + 1)
+      throw std::invalid_argument("ETF integer wider than 64 bits");
+    return (int64_t)(0 - value);
+  }
+
+  /**
+   * Decode the next term
+   * @param {int} depth the current nesting
+   * @return {json} the decoded term
+   */
+  nlohmann::json term(int depth) {
+    if (depth > ETF_MAX_DEPTH)
+      throw std::invalid_argument("ETF payload is nested too deep");
+    const uint8_t tag = u8();
+    switch (tag) {
+      case io::Etf::SMALL_INTEGER_EXT:
+        return u8();
+      case io::Etf::INTEGER_EXT: {
+        // non negative values decode as unsigned, like json numbers do
+        const int32_t value = (int32_t)u32();
+        if (value >= 0) return (uint32_t)value;
+        return value;
+      }
+      case io::Etf::NEW_FLOAT_EXT: {
+        uint64_t bits = ((uint64_t)u32() << 32);
+        bits |= u32();
+        double value;
+        std::memcpy(&value, &bits, sizeof(value));
+        return value;
+      }
+      case io::Etf::FLOAT_EXT: {
+        std::string text(bytes(31), 31);
+        return std::strtod(text.c_str(), nullptr);
+      }
+      case io::Etf::ATOM_EXT:
+      case io::Etf::ATOM_UTF8_EXT:
+        return atom(u16());
+      case io::Etf::SMALL_ATOM_EXT:
+      case io::Etf::SMALL_ATOM_UTF8_EXT:
+        return atom(u8());
+      case io::Etf::BINARY_EXT: {
+        const uint32_t length = u32();
+        return std::string(bytes(length), length);
+      }
+      case io::Etf::STRING_EXT: {
+        const uint16_t length = u16();
+        return std::string(bytes(length), length);
+      }
+      case io::Etf::SMALL_BIG_EXT:
+        return big(u8());
+      case io::Etf::LARGE_BIG_EXT:
+        return big(u32());
+      case io::Etf::NIL_EXT:
+        return nlohmann::json::array();
+      case io::Etf::SMALL_TUPLE_EXT:
+        return list(u8(), depth, false);
+      case io::Etf::LARGE_TUPLE_EXT:
+        return list(u32(), depth, false);
+      case io::Etf::LIST_EXT:
+        return list(u32(), depth, true);
+      case io::Etf::MAP_EXT:
+        return map(u32(), depth);
+      case io::Etf::COMPRESSED:
+        throw std::invalid_argument("Compressed ETF is not supported");
+      default:
+        throw std::invalid_argument("Unsupported ETF tag "
+          + std::to_string(tag));
+    }
+  }
+
+  /**
+   * Decode a list or tuple
+   * @param {size_t} count the amount of elements
+   * @param {int} depth the current nesting
+   * @param {bool} tail if a list tail follows the elements
+   * @return {json} the array
+   */
+  nlohmann::json list(std::size_t count, int depth, bool tail) {
+    need(count); // every element takes at least a byte
+    nlohmann::json array = nlohmann::json::array();
+    for (std::size_t i = 0; i < count; i++)
+      array.push_back(term(depth + 1));
+
+    // proper lists end with an empty list
+    if (tail) {
+      nlohmann::json end = term(depth + 1);
+      if (!end.is_array() || !end.empty())
+        throw std::invalid_argument("Improper ETF lists are not supported");
+    }
+    return array;
+  }
+
+  /**
+   * Decode a map, keys become strings
+   * @param {size_t} count the amount of pairs
+   * @param {int} depth the current nesting
+   * @return {json} the object
+   */
+  nlohmann::json map(std::size_t count, int depth) {
+    need(count * 2);
+    nlohmann::json object = nlohmann::json::object();
+    for (std::size_t i = 0; i < count; i++) {
+      nlohmann::json key = term(depth + 1);
+      if (key.is_string())
+        object[key.get<std::string>()] = term(depth + 1);
+      else
+        object[key.dump()] = term(depth + 1);
+    }
+    return object;
+  }
+};
+
+/**
+ * Decode an ETF payload into a json value tree
+ * @param {const char*} data the payload
+ * @param {size_t} len the payload size
+ * @return {json} the decoded value
+ */
+nlohmann::json io::EtfDecode(const char *data, std::size_t len) {
+  EtfReader reader(data, len);
+  if (reader.u8() != io::Etf::VERSION)
+    throw std::invalid_argument("Unknown ETF version");
+  return reader.term(0);
+}
+
+// append bytes to a buffer or fragmented message
+template <typename Buffer>
+static inline void Put(Buffer &out, const char *data, std::size_t len) {
+  out.insert(out.end(), data, data + len);
+}
+static inline void Put(io::WebsockStream &out, const char *data,
+  std::size_t len)
+{
+  out.write(data, len);
+}
+template <typename Buffer>
+static inline void Put(Buffer &out, char c) {
+  out.push_back(c);
+}
+static inline void Put(io::WebsockStream &out, char c) {
+  out.put(c);
+}
+
+template <typename Buffer>
+class EtfWriter {
+/** Appends ETF terms to a buffer (std::string, io::Data or a stream) */
+public:
+  Buffer &out;
+
+  inline EtfWriter(Buffer &out) : out(out) {}
+
+  // append raw bytes
+  inline void bytes(const char *data, std::size_t len) {
+    Put(out, data, len);
+  }
+
+  // write big endian integers
+  inline void u8(uint8_t value) {
+    Put(out, (char)value);
+  }
+  inline void u16(uint16_t value) {
+    u8(value >> 8);
+    u8(value & 0xff);
+  }
+  inline void u32(uint32_t value) {
+    u16(value >> 16);
+    u16(value & 0xffff);
+  }
+
+  // write an atom
+  inline void atom(const char *name) {
+    const std::size_t length = std::strlen(name);
+    u8(io::Etf::ATOM_EXT);
+    u16((uint16_t)length);
+    bytes(name, length);
+  }
+
+  // write an integer with its magnitude and sign
+  inline void integer(uint64_t magnitude, bool negative) {
+    if (!negative && magnitude <= 0xff) {
+      u8(io::Etf::SMALL_INTEGER_EXT);
+      u8((uint8_t)magnitude);
+    } else if (magnitude <= (negative ? 0x80000000ULL : 0x7fffffffULL)) {
+      u8(io::Etf::INTEGER_EXT);
+      u32((uint32_t)(negative ? 0 - magnitude : magnitude));
+    } else {
+      // the byte count comes first, streams can not patch it later
+      uint8_t digits = 0;
+      for (uint64_t rest = magnitude; rest > 0; rest >>= 8) digits++;
+      u8(io::Etf::SMALL_BIG_EXT);
+      u8(digits);
+      u8(negative ? 1 : 0);
+      for (; magnitude > 0; magnitude >>= 8)
+        u8(magnitude & 0xff);
+    }
+  }
+
+  /**
+   * Encode a json value
+   * @param {json} value the value to encode
+   */
+  void term(const nlohmann::json &value) {
+    switch (value.type()) {
+      case nlohmann::json::value_t::null:
+      case nlohmann::json::value_t::discarded:
+        atom("nil");
+        break;
+      case nlohmann::json::value_t::boolean:
+        atom(value.get<bool>() ? "true" : "false");
+        break;
+      case nlohmann::json::value_t::number_unsigned:
+        integer(value.get<uint64_t>(), false);
+        break;
+      case nlohmann::json::value_t::number_integer: {
+        const int64_t number = value.get<int64_t>();
+        integer(number < 0 ? 0 - (uint64_t)number : (uint64_t)number,
+          number < 0);
+        break;
+      }
+      case nlohmann::json::value_t::number_float: {
+        const double number = value.get<double>();
+        uint64_t bits;
+        std::memcpy(&bits, &number, sizeof(bits));
+        u8(io::Etf::NEW_FLOAT_EXT);
+        u32((uint32_t)(bits >> 32));
+        u32((uint32_t)(bits & 0xffffffff));
+        break;
+      }
+      case nlohmann::json::value_t::string: {
+        const std::string &text = *value.get_ptr<const std::string*>();
+        u8(io::Etf::BINARY_EXT);
+        u32((uint32_t)text.size());
+        bytes(text.data(), text.size());
+        break;
+      }
+      case nlohmann::json::value_t::array:
+        if (!value.empty()) {
+          u8(io::Etf::LIST_EXT);
+          u32((uint32_t)value.size());
+          for (const nlohmann::json &item : value)
+            term(item);
+        }
+        u8(io::Etf::NIL_EXT);
+        break;
+      case nlohmann::json::value_t::object:
+        u8(io::Etf::MAP_EXT);
+        u32((uint32_t)value.size());
+        for (auto it = value.begin(); it != value.end(); ++it) {
+          const std::string &key = it.key();
+          u8(io::Etf::BINARY_EXT);
+          u32((uint32_t)key.size());
+          bytes(key.data(), key.size());
+          term(it.value());
+        }
+        break;
+    }
+  }
+};
+
+/**
+ * Encode a json value as an ETF payload
+ * @param {json} value the value to encode
+ * @return {string} the payload bytes
+ */
+std::string io::EtfEncode(const nlohmann::json &value) {
+  std::string out;
+  EtfWriter<std::string> writer(out);
+  writer.u8(io::Etf::VERSION);
+  writer.term(value);
+  return out;
+}
+
+/**
+ * Append a json value as an ETF payload
+ * @param {json} value the value to encode
+ * @param {Data&} out the buffer to append to
+ * @param {bool} version if the version byte starts the payload
+ */
+void io::EtfEncode(const nlohmann::json &value, io::Data &out,
+  bool version)
+{
+  EtfWriter<io::Data> writer(out);
+  if (version) writer.u8(io::Etf::VERSION);
+  writer.term(value);
+}
+
+/**
+ * Append a json value as an ETF payload to a fragmented message
+ * @param {json} value the value to encode
+ * @param {WebsockStream&} out the message to append to
+ * @param {bool} version if the version byte starts the payload
+ */
+void io::EtfEncode(const nlohmann::json &value, io::WebsockStream &out,
+  bool version)
+{
+  EtfWriter<io::WebsockStream> writer(out);
+  if (version) writer.u8(io::Etf::VERSION);
+  writer.term(value);
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include "http.hh"
+
+namespace io {
+
+  /**
+   * Erlang External Term Format tags
+   * (http://erlang.org/doc/apps/erts/erl_ext_dist.html)
+   */
+  struct Etf {
+    static const unsigned char VERSION          = 131;
+    static const unsigned char NEW_FLOAT_EXT    = 70;
+    static const unsigned char COMPRESSED       = 80;
+    static const unsigned char SMALL_INTEGER_EXT = 97;
+    static const unsigned char INTEGER_EXT      = 98;
+    static const unsigned char FLOAT_EXT        = 99;
+    static const unsigned char ATOM_EXT         = 100;
+    static const unsigned char SMALL_TUPLE_EXT  = 104;
+    static const unsigned char LARGE_TUPLE_EXT  = 105;
+    static const unsigned char NIL_EXT          = 106;
+    static const unsigned char STRING_EXT       = 107;
+    static const unsigned char LIST_EXT         = 108;
+    static const unsigned char BINARY_EXT       = 109;
+    static const unsigned char SMALL_BIG_EXT    = 110;
+    static const unsigned char LARGE_BIG_EXT    = 111;
+    static const unsigned char SMALL_ATOM_EXT   = 115;
+    static const unsigned char MAP_EXT          = 116;
+    static const unsigned char ATOM_UTF8_EXT    = 118;
+    static const unsigned char SMALL_ATOM_UTF8_EXT = 119;
+  };
+
+  /**
+   * Decode an ETF payload into a json value tree. Atoms nil, true and
+   * false map to null and booleans, other atoms and binaries to strings,
+   * and big integers up to 64 bits (snowflakes) to unsigned numbers.
+   * @param {const char*} data the payload
+   * @param {size_t} len the payload size
+   * @return {json} the decoded value
+   * @throws {invalid_argument} on malformed or unsupported terms
+   */
+  nlohmann::json EtfDecode(const char *data, std::size_t len);
+
+  /**
+   * Encode a json value as an ETF payload the way erlpack does
+   * (strings as binaries, objects as maps, arrays as lists)
+   * @param {json} value the value to encode
+   * @return {string} the payload bytes
+   */
+  std::string EtfEncode(const nlohmann::json &value);
+
+  /**
+   * Append a json value as an ETF payload, ex: into a frame Buffer()
+   * @param {json} value the value to encode
+   * @param {Data&} out the buffer to append to
+   * @param {bool} version if the version byte starts the payload
+   *   (false to append a term inside an already started payload)
+   */
+  void EtfEncode(const nlohmann::json &value, Data &out,
+    bool version = true);
+
+  /**
+   * Append a json value as an ETF payload to a message sent while it
+   * is written
+   * @param {json} value the value to encode
+   * @param {WebsockStream&} out the message to append to
+   * @param {bool} version if the version byte starts the payload
+   */
+  void EtfEncode(const nlohmann::json &value, WebsockStream &out,
+    bool version = true);
+
+}
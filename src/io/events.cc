@@ -1,30 +1,93 @@
 #include "events.hh"
 
-io::Emitter::Emitter() {}
-io::Emitter::~Emitter() {}
+/**
+ * Create an emitter
+ * @param {uint} size the amount of event ids supported
+ */
+io::Emitter::Emitter(io::uint size) : size(size) {
+  slots.reset(new std::atomic<ListBase*>[size]);
+  for (io::uint i = 0; i < size; i++)
+    slots[i] = nullptr;
+}
 
-io::uint io::Emitter::add(io::uint eid, std::function<void()> cb) {
-  if (!cb)
-    throw std::invalid_argument("No callback given!");
-  std::lock_guard<std::mutex> lock(mutex);
-  uint lid = ++last;
-  map.insert(std::make_pair(eid,
-    std::make_shared<Listener<>>(lid, cb)));
-  return lid;
+/**
+ * Free every listener snapshot
+ */
+io::Emitter::~Emitter() {
+  for (io::uint i = 0; i < size; i++)
+    delete slots[i].load();
+  for (std::vector<ListBase*> &lists : retired)
+    for (ListBase *list : lists)
+      delete list;
+}
+
+/**
+ * Count an emit in the current generation
+ * @return {uint} the generation to leave
+ */
+io::uint io::Emitter::enter() {
+  while (true) {
+    const io::uint gen = epoch.load();
+    readers[gen & 1]++;
+    if (epoch.load() == gen) return gen;
+    readers[gen & 1]--; // a writer moved on, count in the new one
+  }
+}
+
+/**
+ * Finish an emit, the last one of an old generation frees its snapshots
+ * @param {uint} gen the generation from enter()
+ */
+void io::Emitter::leave(io::uint gen) {
+  if (readers[gen & 1].fetch_sub(1) != 1 || epoch.load() == gen) return;
+  std::unique_lock<std::mutex> lock(mutex, std::try_to_lock);
+  if (lock.owns_lock()) collect();
 }
 
-io::uint io::Emitter::on(io::uint eid, std::function<void()> cb) {
-  return add(eid, cb);
+/**
+ * Free the snapshots no emit can still be reading (writer lock held).
+ * Snapshots retired in the current generation wait until the next one
+ * starts and the emits counted in it returned.
+ */
+void io::Emitter::collect() {
+  while (true) {
+    const io::uint gen = epoch.load();
+    const io::uint previous = (gen + 1) & 1;
+    if (readers[previous].load() != 0) return;
+    for (ListBase *dead : retired[previous])
+      delete dead;
+    retired[previous].clear();
+
+    // start a new generation so the current snapshots can follow
+    if (retired[gen & 1].empty()) return;
+    epoch.store(gen + 1);
+  }
 }
 
+/**
+ * Swap in a new snapshot for an event (writer lock must be held)
+ * @param {uint} eid the event id
+ * @param {ListBase*} list the new snapshot, nullptr when empty
+ */
+void io::Emitter::publish(io::uint eid, ListBase *list) {
+  ListBase *old = slots[eid].exchange(list);
+  if (old != nullptr) retired[epoch.load() & 1].push_back(old);
+  collect();
+}
+
+/**
+ * Remove a listener by id
+ * @param {uint} lid the id returned from on()
+ */
 void io::Emitter::remove(io::uint lid) {
   std::lock_guard<std::mutex> lock(mutex);
-  auto id = std::find_if(map.begin(), map.end(),
-  [&](std::pair<const io::uint, std::shared_ptr<ListenerBase>> p) {
-    return p.second->id == lid;
-  });
-  if (id != map.end())
-    map.erase(id);
-  else
-    throw std::invalid_argument("Invalid event id");
-}
\ No newline at end of file
+  for (io::uint eid = 0; eid < size; eid++) {
+    const ListBase *list = slots[eid].load();
+    if (list == nullptr) continue;
+    auto it = std::find(list->ids.begin(), list->ids.end(), lid);
+    if (it == list->ids.end()) continue;
+    publish(eid, list->without(it - list->ids.begin()));
+    return;
+  }
+  throw std::invalid_argument("Invalid event id");
+}
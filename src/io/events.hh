@@ -1,93 +1,153 @@
 #pragma once
 
-#include "date.hh"
+#include "intern.hh"
 #include <mutex>
-#include <list>
-
-/******************************************************/
-/* https://gist.github.com/rioki/1290004d7505380f2b1d */
-/******************************************************/
+#include <atomic>
+#include <tuple>
 
 namespace io {
 
   // small extras
   typedef unsigned int uint;
 
-  class Emitter {
-  public:
-    Emitter();
-    ~Emitter();
+  /**
+   * Compile time event descriptor. The id selects the listener slot
+   * and Args is the signature every listener of that slot receives.
+   * An id must only ever be paired with one signature (see SignalTraits).
+   */
+  template <uint Id, typename ...Args>
+  struct Signal {
+    static const uint id = Id;
+    typedef std::tuple<Args...> Tuple;
+    typedef std::function<void(const Args&...)> Callback;
+    typedef std::function<bool(const Args&...)> Filter;
+  };
 
-    void remove(uint id);
-    uint on(uint id, std::function<void()> cb);
-    uint add(uint id, std::function<void()> cb);
+  /**
+   * The one signature of an event id, every id used with an Emitter
+   * needs a specialization with its Tuple. on() and emit() refuse to
+   * compile for a Signal pairing the id with other arguments.
+   * ex: template <> struct SignalTraits<1> : Signal<1, int> {};
+   */
+  template <uint Id, typename Enable = void>
+  struct SignalTraits;
 
-    template <typename ...Args>
-    uint add(uint id, std::function<void(Args...)> cb);
+  /** If a signal matches the signature registered for its id */
+  template <typename Sig>
+  static constexpr bool IsSignal = std::is_same<typename Sig::Tuple,
+    typename SignalTraits<Sig::id>::Tuple>::value;
 
-    template <typename ...Args>
-    uint on(uint id, std::function<void(Args...)> cb);
+  class Emitter {
+  /**
+   * Event emitter with a contiguous listener list per event id.
+   * Writers copy the list and publish the new snapshot atomically so
+   * emit() never takes a lock. Replaced snapshots are reclaimed by
+   * generation: emits count themselves in the generation they started
+   * in, and a generation's snapshots are freed once its last emit
+   * returned, so steady emitting never keeps them alive.
+   */
+  public:
+    Emitter(uint size = 64);
+    ~Emitter();
 
-    template <typename ...Args>
-    void emit(uint id, Args... args);
+    /**
+     * Add a listener for an event
+     * @param {Callback} cb the listener to invoke on emit
+     * @return {uint} the listener id used for removal
+     */
+    template <typename Sig>
+    uint on(typename Sig::Callback cb);
+
+    /**
+     * Invoke every listener of an event
+     * @param {Args} args the arguments matching the event signature
+     */
+    template <typename Sig, typename ...Args>
+    void emit(const Args&... args);
+
+    /**
+     * Check if an event has any listeners
+     * @param {uint} eid the event id
+     * @return {bool} if emitting would invoke anything
+     */
+    inline bool has(uint eid) const {
+      return eid < size && slots[eid].load() != nullptr;
+    }
+
+    /**
+     * Remove a listener by id
+     * @param {uint} lid the id returned from on()
+     */
+    void remove(uint lid);
 
   private:
-
-    struct ListenerBase {
-      uint id;
-      ListenerBase() {}
-      ListenerBase(uint i) : id(i) {}
-      virtual ~ListenerBase() {}
+    struct ListBase {
+      std::vector<uint> ids; // listener ids, parallel to the callbacks
+      virtual ~ListBase() {}
+      virtual ListBase *without(std::size_t index) const = 0;
     };
 
-    template <typename ...Args>
-    struct Listener : public ListenerBase {
-      Listener() {}
-      std::function<void(Args...)> cb;
-      Listener(uint i, std::function<void(Args...)> c)
-        : ListenerBase(i), cb(c) {}
+    template <typename Cb>
+    struct List : public ListBase {
+      std::vector<Cb> callbacks;
+      ListBase *without(std::size_t index) const {
+        if (ids.size() == 1) return nullptr;
+        List *copy = new List(*this);
+        copy->ids.erase(copy->ids.begin() + index);
+        copy->callbacks.erase(copy->callbacks.begin() + index);
+        return copy;
+      }
     };
 
     Emitter(const Emitter&) = delete;
     const Emitter& operator= (const Emitter&) = delete;
 
-    uint last;
-    std::mutex mutex;
-    std::multimap<uint, std::shared_ptr<ListenerBase>> map;
+    void publish(uint eid, ListBase *list);
+    void collect();
+    uint enter();
+    void leave(uint gen);
+
+    uint size;                                  // amount of event slots
+    uint last = 0;                              // last listener id
+    std::mutex mutex;                           // serializes writers
+    std::atomic<uint> epoch{0};                 // current generation
+    std::atomic<long> readers[2] = {};          // emits per generation parity
+    std::vector<ListBase*> retired[2];          // snapshots per generation parity
+    std::unique_ptr<std::atomic<ListBase*>[]> slots;
   };
 
 }
 
-template <typename ...Args>
-uint io::Emitter::add(uint eid, std::function<void(Args...)> cb) {
+template <typename Sig>
+io::uint io::Emitter::on(typename Sig::Callback cb) {
+  static_assert(IsSignal<Sig>, "Signal id used with another signature");
+  typedef List<typename Sig::Callback> SigList;
   if (!cb)
     throw std::invalid_argument("No callback given!");
+  if (Sig::id >= size)
+    throw std::invalid_argument("Invalid event id");
+
+  // copy the current snapshot with the new listener appended
   std::lock_guard<std::mutex> lock(mutex);
-  uint lid = ++last;
-  map.insert(std::make_pair(eid,
-    std::make_shared<Listener<Args...>>(lid, cb)));
-  return lid;
+  const SigList *current = static_cast<const SigList*>(slots[Sig::id].load());
+  SigList *list = current ? new SigList(*current) : new SigList();
+  list->ids.push_back(++last);
+  list->callbacks.push_back(cb);
+  publish(Sig::id, list);
+  return last;
 }
 
-template <typename ...Args>
-uint io::Emitter::on(uint eid, std::function<void(Args...)> cb) {
-  return add(eid, cb);
+template <typename Sig, typename ...Args>
+void io::Emitter::emit(const Args&... args) {
+  static_assert(IsSignal<Sig>, "Signal id used with another signature");
+  typedef List<typename Sig::Callback> SigList;
+  if (Sig::id >= size) return;
+
+  // pin the snapshot for the duration of the callbacks
+  const uint gen = enter();
+  const SigList *list = static_cast<const SigList*>(slots[Sig::id].load());
+  if (list != nullptr)
+    for (const typename Sig::Callback &cb : list->callbacks)
+      cb(args...);
+  leave(gen);
 }
-
-template <typename ...Args>
-void io::Emitter::emit(uint eid, Args... args) {
-  std::list<std::shared_ptr<Listener<Args...>>> handlers;
-  {
-    std::lock_guard<std::mutex> lock(mutex);
-    auto range = map.equal_range(eid);
-    handlers.resize(std::distance(range.first, range.second));
-    std::transform(range.first, range.second, handlers.begin(),
-    [](std::pair<const uint, std::shared_ptr<ListenerBase>> p){
-      auto lid = std::dynamic_pointer_cast<Listener<Args...>>(p.second);
-      if (lid) return lid;
-      throw std::logic_error("Invalid event signature");
-    });
-  }
-  for (auto &handler : handlers)
-    handler->cb(args...);
-}
\ No newline at end of file
@@ -0,0 +1,185 @@
+#include "executor.hh"
+#include <iostream>
+
+// max amount of strand tasks ran before yielding the worker
+#define STRAND_BATCH 64
+
+/**
+ * Run a task, reporting exceptions instead of killing the worker
+ * @param {Callback} task the task to run
+ */
+static inline void Invoke(io::Callback &task) {
+  try {
+    task();
+  } catch (const std::exception &e) {
+    std::cerr << "[io] Executor task threw: " << e.what() << std::endl;
+  } catch (...) {
+    std::cerr << "[io] Executor task threw" << std::endl;
+  }
+}
+
+/**
+ * Create the pool, workers start with the first posted task
+ * @param {uint} threads amount of workers (0 for hardware threads)
+ * @param {size_t} capacity pending tasks considered saturated
+ */
+io::Executor::Executor(io::uint threads, std::size_t capacity)
+  : capacity(capacity), count(threads), strands(new Strand[STRANDS]) {}
+
+/**
+ * Change the amount of workers, only before the first task is posted
+ * @param {uint} count amount of workers (0 for hardware threads)
+ */
+void io::Executor::threads(io::uint count) {
+  if (!workers.empty())
+    throw std::runtime_error("Executor workers already started");
+  this->count = count;
+}
+
+/**
+ * Start the worker threads
+ */
+void io::Executor::start() {
+  io::uint threads = count;
+  if (threads == 0)
+    threads = std::max(2u, std::thread::hardware_concurrency());
+  for (io::uint i = 0; i < threads; i++)
+    workers.emplace_back(new Worker());
+  for (io::uint i = 0; i < threads; i++)
+    workers[i]->thread = std::thread(&io::Executor::run, this, i);
+}
+
+/**
+ * Run the remaining tasks then join the workers
+ */
+io::Executor::~Executor() {
+  {
+    std::lock_guard<std::mutex> lock(idleMutex);
+    stopping = true;
+  }
+  idle.notify_all();
+  for (auto &worker : workers)
+    worker->thread.join();
+}
+
+/**
+ * Push a job onto a worker queue and wake a sleeping worker
+ * @param {Callback} job the job to schedule
+ */
+void io::Executor::schedule(io::Callback job) {
+  std::call_once(started, &io::Executor::start, this);
+  Worker &worker = *workers[next++ % workers.size()];
+  {
+    std::lock_guard<std::mutex> lock(worker.mutex);
+    worker.jobs.push_back(std::move(job));
+  }
+  {
+    std::lock_guard<std::mutex> lock(idleMutex);
+    ready++;
+  }
+  idle.notify_one();
+}
+
+/**
+ * Take a job from the workers own queue or steal from another
+ * @param {uint} index the worker taking the job
+ * @param {Callback&} job the job taken
+ * @return {bool} if a job was found
+ */
+bool io::Executor::take(io::uint index, io::Callback &job) {
+  const std::size_t count = workers.size();
+  for (std::size_t i = 0; i < count; i++) {
+    Worker &worker = *workers[(index + i) % count];
+    std::lock_guard<std::mutex> lock(worker.mutex);
+    if (worker.jobs.empty()) continue;
+
+    // own jobs run oldest first, stolen jobs come from the back
+    if (i == 0) {
+      job = std::move(worker.jobs.front());
+      worker.jobs.pop_front();
+    } else {
+      job = std::move(worker.jobs.back());
+      worker.jobs.pop_back();
+    }
+    ready--;
+    return true;
+  }
+  return false;
+}
+
+/**
+ * Worker thread main loop
+ * @param {uint} index the index of the worker
+ */
+void io::Executor::run(io::uint index) {
+  io::Callback job;
+  while (true) {
+    if (take(index, job)) {
+      Invoke(job);
+      job = nullptr;
+      continue;
+    }
+    std::unique_lock<std::mutex> lock(idleMutex);
+    if (stopping && ready == 0) break;
+    idle.wait(lock, [this]() { return ready > 0 || stopping; });
+  }
+}
+
+/**
+ * Run a batch of strand tasks then reschedule if any remain
+ * @param {Strand*} strand the strand to drain
+ */
+void io::Executor::drain(Strand *strand) {
+  io::Callback task;
+  for (int i = 0; i < STRAND_BATCH; i++) {
+    {
+      std::lock_guard<std::mutex> lock(strand->mutex);
+      if (strand->tasks.empty()) {
+        strand->scheduled = false;
+        return;
+      }
+      task = std::move(strand->tasks.front());
+      strand->tasks.pop_front();
+    }
+    Invoke(task);
+    queued--;
+  }
+
+  // let other strands run before continuing
+  io::Executor *self = this;
+  schedule([self, strand]() { self->drain(strand); });
+}
+
+/**
+ * Run a task, serialized with every other task of the same key
+ * @param {uint64_t} key the ordering key (ex: guild id)
+ * @param {Callback} task the task to run
+ */
+void io::Executor::post(uint64_t key, io::Callback task) {
+  // snowflake low bits barely change, so mix the whole key
+  key ^= key >> 22;
+  key *= 0x9e3779b97f4a7c15ULL;
+  Strand *strand = &strands[(key >> 32) % STRANDS];
+
+  queued++;
+  std::lock_guard<std::mutex> lock(strand->mutex);
+  strand->tasks.push_back(std::move(task));
+  if (!strand->scheduled) {
+    strand->scheduled = true;
+    io::Executor *self = this;
+    schedule([self, strand]() { self->drain(strand); });
+  }
+}
+
+/**
+ * Run a task with no ordering guarantees
+ * @param {Callback} task the task to run
+ */
+void io::Executor::post(io::Callback task) {
+  queued++;
+  io::Executor *self = this;
+  schedule([self, task]() mutable {
+    Invoke(task);
+    self->queued--;
+  });
+}
@@ -0,0 +1,94 @@
+#pragma once
+
+#include "loop.hh"
+#include <thread>
+#include <condition_variable>
+
+namespace io {
+
+  class Executor {
+  /**
+   * Work stealing thread pool for running tasks off the event loop.
+   * Tasks posted with the same key run one at a time in post order.
+   */
+  public:
+    std::size_t capacity; // pending tasks considered saturated
+
+    /**
+     * Create the pool, workers start with the first posted task
+     * @param {uint} threads amount of workers (0 for hardware threads)
+     * @param {size_t} capacity pending tasks considered saturated
+     */
+    Executor(uint threads = 0, std::size_t capacity = 4096);
+
+    /**
+     * Change the amount of workers, only before the first task is posted
+     * @param {uint} count amount of workers (0 for hardware threads)
+     */
+    void threads(uint count);
+
+    /**
+     * Run the remaining tasks then join the workers
+     */
+    ~Executor();
+
+    /**
+     * Run a task, serialized with every other task of the same key
+     * @param {uint64_t} key the ordering key (ex: guild id)
+     * @param {Callback} task the task to run
+     */
+    void post(uint64_t key, Callback task);
+
+    /**
+     * Run a task with no ordering guarantees
+     * @param {Callback} task the task to run
+     */
+    void post(Callback task);
+
+    /** Amount of tasks posted but not yet finished */
+    inline std::size_t pending() const {
+      return queued.load();
+    }
+
+    /** If producers should stop feeding new tasks */
+    inline bool saturated() const {
+      return pending() >= capacity;
+    }
+
+  private:
+    // amount of ordering lanes keys are hashed into
+    static const uint STRANDS = 256;
+
+    struct Strand {
+      std::mutex mutex;
+      bool scheduled = false;
+      std::deque<Callback> tasks;
+    };
+
+    struct Worker {
+      std::mutex mutex;
+      std::thread thread;
+      std::deque<Callback> jobs;
+    };
+
+    Executor(const Executor&) = delete;
+    const Executor& operator= (const Executor&) = delete;
+
+    void start();
+    void run(uint index);
+    void drain(Strand *strand);
+    void schedule(Callback job);
+    bool take(uint index, Callback &job);
+
+    uint count;                          // workers to start
+    std::once_flag started;              // workers were started
+    std::atomic<bool> stopping{false};   // destructor was called
+    std::atomic<uint> next{0};           // round robin worker index
+    std::atomic<long> ready{0};          // jobs sitting in worker queues
+    std::atomic<std::size_t> queued{0};  // tasks not yet finished
+    std::mutex idleMutex;                // guards sleeping workers
+    std::condition_variable idle;        // wakes sleeping workers
+    std::unique_ptr<Strand[]> strands;
+    std::vector<std::unique_ptr<Worker>> workers;
+  };
+}
@@ -88,18 +88,20 @@ bool io::HttpClient::Request(io::HttpRequest &req,
   if (!cached) {
     sock->onConnect([sock, buffer]() {
       io::Data copy(buffer.begin(), buffer.end());
-      sock->Write(copy);
+      sock->Write(std::move(copy));
     });
 
   // if cached, write the http data
   } else {
     if (cached) route->addTask(callback);
-    sock->Write(buffer);
+    sock->Write(std::move(buffer));
   }
 
   // handle reading and parsing the data
   if (!cached) {
-    sock->onRead([self, sock, &req, callback]
+    const std::string host = req.uri.host;
+    std::shared_ptr<bool> answered = std::make_shared<bool>(false);
+    sock->onRead([self, sock, host, callback, answered]
     (io::Data &data) {
       io::HttpResponse resp;                // the response object
       std::size_t used = 0;                 // buffered parsing var
@@ -114,7 +116,7 @@ bool io::HttpClient::Request(io::HttpRequest &req,
 
         // check if connection is cached
         bool cached = 
-          self->cache.find(req.uri.host) != self->cache.end();
+          self->cache.find(host) != self->cache.end();
   
         // add connection to cache if keep alive
         if (resp.has_header("Connection")) {
@@ -122,25 +124,26 @@ bool io::HttpClient::Request(io::HttpRequest &req,
           if (conn.find("keep-alive") != std::string::npos) {
             io::HttpRoute _route(sock);
             self->cache.insert(std::pair<std::string, io::HttpRoute>(
-              req.uri.host, _route));
+              host, _route));
           
           // remove connection from cache if not keep-alive
           } else {
-            if (self->cache.find(req.uri.host) != self->cache.end())
-              self->cache.erase(req.uri.host);
+            if (self->cache.find(host) != self->cache.end())
+              self->cache.erase(host);
             cached = false;
           }
         }
 
         // connection not cached, perform callback
         if (!cached) {
-          if (self->cache.find(req.uri.host) == self->cache.end())
+          *answered = true;
+          if (self->cache.find(host) == self->cache.end())
             delete sock;
           callback(resp);
 
         // connection cached, perform last callback
         } else {
-          HttpRoute &route = self->cache[req.uri.host];
+          HttpRoute &route = self->cache[host];
           if (route.hasTask()) {
             io::HttpCallback task = route.getTask();
             task(resp);
@@ -149,13 +152,25 @@ bool io::HttpClient::Request(io::HttpRequest &req,
       }
     });
 
-    // remove from cached when disconnected
-    if (!cached) {
-      sock->onClose([self, &req](int error){
-        if (self->cache.find(req.uri.host) != self->cache.end())
-          self->cache.erase(req.uri.host);
-      });
-    }
+    // remove from cached when disconnected and fail the requests
+    // still waiting for a response with status 0
+    sock->onClose([self, sock, host, callback, answered](int error){
+      std::vector<io::HttpCallback> waiting;
+      if (!*answered) {
+        *answered = true;
+        waiting.push_back(callback);
+      }
+      auto route = self->cache.find(host);
+      if (route != self->cache.end() && route->second.getSock() == sock) {
+        while (route->second.hasTask())
+          waiting.push_back(route->second.getTask());
+        self->cache.erase(route);
+      }
+      for (io::HttpCallback &task : waiting) {
+        io::HttpResponse failed;
+        task(failed);
+      }
+    });
   }
 
   // success in establishing http client
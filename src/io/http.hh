@@ -59,7 +59,9 @@ namespace io {
     }
 
     /**
-     * Perform http request using req object provided
+     * Perform http request using req object provided. If the connection
+     * closes before the response, the callback gets an empty response
+     * with status 0.
      * @param {HttpRequest} req the request obejct
      * @param {HttpCallback} the response callback
      * @return {bool} if the request was successful
@@ -0,0 +1,95 @@
+#include "intern.hh"
+
+/**
+ * Hash a string using FNV-1a
+ * @param {const char*} data the string data
+ * @param {size_t} len the length of the string
+ * @return {size_t} the string hash
+ */
+static inline std::size_t Hash(const char *data, std::size_t len) {
+  uint64_t hash = 0xcbf29ce484222325ULL;
+  for (std::size_t i = 0; i < len; i++) {
+    hash ^= (unsigned char)data[i];
+    hash *= 0x100000001b3ULL;
+  }
+  return (std::size_t)hash;
+}
+
+/**
+ * Free all entries when the pool is destroyed
+ */
+io::StringPool::~StringPool() {
+  for (auto &it : entries)
+    delete it.second;
+}
+
+/**
+ * Get the shared handle for a string, adding it if missing
+ * @param {const char*} data the string data
+ * @param {size_t} len the length of the string
+ * @return {Symbol} the interned string handle
+ */
+io::Symbol io::StringPool::get(const char *data, std::size_t len) {
+  Key key = {data, len, Hash(data, len)};
+  std::lock_guard<std::mutex> lock(mutex);
+
+  // reuse the entry if already interned
+  auto it = entries.find(key);
+  if (it != entries.end()) {
+    if (it->second->refs++ == 0) dead--;
+    return Symbol(it->second);
+  }
+
+  // free released entries before growing further
+  if (dead > 64 && (std::size_t)dead * 2 > entries.size())
+    sweep();
+
+  // create a new entry keyed by its own storage
+  Symbol::Entry *entry = new Symbol::Entry();
+  entry->refs = 1;
+  entry->pool = this;
+  entry->str.assign(data, len);
+  key.data = entry->str.data();
+  entries.insert(std::make_pair(key, entry));
+  return Symbol(entry);
+}
+
+/**
+ * Free every entry with no remaining handles
+ */
+void io::StringPool::collect() {
+  std::lock_guard<std::mutex> lock(mutex);
+  sweep();
+}
+
+/**
+ * Erase released entries (pool lock must be held)
+ */
+void io::StringPool::sweep() {
+  for (auto i = entries.begin(); i != entries.end();) {
+    if (i->second->refs == 0) {
+      delete i->second;
+      i = entries.erase(i);
+    } else i++;
+  }
+  dead = 0;
+}
+
+/**
+ * Amount of strings currently held
+ * @return {size_t} the amount of pooled entries
+ */
+std::size_t io::StringPool::size() {
+  std::lock_guard<std::mutex> lock(mutex);
+  return entries.size();
+}
+
+/**
+ * The process wide pool used by the cda object parsers.
+ * Intentionally leaked so symbols in static objects stay valid.
+ * @return {StringPool&} the global pool
+ */
+io::StringPool& io::StringPool::global() {
+  static io::StringPool *pool = new io::StringPool();
+  return *pool;
+}
@@ -0,0 +1,142 @@
+#pragma once
+
+#include "date.hh"
+#include <mutex>
+#include <atomic>
+#include <unordered_map>
+
+namespace io {
+
+  class StringPool;
+  class Symbol {
+  /** Reference counted handle to a string interned in a StringPool */
+  public:
+    struct Entry {
+      std::atomic<long> refs; // live handles to the string
+      StringPool *pool;       // the pool owning the entry
+      std::string str;        // the interned value
+    };
+
+    inline Symbol() = default;
+    inline ~Symbol() { release(); }
+    inline Symbol(const Symbol &other) : entry(other.entry) {
+      if (entry != nullptr) entry->refs++;
+    }
+    inline Symbol(Symbol &&other) noexcept : entry(other.entry) {
+      other.entry = nullptr;
+    }
+    inline Symbol& operator=(const Symbol &other) {
+      if (other.entry != nullptr) other.entry->refs++;
+      release();
+      entry = other.entry;
+      return *this;
+    }
+    inline Symbol& operator=(Symbol &&other) noexcept {
+      if (this != &other) {
+        release();
+        entry = other.entry;
+        other.entry = nullptr;
+      }
+      return *this;
+    }
+
+    /** String accessors */
+    inline const std::string& str() const {
+      static const std::string empty;
+      return entry != nullptr ? entry->str : empty;
+    }
+    inline operator const std::string&() const { return str(); }
+    inline const char *c_str() const { return str().c_str(); }
+    inline std::size_t size() const { return str().size(); }
+    inline bool empty() const { return str().empty(); }
+
+    /** Symbols from the same pool compare by identity */
+    inline bool operator==(const Symbol &other) const {
+      if (entry == other.entry) return true;
+      if (entry != nullptr && other.entry != nullptr &&
+          entry->pool == other.entry->pool) return false;
+      return str() == other.str();
+    }
+    inline bool operator!=(const Symbol &other) const {
+      return !(*this == other);
+    }
+    inline bool operator==(const std::string &other) const {
+      return str() == other;
+    }
+    inline bool operator!=(const std::string &other) const {
+      return str() != other;
+    }
+    inline friend std::ostream& operator<<(std::ostream &s, const Symbol &sym) {
+      s << sym.str(); return s;
+    }
+
+  private:
+    friend class StringPool;
+    Entry *entry = nullptr;
+    inline explicit Symbol(Entry *e) : entry(e) {}
+    void release();
+  };
+
+  class StringPool {
+  /**
+   * Hash-consed string pool. Entries whose last Symbol was released
+   * are freed in batches once they make up half of the pool.
+   */
+  public:
+    inline StringPool() = default;
+    ~StringPool();
+
+    /**
+     * Get the shared handle for a string, adding it if missing
+     * @param {const char*} data the string data
+     * @param {size_t} len the length of the string
+     * @return {Symbol} the interned string handle
+     */
+    Symbol get(const char *data, std::size_t len);
+    inline Symbol get(const std::string &str) {
+      return get(str.data(), str.size());
+    }
+
+    /** Free every entry with no remaining handles */
+    void collect();
+
+    /** Amount of strings currently held */
+    std::size_t size();
+
+    /** The process wide pool used by the cda object parsers */
+    static StringPool& global();
+
+  private:
+    friend class Symbol;
+    struct Key {
+      const char *data;
+      std::size_t len;
+      std::size_t hash;
+      inline bool operator==(const Key &other) const {
+        return len == other.len &&
+          std::memcmp(data, other.data, len) == 0;
+      }
+    };
+    struct KeyHash {
+      inline std::size_t operator()(const Key &key) const {
+        return key.hash;
+      }
+    };
+
+    StringPool(const StringPool&) = delete;
+    const StringPool& operator= (const StringPool&) = delete;
+
+    void sweep();
+
+    std::mutex mutex;
+    std::atomic<long> dead{0};
+    std::unordered_map<Key, Symbol::Entry*, KeyHash> entries;
+  };
+
+  inline void Symbol::release() {
+    if (entry == nullptr) return;
+    StringPool *pool = entry->pool;
+    if (--entry->refs == 0) pool->dead++;
+    entry = nullptr;
+  }
+}
@@ -1,6 +1,6 @@
 #pragma once
 
-#include "http.hh"
+#include "scan.hh"
 
 namespace io {
   using json = nlohmann::json;
@@ -0,0 +1,67 @@
+#include "ipc.hh"
+
+// largest message accepted from the other end
+#define IPC_MAX_MESSAGE (64 * 1024 * 1024)
+
+/**
+ * Wrap a connected (or connecting) local socket
+ * @param {Socket} sock the socket, owned by the channel from now on
+ */
+io::IpcChannel::IpcChannel(io::Socket *sock) : sock(sock) {
+  onMessage([](std::string &message){});
+  onClose([](){});
+  io::IpcChannel *self = this;
+
+  // split the stream back into messages
+  sock->onRead([self](io::Data &data) {
+    self->buffer.insert(self->buffer.end(), data.begin(), data.end());
+    std::size_t offset = 0;
+    while (self->sock != nullptr && self->buffer.size() - offset >= 4) {
+      uint32_t length;
+      std::memcpy(&length, &self->buffer[offset], 4);
+      if (length > IPC_MAX_MESSAGE) {
+        self->Close();
+        return;
+      }
+      if (self->buffer.size() - offset - 4 < length) break;
+      std::string message(&self->buffer[offset + 4], length);
+      offset += 4 + length;
+      self->message_cb(message);
+    }
+    if (self->sock != nullptr)
+      self->buffer.erase(self->buffer.begin(), self->buffer.begin() + offset);
+  });
+
+  // the loop deletes sockets that hang up
+  sock->onClose([self](int err) {
+    if (self->sock == nullptr) return;
+    self->sock = nullptr;
+    self->buffer.clear();
+    self->close_cb();
+  });
+}
+
+/**
+ * Send a message to the other end
+ * @param {string} message the message payload
+ */
+void io::IpcChannel::Send(const std::string &message) {
+  if (sock == nullptr) return;
+  const uint32_t length = (uint32_t)message.size();
+  io::Data output(4 + message.size());
+  std::memcpy(&output[0], &length, 4);
+  std::memcpy(&output[4], message.data(), message.size());
+  sock->Write(std::move(output));
+}
+
+/**
+ * Close the channel
+ */
+void io::IpcChannel::Close() {
+  if (sock == nullptr) return;
+  io::Socket *closing = sock;
+  sock = nullptr;
+  buffer.clear();
+  delete closing;
+  close_cb();
+}
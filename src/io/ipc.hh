@@ -0,0 +1,59 @@
+#pragma once
+
+#include "task.hh"
+
+namespace io {
+
+  class IpcChannel {
+  /**
+   * Message channel over a local (unix domain) socket.
+   * Every message is sent as a 4 byte length followed by the payload,
+   * so messages arrive whole no matter how the stream was split.
+   */
+  private:
+    Socket *sock;  // the connected socket
+    Data buffer;   // bytes of messages not fully received yet
+    std::function<void(std::string&)> message_cb;
+    std::function<void()> close_cb;
+
+  public:
+    /**
+     * Wrap a connected (or connecting) local socket
+     * @param {Socket} sock the socket, owned by the channel from now on
+     */
+    IpcChannel(Socket *sock);
+
+    // close the socket when the channel is killed
+    inline ~IpcChannel() { Close(); }
+
+    /** If the socket is still open */
+    inline bool isOpen() const {
+      return sock != nullptr;
+    }
+
+    /**
+     * Send a message to the other end
+     * @param {string} message the message payload
+     */
+    void Send(const std::string &message);
+
+    /**
+     * Close the channel
+     */
+    void Close();
+
+    // bind message callback
+    inline void onMessage(std::function<void(std::string&)> cb) {
+      message_cb = cb;
+    }
+
+    // bind close callback
+    inline void onClose(std::function<void()> cb) {
+      close_cb = cb;
+    }
+
+  private:
+    IpcChannel(const IpcChannel&) = delete;
+    const IpcChannel& operator= (const IpcChannel&) = delete;
+  };
+}
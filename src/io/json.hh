@@ -1998,7 +1998,8 @@ class basic_json
             alloc.deallocate(object, 1);
         };
         std::unique_ptr<T, decltype(deleter)> object(alloc.allocate(1), deleter);
-        alloc.construct(object.get(), std::forward<Args>(args)...);
+        std::allocator_traits<AllocatorType<T>>::construct(
+            alloc, object.get(), std::forward<Args>(args)...);
         assert(object != nullptr);
         return object.release();
     }
@@ -2918,7 +2919,8 @@ class basic_json
             case value_t::object:
             {
                 AllocatorType<object_t> alloc;
-                alloc.destroy(m_value.object);
+                std::allocator_traits<AllocatorType<object_t>>::destroy(
+                    alloc, m_value.object);
                 alloc.deallocate(m_value.object, 1);
                 break;
             }
@@ -2926,7 +2928,8 @@ class basic_json
             case value_t::array:
             {
                 AllocatorType<array_t> alloc;
-                alloc.destroy(m_value.array);
+                std::allocator_traits<AllocatorType<array_t>>::destroy(
+                    alloc, m_value.array);
                 alloc.deallocate(m_value.array, 1);
                 break;
             }
@@ -2934,7 +2937,8 @@ class basic_json
             case value_t::string:
             {
                 AllocatorType<string_t> alloc;
-                alloc.destroy(m_value.string);
+                std::allocator_traits<AllocatorType<string_t>>::destroy(
+                    alloc, m_value.string);
                 alloc.deallocate(m_value.string, 1);
                 break;
             }
@@ -4685,7 +4689,8 @@ class basic_json
                 if (is_string())
                 {
                     AllocatorType<string_t> alloc;
-                    alloc.destroy(m_value.string);
+                    std::allocator_traits<AllocatorType<string_t>>::destroy(
+                    alloc, m_value.string);
                     alloc.deallocate(m_value.string, 1);
                     m_value.string = nullptr;
                 }
@@ -4792,7 +4797,8 @@ class basic_json
                 if (is_string())
                 {
                     AllocatorType<string_t> alloc;
-                    alloc.destroy(m_value.string);
+                    std::allocator_traits<AllocatorType<string_t>>::destroy(
+                    alloc, m_value.string);
                     alloc.deallocate(m_value.string, 1);
                     m_value.string = nullptr;
                 }
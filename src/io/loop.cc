@@ -1,6 +1,8 @@
 #include "loop.hh"
 #include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <sys/socket.h>
+#include <sys/un.h>
 #include <netinet/tcp.h>
 #include <arpa/inet.h>
 #include <fcntl.h>
@@ -13,6 +15,45 @@
 // max amount of socket events
 #define MAXEVENTS 128
 
+/**
+ * Write to a socket BIO without raising SIGPIPE when the peer is gone
+ * @param {BIO*} bio the socket BIO
+ * @param {char*} data the bytes to write
+ * @param {int} len the amount of bytes
+ * @return {int} bytes written or -1
+ */
+static int NoSignalWrite(BIO *bio, const char *data, int len) {
+  int fd = -1;
+  BIO_get_fd(bio, &fd);
+  errno = 0;
+  const int ret = (int)send(fd, data, (std::size_t)len, MSG_NOSIGNAL);
+  BIO_clear_retry_flags(bio);
+  if (ret <= 0 && BIO_sock_should_retry(ret))
+    BIO_set_retry_write(bio);
+  return ret;
+}
+
+/**
+ * Get the socket BIO method ssl connections write through, a socket BIO
+ * whose writes never raise SIGPIPE
+ * @return {BIO_METHOD*} the shared method
+ */
+static BIO_METHOD *NoSignalSocket() {
+  static BIO_METHOD *method = []() {
+    const BIO_METHOD *base = BIO_s_socket();
+    BIO_METHOD *m = BIO_meth_new(BIO_TYPE_SOCKET, "socket (no SIGPIPE)");
+    if (m == nullptr) return m;
+    BIO_meth_set_write(m, NoSignalWrite);
+    BIO_meth_set_read(m, BIO_meth_get_read(base));
+    BIO_meth_set_puts(m, BIO_meth_get_puts(base));
+    BIO_meth_set_ctrl(m, BIO_meth_get_ctrl(base));
+    BIO_meth_set_create(m, BIO_meth_get_create(base));
+    BIO_meth_set_destroy(m, BIO_meth_get_destroy(base));
+    return m;
+  }();
+  return method;
+}
+
 /**
  * Set socket to non-blocking mode
  * @param {int} fd the socket file descriptor to set
@@ -25,6 +66,25 @@ static inline int nonblock(int fd) {
   return (flags != 0) ? -1 : 0;
 }
 
+/**
+ * Detect dead peers within idle + interval * count seconds
+ * @param {int} fd the socket file descriptor to set
+ * @param {int} idle seconds without traffic before probing
+ * @param {int} interval seconds between probes
+ * @param {int} count unanswered probes before dropping the connection
+ */
+static inline int keepalive(int fd, int idle, int interval, int count) {
+  int on = 1;
+  unsigned timeout = (unsigned)(idle + interval * count) * 1000;
+  if (setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE, &on, sizeof(on)) ||
+    setsockopt(fd, SOL_TCP, TCP_KEEPIDLE, &idle, sizeof(idle)) ||
+    setsockopt(fd, SOL_TCP, TCP_KEEPINTVL, &interval, sizeof(interval)) ||
+    setsockopt(fd, SOL_TCP, TCP_KEEPCNT, &count, sizeof(count)) ||
+    setsockopt(fd, SOL_TCP, TCP_USER_TIMEOUT, &timeout, sizeof(timeout)))
+    return -1;
+  return 0;
+}
+
 /**
  * Initalize an event loop
  */
@@ -33,6 +93,11 @@ io::Loop::Loop() {
   epoll = epoll_create1(0);
   if (epoll == -1)
     throw std::runtime_error("Epoll init failed");
+
+  // wake up epoll_wait when callbacks are posted from other threads
+  wakeup = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (wakeup == -1 || mod(wakeup, EPOLL_CTL_ADD, EPOLLIN) != 0)
+    throw std::runtime_error("Eventfd init failed");
   
   // load ssl libraries
   SSL_load_error_strings();
@@ -64,17 +129,61 @@ int io::Loop::mod(int fd, int op, int flags, void *data)
 }
 
 /**
- * Send data into write queue to be written
- * @param {Data&} data the buffer to enqueue
+ * Hand a buffer to the write queue without copying it
+ * @param {Data&&} data the buffer to enqueue
+ * @param {size_t} offset where the bytes to send start in the buffer
  */
-void io::Socket::Write(io::Data &data) {
-  writeQueue.push_front(data);
+void io::Socket::Write(io::Data &&data, std::size_t offset) {
+  if (offset >= data.size()) return;
+
+  // write through while nothing is queued, the rest waits for EPOLLOUT
+  if (connected && !closed && writeQueue.empty()) {
+    while (offset < data.size()) {
+      const std::size_t left = data.size() - offset;
+      const ssize_t nwrite = ssl != nullptr ?
+        (ssize_t)SSL_write(ssl, &data[offset], (int)left) :
+        ::send(fd, &data[offset], left, MSG_NOSIGNAL);
+      if (nwrite < 1) break;
+      offset += (std::size_t)nwrite;
+    }
+    if (offset >= data.size()) return;
+  }
+  writeQueue.push_front({std::move(data), offset});
   int ret = this->loop->mod(fd, EPOLL_CTL_MOD,
-    EPOLLIN | EPOLLOUT | EPOLLET,
+    (paused ? 0 : EPOLLIN) | EPOLLOUT | EPOLLET,
     this);
   if (ret != 0) Close(ret);
 }
 
+/**
+ * Stop reading and let the loop delete the socket once written
+ */
+void io::Socket::End() {
+  ending = true;
+  this->loop->mod(fd, EPOLL_CTL_MOD, EPOLLOUT | EPOLLET, this);
+}
+
+/**
+ * Stop watching for readable data (backpressure)
+ */
+void io::Socket::pause() {
+  if (paused) return;
+  paused = true;
+  loop->mod(fd, EPOLL_CTL_MOD,
+    (hasBuffer() ? EPOLLOUT : 0) | EPOLLET, this);
+}
+
+/**
+ * Start watching for readable data again. Re-arming an edge
+ * triggered fd reports data that arrived while paused.
+ */
+void io::Socket::resume() {
+  if (!paused) return;
+  paused = false;
+  loop->mod(fd, EPOLL_CTL_MOD,
+    EPOLLIN | (hasBuffer() ? EPOLLOUT : 0) | EPOLLET, this);
+}
+
 /**
  * set socket into connected state
  */
@@ -115,6 +224,14 @@ io::Socket* io::Loop::spawn(Uri uri) {
     return sock;
   }
 
+  // probe idle connections so dead peers are noticed in seconds
+  if (keepIdle > 0 &&
+    keepalive(fd, keepIdle, keepInterval, keepCount) != 0)
+  {
+    close(fd);
+    return sock;
+  }
+
   // connect to hostname using uri
   struct sockaddr_in addr;
   memset(&addr, 0, sizeof(addr));
@@ -140,11 +257,16 @@ io::Socket* io::Loop::spawn(Uri uri) {
       return nullptr;
     }
 
-    // set ssl object file descriptor
-    if (!SSL_set_fd(sock->ssl, sock->fd)) {
+    // write through a socket bio that fails with EPIPE instead of
+    // raising SIGPIPE when the peer went away
+    BIO *bio = NoSignalSocket() != nullptr ?
+      BIO_new(NoSignalSocket()) : nullptr;
+    if (bio == nullptr) {
       delete sock;
       return nullptr;
     }
+    BIO_set_fd(bio, sock->fd, BIO_NOCLOSE);
+    SSL_set_bio(sock->ssl, bio, bio);
 
     // set the connection state
     SSL_set_connect_state(sock->ssl);
@@ -161,6 +283,147 @@ io::Socket* io::Loop::spawn(Uri uri) {
   return sock;
 }
 
+/**
+ * Fill a unix domain socket address
+ * @param {string} path the socket file path
+ * @param {sockaddr_un} addr the address to fill
+ * @return {bool} if the path fits the address
+ */
+static inline bool localAddress(const std::string &path, sockaddr_un &addr) {
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (path.empty() || path.size() >= sizeof(addr.sun_path)) return false;
+  std::memcpy(addr.sun_path, path.c_str(), path.size());
+  return true;
+}
+
+/**
+ * Connect to a unix domain socket
+ * @param {string} path the socket file path
+ * @return {Socket} the socket object if success else nullptr
+ */
+io::Socket* io::Loop::spawnLocal(const std::string &path) {
+  struct sockaddr_un addr;
+  if (!localAddress(path, addr)) return nullptr;
+
+  // create non blocking socket
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0) return nullptr;
+  if (nonblock(fd) != 0) {
+    close(fd);
+    return nullptr;
+  }
+
+  // local connects finish right away or fail
+  if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0
+    && errno != EINPROGRESS) {
+    close(fd);
+    return nullptr;
+  }
+
+  // connection is reported through the write event
+  io::Socket *sock = new io::Socket(fd, this);
+  if (mod(fd, EPOLL_CTL_ADD, EPOLLIN | EPOLLOUT | EPOLLET, sock) != 0) {
+    delete sock;
+    return nullptr;
+  }
+  return sock;
+}
+
+/**
+ * Bind a socket and register it to accept connections
+ * @param {Loop} loop the loop to register with
+ * @param {int} fd the non blocking socket, closed on failure
+ * @param {sockaddr} addr the address to bind
+ * @param {socklen_t} len the address size
+ * @return {Socket} the listening socket if success else nullptr
+ */
+static io::Socket *startListening(io::Loop *loop, int fd,
+  const struct sockaddr *addr, socklen_t len)
+{
+  if (bind(fd, addr, len) < 0 || ::listen(fd, SOMAXCONN) < 0) {
+    close(fd);
+    return nullptr;
+  }
+
+  // wait for incoming connections
+  io::Socket *sock = new io::Socket(fd, loop);
+  sock->listening = true;
+  sock->connected = true;
+  sock->onAccept([](io::Socket *client){ delete client; });
+  if (loop->mod(fd, EPOLL_CTL_ADD, EPOLLIN | EPOLLET, sock) != 0) {
+    delete sock;
+    return nullptr;
+  }
+  return sock;
+}
+
+/**
+ * Listen on a unix domain socket
+ * @param {string} path the socket file path
+ * @return {Socket} the listening socket if success else nullptr
+ */
+io::Socket* io::Loop::listenLocal(const std::string &path) {
+  struct sockaddr_un addr;
+  if (!localAddress(path, addr)) return nullptr;
+
+  // create non blocking socket, removing a previous socket file
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0) return nullptr;
+  unlink(path.c_str());
+  if (nonblock(fd) != 0) {
+    close(fd);
+    return nullptr;
+  }
+  return startListening(this, fd, (struct sockaddr*)&addr, sizeof(addr));
+}
+
+/**
+ * Listen for tcp connections
+ * @param {string} host the ipv4 address to bind
+ * @param {int} port the port to bind
+ * @return {Socket} the listening socket if success else nullptr
+ */
+io::Socket* io::Loop::listen(const std::string &host, int port) {
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  if (inet_pton(AF_INET, host.c_str(), &addr.sin_addr) != 1) return nullptr;
+
+  // create non blocking socket, reusing a recently closed port
+  int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0) return nullptr;
+  int on = 1;
+  if (nonblock(fd) != 0
+    || setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) < 0) {
+    close(fd);
+    return nullptr;
+  }
+  return startListening(this, fd, (struct sockaddr*)&addr, sizeof(addr));
+}
+
+/**
+ * Accept every pending connection of a listening socket
+ * @param {Socket} server the listening socket
+ */
+static inline void acceptAll(io::Socket *server) {
+  while (true) {
+    int fd = accept4(server->fd, nullptr, nullptr,
+      SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd < 0) return;
+
+    // accepted sockets are already connected
+    io::Socket *client = new io::Socket(fd, server->loop);
+    client->connected = true;
+    if (server->loop->mod(fd, EPOLL_CTL_ADD, EPOLLIN | EPOLLET, client)) {
+      delete client;
+      continue;
+    }
+    server->performAccept(client);
+  }
+}
+
 /**
  * Check if socket is connected using file descriptor
  * @param {int} fd the socket file descriptor
@@ -200,6 +463,55 @@ static inline int sslHandshake(io::Socket *sock) {
   return 1;
 }
 
+/**
+ * Record loop iteration time, ready events and timer lag
+ * @param {Metrics} metrics the registry to record into
+ */
+void io::Loop::instrument(io::Metrics &metrics) {
+  iterationTime = &metrics.histogram("io_loop_iteration_seconds",
+    "Time an event loop iteration spent working", "", 1e-6);
+  readyEvents = &metrics.histogram("io_loop_ready_events",
+    "Socket events returned by a wakeup of the event loop");
+  timerLag = &metrics.histogram("io_loop_timer_lag_seconds",
+    "Delay between a timer being due and running", "", 1e-6);
+}
+
+/**
+ * Run the high priority timers that are due
+ */
+void io::Loop::poll() {
+  if (urgents.empty()) return;
+  const io::TimeStamp now = io::Clock::now();
+  while (!urgents.empty() && urgents.top().deadline <= now) {
+    io::Callback callback = urgents.top().callback;
+    if (timerLag != nullptr)
+      timerLag->record((uint64_t)std::chrono::duration_cast<
+        std::chrono::microseconds>(now - urgents.top().deadline).count());
+    urgents.pop();
+    callback();
+  }
+}
+
+/**
+ * Run a callback on the loop thread (safe from any thread)
+ * @param {Callback} callback the action to run
+ */
+void io::Loop::post(io::Callback callback) {
+  bool idle;
+  {
+    std::lock_guard<std::mutex> lock(inboxMutex);
+    idle = inbox.empty();
+    inbox.push_back(std::move(callback));
+  }
+
+  // the first callback wakes the loop, the rest ride along
+  if (idle) {
+    const uint64_t one = 1;
+    ssize_t ret = ::write(wakeup, &one, sizeof(one));
+    (void)ret;
+  }
+}
+
 /**
  * Start the io event loop
  * @return {int} for ease of use
@@ -221,39 +533,40 @@ int io::Loop::run() {
   io::Duration passed;      // time passed in chrono
 
   // create events holder
-  events = (epoll_event*)calloc(MAXEVENTS, sizeof(events));
+  events = (epoll_event*)calloc(MAXEVENTS, sizeof(*events));
   if (events == nullptr) return -1;
 
   // start event loop
   running = true;
   while (running) {
 
-    // wait for socket events
-    polled = epoll_wait(epoll, events, MAXEVENTS, 10);
-
-    // Iterate only through current timer tasks
-    size = tasks.size();
-    for (i = 0; i < size && !tasks.empty(); i++) {
-      promise = std::move(tasks.front());
-      tasks.pop();
-
-      // Do not perform cancelled timer tasks
-      if (promise.cancelled) continue;
-
-      // If time passed since timeout, perform task. Else, add back to tasks
-      passed = io::Clock::now() - promise.created;
-      since = passed.count() * 1000L;
-      if (since >= promise.delay)
-        promise.callback();
-      else
-        tasks.push(promise);
+    // wait for socket events, waking up for the next urgent timer
+    int timeout = 10;
+    if (!urgents.empty()) {
+      const long until = std::chrono::duration_cast<std::chrono::milliseconds>(
+        urgents.top().deadline - io::Clock::now()).count();
+      timeout = (int)std::max(0L, std::min(until, 10L));
     }
+    polled = epoll_wait(epoll, events, MAXEVENTS, timeout);
+    const io::TimeStamp woke = io::Clock::now();
+    if (readyEvents != nullptr && polled > 0)
+      readyEvents->record((uint64_t)polled);
+    poll();
 
     // iterate through found socket events
     for (i = 0; i < polled; i++) {
+      poll();
       event = events[i];
       sock = (io::Socket*)event.data.ptr;
 
+      // posted callbacks run after the batch, just reset the wakeup
+      if (sock == nullptr) {
+        uint64_t count;
+        ssize_t ret = ::read(wakeup, &count, sizeof(count));
+        (void)ret;
+        continue;
+      }
+
       // kill socket if epoll error
       if (event.events & EPOLLERR || event.events & EPOLLHUP) {
         delete sock;
@@ -269,6 +582,7 @@ int io::Loop::run() {
           // check if socket is connected
           if (!isConnected(sock->fd)) {
             sock->Close(1);
+            delete sock;
             continue;
           }
 
@@ -287,45 +601,70 @@ int io::Loop::run() {
 
         // since write event, check if theres anythign to be written
         if (sock->hasBuffer()) {
-          io::Data buffer;
+          io::Outgoing buffer;
+          bool blocked = false;
 
           // iterate through all items in write queue
-          while (sock->hasBuffer()) {
+          while (sock != nullptr && !blocked && sock->hasBuffer()) {
             buffer = sock->getBuffer(); // get next buffer to be written
    
             // start writing the buffer information
-            while (true) {
+            while (buffer.offset < buffer.data.size()) {
+              const char *start = &buffer.data[buffer.offset];
+              const std::size_t left = buffer.data.size() - buffer.offset;
               if (sock->ssl != nullptr)
-                nwrite = (ssize_t)SSL_write(sock->ssl, &buffer[0], buffer.size());
+                nwrite = (ssize_t)SSL_write(sock->ssl, start, (int)left);
               else
-                nwrite = write(sock->fd, &buffer[0], buffer.size());
+                nwrite = send(sock->fd, start, left, MSG_NOSIGNAL);
   
               // EOF Reached or Write error
               if (nwrite == -1) {
                 if (errno != EAGAIN) {
                   sock->Close(-1);
                   delete sock;
+                  sock = nullptr;
+
+                // keep the rest for the next write event
+                } else {
+                  sock->putBack(std::move(buffer));
+                  blocked = true;
                 }
                 break;
               
-              // there is no more data to write
+              // nothing could be written, retry on the next write event
               } else if (nwrite < 1) {
-                if (buffer.size() < 1) break;
+                sock->putBack(std::move(buffer));
+                blocked = true;
+                break;
 
-              // write any data that wasnt written
+              // skip past the written bytes without moving the rest
               } else {
-                buffer.erase(buffer.begin(), buffer.begin() + nwrite);
+                buffer.offset += (std::size_t)nwrite;
               }
             }
           }
 
         // no data left to write, remove write event
-        } else mod(sock->fd, EPOLL_CTL_MOD, EPOLLIN | EPOLLET, sock);
+        } else mod(sock->fd, EPOLL_CTL_MOD,
+          (sock->paused ? 0 : EPOLLIN) | EPOLLET, sock);
+        if (sock == nullptr) continue;
+
+        // ended sockets are done once everything is written
+        if (sock->ending && !sock->hasBuffer()) {
+          delete sock;
+          continue;
+        }
       }
 
       // socket is ready to read
       if (event.events & EPOLLIN) {
 
+        // listening sockets accept instead of reading
+        if (sock->listening) {
+          acceptAll(sock);
+          continue;
+        }
+
         // if ssl and not fully connected, complete handshake
         if (sock->ssl != nullptr && !sock->connected) {
           if (sslHandshake(sock) == 0)
@@ -348,11 +687,16 @@ int io::Loop::run() {
             if (errno != EAGAIN) {
               sock->Close(-1);
               delete sock;
+              sock = nullptr;
             }
             break;
 
-          // there is no more data to read, stop reading
-          } else if (nread == 0) break;
+          // the peer closed, the write path deletes the socket once its
+          // queued writes are out (or the read callback deletes it first)
+          } else if (nread == 0) {
+            sock->End();
+            break;
+          }
 
           // there is still data left to read, clear and keep reading
           else reader.insert(reader.end(), rbuf, rbuf + nread);
@@ -360,10 +704,48 @@ int io::Loop::run() {
         }
 
         // emit read event if there was data collected
-        if (reader.size() > 0)
+        if (sock != nullptr && reader.size() > 0)
           sock->performRead(reader);
       }
     }
+
+    // run callbacks posted from other threads (and deferred closes) once
+    // the batch is done, so deleted sockets leave no stale events behind
+    {
+      std::vector<io::Callback> posted;
+      {
+        std::lock_guard<std::mutex> lock(inboxMutex);
+        posted.swap(inbox);
+      }
+      for (io::Callback &callback : posted)
+        callback();
+    }
+
+    // Iterate only through current timer tasks
+    size = tasks.size();
+    for (i = 0; i < size && !tasks.empty(); i++) {
+      promise = std::move(tasks.front());
+      tasks.pop();
+
+      // Do not perform cancelled timer tasks
+      if (promise.cancelled) continue;
+
+      // If time passed since timeout, perform task. Else, add back to tasks
+      passed = io::Clock::now() - promise.created;
+      since = passed.count() * 1000L;
+      if (since >= promise.delay) {
+        if (timerLag != nullptr)
+          timerLag->record((uint64_t)std::max(0.0,
+            passed.count() * 1e6 - promise.delay * 1000.0));
+        promise.callback();
+      } else
+        tasks.push(promise);
+    }
+
+    // time spent working, without the wait for events
+    if (iterationTime != nullptr)
+      iterationTime->record((uint64_t)std::chrono::duration_cast<
+        std::chrono::microseconds>(io::Clock::now() - woke).count());
   }
 
   // when io loop exits, free data
@@ -1,7 +1,7 @@
 #pragma once
 
 #include <chrono>
-#include "socket.hh"
+#include "metrics.hh"
 
 namespace io {
 
@@ -19,15 +19,41 @@ namespace io {
     TimeStamp created;
   } Promise;
 
+  // High priority timer task
+  typedef struct Urgent {
+    TimeStamp deadline;
+    Callback callback;
+    inline bool operator<(const Urgent &other) const {
+      return deadline > other.deadline; // earliest deadline first
+    }
+  } Urgent;
+
   class Loop {
   private:
     int epoll;                 // the internal epoll file descriptor
+    int wakeup;                // eventfd that interrupts epoll_wait
     bool running = false;      // the event loop state
     std::queue<Promise> tasks; // timed callbacks
+    std::priority_queue<Urgent> urgents; // high priority timers
+    std::mutex inboxMutex;     // guards the inbox
+    std::vector<Callback> inbox; // callbacks posted from other threads
+
+    // instrumentation (see instrument())
+    Histogram *iterationTime = nullptr; // us an iteration spent working
+    Histogram *readyEvents = nullptr;   // socket events per wakeup
+    Histogram *timerLag = nullptr;      // us timers ran after being due
 
   public:
     SSL_CTX *ctx; // the ssl shared client context
 
+    // TCP keepalive of spawned connections: idle seconds before probing,
+    // seconds between probes and unanswered probes before the connection
+    // is dropped. Unacknowledged writes time out after the same total.
+    // (keepIdle 0 leaves the system defaults)
+    int keepIdle = 10;
+    int keepInterval = 5;
+    int keepCount = 3;
+
     /**
      * Initalize an event loop
      */
@@ -55,6 +81,30 @@ namespace io {
      */
     io::Socket *spawn(Uri uri);
 
+    /**
+     * Connect to a unix domain socket
+     * @param {string} path the socket file path
+     * @return {Socket} the socket object if success else nullptr
+     */
+    io::Socket *spawnLocal(const std::string &path);
+
+    /**
+     * Listen on a unix domain socket, replacing a stale socket file.
+     * Accepted sockets are handed to the listeners onAccept callback.
+     * @param {string} path the socket file path
+     * @return {Socket} the listening socket if success else nullptr
+     */
+    io::Socket *listenLocal(const std::string &path);
+
+    /**
+     * Listen for tcp connections, accepted sockets are handed to the
+     * listeners onAccept callback
+     * @param {string} host the ipv4 address to bind, ex: 127.0.0.1
+     * @param {int} port the port to bind
+     * @return {Socket} the listening socket if success else nullptr
+     */
+    io::Socket *listen(const std::string &host, int port);
+
     /**
      * Create a promise to be resolved sometime later
      * @param {long} delay, the time to wait before fulfilling
@@ -69,6 +119,39 @@ namespace io {
       return task;
     }
 
+    /**
+     * Schedule a high priority timer. These are checked between every
+     * socket event and whenever poll() is called, so slow handlers do
+     * not delay them by a whole loop iteration.
+     * @param {long} delay the time in ms to wait before running
+     * @param {Callback} the action to run
+     */
+    inline void urgent(long delay, Callback callback) {
+      if (!callback)
+        throw std::invalid_argument("No callback provided");
+      urgents.push({Clock::now() + std::chrono::milliseconds(delay),
+        std::move(callback)});
+    }
+
+    /**
+     * Run the high priority timers that are due.
+     * Long running work on the loop should call this periodically.
+     */
+    void poll();
+
+    /**
+     * Run a callback on the loop thread (safe from any thread). It runs
+     * after the current batch of socket events, so it may delete sockets.
+     * @param {Callback} callback the action to run
+     */
+    void post(Callback callback);
+
+    /**
+     * Record loop iteration time, ready events and timer lag
+     * @param {Metrics} metrics the registry to record into
+     */
+    void instrument(Metrics &metrics);
+
     /** Close the event event */
     inline void quit() { running = false; }
   };
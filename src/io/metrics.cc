@@ -0,0 +1,262 @@
+#include "metrics.hh"
+#include "loop.hh"
+#include <sstream>
+#include <algorithm>
+
+// quantiles exported for every histogram
+static const double Quantiles[] = {0.5, 0.9, 0.99, 0.999};
+
+/**
+ * Find the bucket of a value
+ * @param {uint64_t} value the value
+ * @return {unsigned} the bucket index
+ */
+static inline unsigned BucketOf(uint64_t value) {
+  const unsigned sub = io::Histogram::SUB_BITS;
+  value = std::min<uint64_t>(value, (1ULL << io::Histogram::MAX_BITS) - 1);
+  if (value < (1ULL << sub)) return (unsigned)value;
+  const unsigned exp = 63 - __builtin_clzll(value);
+  const unsigned linear = (unsigned)(value >> (exp - sub)) & ((1 << sub) - 1);
+  return ((exp - sub + 1) << sub) + linear;
+}
+
+/**
+ * Get the highest value that falls into a bucket
+ * @param {unsigned} index the bucket index
+ * @return {uint64_t} the bucket upper bound
+ */
+static inline uint64_t BucketTop(unsigned index) {
+  const unsigned sub = io::Histogram::SUB_BITS;
+  if (index < (1U << sub)) return index;
+  const unsigned exp = (index >> sub) + sub - 1;
+  const uint64_t linear = index & ((1 << sub) - 1);
+  return (((1ULL << sub) + linear + 1) << (exp - sub)) - 1;
+}
+
+/**
+ * Record a value
+ * @param {uint64_t} value the value
+ */
+void io::Histogram::record(uint64_t value) {
+  counts[BucketOf(value)].fetch_add(1, std::memory_order_relaxed);
+  total.fetch_add(1, std::memory_order_relaxed);
+  summed.fetch_add(value, std::memory_order_relaxed);
+}
+
+/**
+ * Estimate a quantile from the buckets
+ * @param {double} q the quantile between 0 and 1
+ * @return {uint64_t} the highest value of the bucket holding it
+ */
+uint64_t io::Histogram::quantile(double q) const {
+  const uint64_t all = count();
+  if (all == 0) return 0;
+  const uint64_t rank = std::max<uint64_t>(1, (uint64_t)std::ceil(q * all));
+  uint64_t seen = 0;
+  for (unsigned i = 0; i < BUCKETS; i++) {
+    seen += counts[i].load(std::memory_order_relaxed);
+    if (seen >= rank) return BucketTop(i);
+  }
+  return BucketTop(BUCKETS - 1);
+}
+
+/**
+ * Get or create a metric family
+ * @param {string} name the metric name
+ * @param {string} help the description of the family
+ * @param {Kind} kind the metric type
+ * @return {Family&} the family
+ */
+io::Metrics::Family &io::Metrics::family(const std::string &name,
+  const std::string &help, Kind kind)
+{
+  auto it = families.find(name);
+  if (it == families.end()) {
+    Family &created = families[name];
+    created.kind = kind;
+    created.help = help;
+    return created;
+  }
+  if (it->second.kind != kind)
+    throw std::invalid_argument("Metric " + name + " has another type");
+  return it->second;
+}
+
+/**
+ * Get or create a counter
+ * @param {string} name the metric name
+ * @param {string} help the description of the family
+ * @param {string} labels the labels from Labels()
+ * @return {Counter&} the counter
+ */
+io::Counter &io::Metrics::counter(const std::string &name,
+  const std::string &help, const std::string &labels)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  std::unique_ptr<io::Counter> &metric =
+    family(name, help, Kind::COUNTER).counters[labels];
+  if (metric.get() == nullptr) metric = std::make_unique<io::Counter>();
+  return *metric;
+}
+
+/**
+ * Get or create a gauge
+ * @param {string} name the metric name
+ * @param {string} help the description of the family
+ * @param {string} labels the labels from Labels()
+ * @return {Gauge&} the gauge
+ */
+io::Gauge &io::Metrics::gauge(const std::string &name,
+  const std::string &help, const std::string &labels)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  std::unique_ptr<io::Gauge> &metric =
+    family(name, help, Kind::GAUGE).gauges[labels];
+  if (metric.get() == nullptr) metric = std::make_unique<io::Gauge>();
+  return *metric;
+}
+
+/**
+ * Get or create a histogram
+ * @param {string} name the metric name
+ * @param {string} help the description of the family
+ * @param {string} labels the labels from Labels()
+ * @param {double} scale multiplier to the exported unit
+ * @return {Histogram&} the histogram
+ */
+io::Histogram &io::Metrics::histogram(const std::string &name,
+  const std::string &help, const std::string &labels, double scale)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  std::unique_ptr<io::Histogram> &metric =
+    family(name, help, Kind::HISTOGRAM).histograms[labels];
+  if (metric.get() == nullptr) metric = std::make_unique<io::Histogram>(scale);
+  return *metric;
+}
+
+/**
+ * Format label pairs, escaping the values
+ * @param {initializer_list} pairs the label names and values
+ * @return {string} the labels
+ */
+std::string io::Metrics::Labels(
+  std::initializer_list<std::pair<std::string, std::string>> pairs)
+{
+  std::string out;
+  for (const auto &pair : pairs) {
+    if (!out.empty()) out += ',';
+    out += pair.first + "=\"";
+    for (char c : pair.second) {
+      if (c == '\\' || c == '"') out += '\\';
+      if (c == '\n') out += "\\n";
+      else out += c;
+    }
+    out += '"';
+  }
+  return out;
+}
+
+/**
+ * Write a sample line
+ * @param {ostream} out the exposition text
+ * @param {string} name the sample name
+ * @param {string} labels the series labels
+ * @param {string} extra a label added to the series ones
+ */
+static inline std::ostream &Sample(std::ostream &out, const std::string &name,
+  const std::string &labels, const std::string &extra = "")
+{
+  out << name;
+  if (!labels.empty() || !extra.empty()) {
+    out << '{' << labels;
+    if (!labels.empty() && !extra.empty()) out << ',';
+    out << extra << '}';
+  }
+  return out << ' ';
+}
+
+/**
+ * Write every metric in the Prometheus text format
+ * @return {string} the exposition text
+ */
+std::string io::Metrics::expose() const {
+  std::lock_guard<std::mutex> lock(mutex);
+  std::ostringstream out;
+  out.precision(9);
+  for (const auto &entry : families) {
+    const std::string &name = entry.first;
+    const Family &family = entry.second;
+    out << "# HELP " << name << ' ' << family.help << '\n';
+
+    switch (family.kind) {
+      case Kind::COUNTER:
+        out << "# TYPE " << name << " counter\n";
+        for (const auto &series : family.counters)
+          Sample(out, name, series.first) << series.second->get() << '\n';
+        break;
+
+      case Kind::GAUGE:
+        out << "# TYPE " << name << " gauge\n";
+        for (const auto &series : family.gauges)
+          Sample(out, name, series.first) << series.second->get() << '\n';
+        break;
+
+      // histograms are summaries with their quantiles
+      case Kind::HISTOGRAM:
+        out << "# TYPE " << name << " summary\n";
+        for (const auto &series : family.histograms) {
+          const io::Histogram &h = *series.second;
+          for (double q : Quantiles) {
+            std::ostringstream label;
+            label << "quantile=\"" << q << '"';
+            Sample(out, name, series.first, label.str())
+              << (double)h.quantile(q) * h.scale << '\n';
+          }
+          Sample(out, name + "_sum", series.first)
+            << (double)h.sum() * h.scale << '\n';
+          Sample(out, name + "_count", series.first) << h.count() << '\n';
+        }
+        break;
+    }
+  }
+  return out.str();
+}
+
+/**
+ * Serve expose() to http GET /metrics requests
+ * @param {Loop} loop the loop to listen on
+ * @param {int} port the tcp port
+ * @param {string} host the address to bind
+ * @return {bool} if listening
+ */
+bool io::Metrics::serve(io::Loop *loop, int port, const std::string &host) {
+  io::Socket *server = loop->listen(host, port);
+  if (server == nullptr) return false;
+  io::Metrics *self = this;
+
+  // answer one request per connection
+  server->onAccept([self](io::Socket *client) {
+    std::shared_ptr<std::string> request = std::make_shared<std::string>();
+    client->onRead([self, client, request](io::Data &data) {
+      request->append(data.begin(), data.end());
+      if (request->find("\r\n\r\n") == std::string::npos) {
+        if (request->size() > 8192) client->End();
+        return;
+      }
+
+      // only the request line matters
+      const std::string line = request->substr(0, request->find("\r\n"));
+      const bool found = line.rfind("GET /metrics ", 0) == 0 ||
+        line.rfind("GET / ", 0) == 0;
+      const std::string body = found ? self->expose() : "not found\n";
+      std::string resp = found ? "HTTP/1.1 200 OK\r\n"
+        "Content-Type: text/plain; version=0.0.4\r\n"
+        : "HTTP/1.1 404 Not Found\r\nContent-Type: text/plain\r\n";
+      resp += "Content-Length: " + std::to_string(body.size()) +
+        "\r\nConnection: close\r\n\r\n" + body;
+      client->Write(io::Data(resp.begin(), resp.end()));
+      client->End();
+    });
+  });
+  return true;
+}
@@ -0,0 +1,170 @@
+#pragma once
+
+#include "socket.hh"
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+
+namespace io {
+
+  class Counter {
+  /** Count that only goes up, safe to add to from any thread */
+  public:
+    inline void add(uint64_t n = 1) {
+      value.fetch_add(n, std::memory_order_relaxed);
+    }
+    inline uint64_t get() const {
+      return value.load(std::memory_order_relaxed);
+    }
+
+  private:
+    std::atomic<uint64_t> value{0};
+  };
+
+  class Gauge {
+  /** Value that goes up and down, safe to change from any thread */
+  public:
+    inline void set(int64_t v) {
+      value.store(v, std::memory_order_relaxed);
+    }
+    inline void add(int64_t n) {
+      value.fetch_add(n, std::memory_order_relaxed);
+    }
+    inline int64_t get() const {
+      return value.load(std::memory_order_relaxed);
+    }
+
+  private:
+    std::atomic<int64_t> value{0};
+  };
+
+  class Histogram {
+  /**
+   * Distribution of values in log-linear buckets (HDR histogram style):
+   * every power of two is split into 16 equal buckets, so quantiles are
+   * within 1/16 of the recorded values from 1 to 2^40 with a fixed 4.7KB
+   * of counts. Recording is lock free. Values are integers (ex: us),
+   * scale converts them to the exported unit (ex: 1e-6 for seconds).
+   */
+  public:
+    static const unsigned SUB_BITS = 4;  // log2 of the buckets per power of two
+    static const unsigned MAX_BITS = 40; // values are clamped below 2^40
+    static const unsigned BUCKETS = (MAX_BITS - SUB_BITS + 1) << SUB_BITS;
+
+    const double scale; // multiplier from recorded to exported values
+
+    inline Histogram(double scale = 1) : scale(scale) {}
+
+    /**
+     * Record a value
+     * @param {uint64_t} value the value, ex: a latency in us
+     */
+    void record(uint64_t value);
+
+    /**
+     * Estimate a quantile from the buckets
+     * @param {double} q the quantile between 0 and 1
+     * @return {uint64_t} the highest value of the bucket holding it
+     */
+    uint64_t quantile(double q) const;
+
+    // amount of recorded values
+    inline uint64_t count() const {
+      return total.load(std::memory_order_relaxed);
+    }
+
+    // sum of the recorded values
+    inline uint64_t sum() const {
+      return summed.load(std::memory_order_relaxed);
+    }
+
+  private:
+    std::atomic<uint64_t> counts[BUCKETS] = {};
+    std::atomic<uint64_t> total{0};
+    std::atomic<uint64_t> summed{0};
+  };
+
+  class Metrics {
+  /**
+   * Registry of named metrics exported in the Prometheus text format.
+   * Metrics of the same name form a family and are told apart by their
+   * labels. They are created on first use and live as long as the
+   * registry, so callers keep the references and update them lock free.
+   */
+  public:
+    /**
+     * Get or create a counter
+     * @param {string} name the metric name, ex: cda_gateway_events_total
+     * @param {string} help the description of the family
+     * @param {string} labels the labels from Labels() (empty for none)
+     * @return {Counter&} the counter
+     * @throws {invalid_argument} if the name is used by another type
+     */
+    Counter &counter(const std::string &name, const std::string &help,
+      const std::string &labels = "");
+
+    /**
+     * Get or create a gauge
+     * @param {string} name the metric name
+     * @param {string} help the description of the family
+     * @param {string} labels the labels from Labels() (empty for none)
+     * @return {Gauge&} the gauge
+     * @throws {invalid_argument} if the name is used by another type
+     */
+    Gauge &gauge(const std::string &name, const std::string &help,
+      const std::string &labels = "");
+
+    /**
+     * Get or create a histogram, exported as a summary with quantiles
+     * @param {string} name the metric name, ex: cda_api_request_seconds
+     * @param {string} help the description of the family
+     * @param {string} labels the labels from Labels() (empty for none)
+     * @param {double} scale multiplier to the exported unit
+     * @return {Histogram&} the histogram
+     * @throws {invalid_argument} if the name is used by another type
+     */
+    Histogram &histogram(const std::string &name, const std::string &help,
+      const std::string &labels = "", double scale = 1);
+
+    /**
+     * Format label pairs, escaping the values
+     * @param {initializer_list} pairs the label names and values
+     * @return {string} the labels, ex: shard="0",event="READY"
+     */
+    static std::string Labels(
+      std::initializer_list<std::pair<std::string, std::string>> pairs);
+
+    /**
+     * Write every metric in the Prometheus text format
+     * @return {string} the exposition text
+     */
+    std::string expose() const;
+
+    /**
+     * Serve expose() to http GET /metrics requests
+     * @param {Loop} loop the loop to listen on
+     * @param {int} port the tcp port
+     * @param {string} host the address to bind, local only by default
+     * @return {bool} if listening
+     */
+    bool serve(Loop *loop, int port, const std::string &host = "127.0.0.1");
+
+  private:
+    enum class Kind { COUNTER, GAUGE, HISTOGRAM };
+    struct Family {
+      Kind kind;
+      std::string help;
+      std::map<std::string, std::unique_ptr<Counter>> counters;
+      std::map<std::string, std::unique_ptr<Gauge>> gauges;
+      std::map<std::string, std::unique_ptr<Histogram>> histograms;
+    };
+
+    Family &family(const std::string &name, const std::string &help,
+      Kind kind);
+
+    mutable std::mutex mutex;                // guards the families
+    std::map<std::string, Family> families;  // families by name
+  };
+
+}
@@ -0,0 +1,162 @@
+#pragma once
+
+#include "json.hh"
+
+namespace io {
+
+  /**
+   * Check if 8 bytes are all ascii digits
+   * @param {uint64_t} v the 8 bytes loaded as a little endian word
+   * @return {bool} if every byte is between '0' and '9'
+   */
+  static inline bool IsEightDigits(uint64_t v) {
+    return (((v & 0xF0F0F0F0F0F0F0F0ULL) |
+      (((v + 0x0606060606060606ULL) & 0xF0F0F0F0F0F0F0F0ULL) >> 4))
+      == 0x3333333333333333ULL);
+  }
+
+  /**
+   * Convert 8 ascii digits into their value within a single word
+   * @param {uint64_t} v the 8 digits loaded as a little endian word
+   * @return {uint32_t} the decimal value of the digits
+   */
+  static inline uint32_t ParseEightDigits(uint64_t v) {
+    v -= 0x3030303030303030ULL;
+    v = (v * 10) + (v >> 8);
+    v = (((v & 0x000000FF000000FFULL) * 0x000F424000000064ULL) +
+      (((v >> 16) & 0x000000FF000000FFULL) * 0x0000271000000001ULL)) >> 32;
+    return (uint32_t)v;
+  }
+
+  /**
+   * Parse a fixed amount of ascii digits
+   * @param {const char*} p the digits to parse
+   * @param {size_t} count the amount of digits
+   * @param {int&} out the parsed value
+   * @return {bool} if all characters were digits
+   */
+  static inline bool ParseDigits(const char *p, std::size_t count, int &out) {
+    out = 0;
+    for (std::size_t i = 0; i < count; i++) {
+      const unsigned d = (unsigned char)p[i] - '0';
+      if (d > 9) return false;
+      out = out * 10 + (int)d;
+    }
+    return true;
+  }
+
+  /**
+   * Parse an unsigned decimal integer without locales or allocation
+   * @param {const char*} str the digits to parse
+   * @param {size_t} len the amount of characters to parse
+   * @param {uint64_t&} out the parsed value
+   * @return {bool} if the whole string was a valid uint64
+   */
+  static inline bool ParseUint(const char *str, std::size_t len, uint64_t &out) {
+    static const char *max = "18446744073709551615";
+    if (len == 0 || len > 20) return false;
+    if (len == 20 && std::memcmp(str, max, 20) > 0) return false;
+
+    // consume 8 digits at a time while possible
+    std::size_t i = 0;
+    uint64_t result = 0;
+    #if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    uint64_t word;
+    for (; i + 8 <= len; i += 8) {
+      std::memcpy(&word, str + i, sizeof(word));
+      if (!IsEightDigits(word)) return false;
+      result = result * 100000000ULL + ParseEightDigits(word);
+    }
+    #endif
+
+    // consume the remaining digits
+    for (; i < len; i++) {
+      const unsigned d = (unsigned char)str[i] - '0';
+      if (d > 9) return false;
+      result = result * 10 + d;
+    }
+
+    out = result;
+    return true;
+  }
+
+  /**
+   * Get the days since the unix epoch for a civil date
+   * @param {int} y the year
+   * @param {int} m the month [1, 12]
+   * @param {int} d the day of the month [1, 31]
+   * @return {int64_t} days since 1970-01-01
+   * @see http://howardhinnant.github.io/date_algorithms.html
+   */
+  static inline constexpr int64_t DaysFromCivil(int y, int m, int d) {
+    y -= m <= 2;
+    const int64_t era = (y >= 0 ? y : y - 399) / 400;
+    const int64_t yoe = y - era * 400;
+    const int64_t doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+    const int64_t doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return era * 146097 + doe - 719468;
+  }
+
+  /**
+   * Parse an ISO-8601 timestamp as sent by discord
+   * ex: 2017-07-11T17:27:07.299000+00:00 or 2017-07-11T17:27:07Z
+   * @param {const char*} str the timestamp to parse
+   * @param {size_t} len the amount of characters to parse
+   * @param {int64_t&} out milliseconds since the unix epoch (UTC)
+   * @return {bool} if the timestamp was valid
+   */
+  static inline bool ParseTimestamp(const char *str, std::size_t len, int64_t &out) {
+    int year, month, day, hour, min, sec, ms = 0;
+    if (len < 19) return false;
+
+    // parse the date and time fields
+    if (str[4] != '-' || str[7] != '-' || (str[10] != 'T' && str[10] != ' ') ||
+        str[13] != ':' || str[16] != ':')
+      return false;
+    if (!ParseDigits(str, 4, year) || !ParseDigits(str + 5, 2, month) ||
+        !ParseDigits(str + 8, 2, day) || !ParseDigits(str + 11, 2, hour) ||
+        !ParseDigits(str + 14, 2, min) || !ParseDigits(str + 17, 2, sec))
+      return false;
+    if (month < 1 || month > 12 || day < 1 || day > 31 ||
+        hour > 23 || min > 59 || sec > 60)
+      return false;
+
+    // parse fractional seconds (only keep milliseconds)
+    std::size_t i = 19;
+    if (i < len && str[i] == '.') {
+      int scale = 100;
+      for (i++; i < len; i++) {
+        const unsigned d = (unsigned char)str[i] - '0';
+        if (d > 9) break;
+        ms += (int)d * scale;
+        scale /= 10;
+      }
+    }
+
+    // parse the utc offset
+    int offset = 0;
+    if (i < len) {
+      if (str[i] == 'Z' || str[i] == 'z') {
+        i++;
+      } else if (str[i] == '+' || str[i] == '-') {
+        int oh, om = 0;
+        const int sign = str[i++] == '-' ? -1 : 1;
+        if (i + 2 > len || !ParseDigits(str + i, 2, oh)) return false;
+        i += 2;
+        if (i < len && str[i] == ':') i++;
+        if (i + 2 <= len) {
+          if (!ParseDigits(str + i, 2, om)) return false;
+          i += 2;
+        }
+        offset = sign * (oh * 3600 + om * 60);
+      }
+    }
+    if (i != len) return false;
+
+    // combine into milliseconds since epoch
+    const int64_t secs = DaysFromCivil(year, month, day) * 86400
+      + hour * 3600 + min * 60 + sec - offset;
+    out = secs * 1000 + ms;
+    return true;
+  }
+}
@@ -0,0 +1,653 @@
+#include "scan.hh"
+#include <charconv>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define IO_SCAN_X86
+#include <immintrin.h>
+#endif
+
+// bytes classified per step
+#define SCAN_BLOCK 64
+
+struct BlockMasks {
+  /** One bit per byte of a 64 byte block */
+  uint64_t quote;     // "
+  uint64_t backslash; // \ .
+  uint64_t op;        // { } [ ] : ,
+  uint64_t ws;        // space, tab, cr, lf
+};
+
+typedef void (*Classifier)(const unsigned char *block, BlockMasks &out);
+
+// character classes for the scalar backend
+enum : uint8_t { C_QUOTE = 1, C_BACKSLASH = 2, C_OP = 4, C_WS = 8 };
+
+struct ClassTable {
+  uint8_t table[256] = {};
+  constexpr ClassTable() {
+    table[(uint8_t)'"'] = C_QUOTE;
+    table[(uint8_t)'\\'] = C_BACKSLASH;
+    for (const char c : {'{', '}', '[', ']', ':', ','})
+      table[(uint8_t)c] = C_OP;
+    for (const char c : {' ', '\t', '\n', '\r'})
+      table[(uint8_t)c] = C_WS;
+  }
+};
+static constexpr ClassTable Classes;
+
+/**
+ * Classify a block one byte at a time
+ * @param {const unsigned char*} block the 64 bytes to classify
+ * @param {BlockMasks&} out the resulting masks
+ */
+static void ClassifyScalar(const unsigned char *block, BlockMasks &out) {
+  uint64_t quote = 0, backslash = 0, op = 0, ws = 0;
+  for (int i = 0; i < SCAN_BLOCK; i++) {
+    const uint8_t c = Classes.table[block[i]];
+    const uint64_t bit = 1ULL << i;
+    if (c & C_QUOTE) quote |= bit;
+    if (c & C_BACKSLASH) backslash |= bit;
+    if (c & C_OP) op |= bit;
+    if (c & C_WS) ws |= bit;
+  }
+  out = {quote, backslash, op, ws};
+}
+
+#ifdef IO_SCAN_X86
+/**
+ * Classify a block 16 bytes per compare
+ * @param {const unsigned char*} block the 64 bytes to classify
+ * @param {BlockMasks&} out the resulting masks
+ */
+__attribute__((target("sse4.2")))
+static void ClassifySse42(const unsigned char *block, BlockMasks &out) {
+  out = {0, 0, 0, 0};
+  for (int i = 0; i < SCAN_BLOCK; i += 16) {
+    const __m128i v = _mm_loadu_si128((const __m128i*)(block + i));
+    // { and [ as well as } and ] only differ by 0x20
+    const __m128i folded = _mm_or_si128(v, _mm_set1_epi8(0x20));
+    const __m128i op = _mm_or_si128(
+      _mm_or_si128(_mm_cmpeq_epi8(folded, _mm_set1_epi8('{')),
+        _mm_cmpeq_epi8(folded, _mm_set1_epi8('}'))),
+      _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(':')),
+        _mm_cmpeq_epi8(v, _mm_set1_epi8(','))));
+    const __m128i ws = _mm_or_si128(
+      _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(' ')),
+        _mm_cmpeq_epi8(v, _mm_set1_epi8('\t'))),
+      _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('\n')),
+        _mm_cmpeq_epi8(v, _mm_set1_epi8('\r'))));
+    out.quote |= (uint64_t)(uint16_t)_mm_movemask_epi8(
+      _mm_cmpeq_epi8(v, _mm_set1_epi8('"'))) << i;
+    out.backslash |= (uint64_t)(uint16_t)_mm_movemask_epi8(
+      _mm_cmpeq_epi8(v, _mm_set1_epi8('\\'))) << i;
+    out.op |= (uint64_t)(uint16_t)_mm_movemask_epi8(op) << i;
+    out.ws |= (uint64_t)(uint16_t)_mm_movemask_epi8(ws) << i;
+  }
+}
+
+/**
+ * Classify a block 32 bytes per compare
+ * @param {const unsigned char*} block the 64 bytes to classify
+ * @param {BlockMasks&} out the resulting masks
+ */
+__attribute__((target("avx2")))
+static void ClassifyAvx2(const unsigned char *block, BlockMasks &out) {
+  out = {0, 0, 0, 0};
+  for (int i = 0; i < SCAN_BLOCK; i += 32) {
+    const __m256i v = _mm256_loadu_si256((const __m256i*)(block + i));
+    const __m256i folded = _mm256_or_si256(v, _mm256_set1_epi8(0x20));
+    const __m256i op = _mm256_or_si256(
+      _mm256_or_si256(_mm256_cmpeq_epi8(folded, _mm256_set1_epi8('{')),
+        _mm256_cmpeq_epi8(folded, _mm256_set1_epi8('}'))),
+      _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(':')),
+        _mm256_cmpeq_epi8(v, _mm256_set1_epi8(','))));
+    const __m256i ws = _mm256_or_si256(
+      _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(' ')),
+        _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\t'))),
+      _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n')),
+        _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\r'))));
+    out.quote |= (uint64_t)(uint32_t)_mm256_movemask_epi8(
+      _mm256_cmpeq_epi8(v, _mm256_set1_epi8('"'))) << i;
+    out.backslash |= (uint64_t)(uint32_t)_mm256_movemask_epi8(
+      _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\\'))) << i;
+    out.op |= (uint64_t)(uint32_t)_mm256_movemask_epi8(op) << i;
+    out.ws |= (uint64_t)(uint32_t)_mm256_movemask_epi8(ws) << i;
+  }
+}
+#endif
+
+/**
+ * Pick the best backend the cpu supports
+ * @return {ScanBackend} the detected backend
+ */
+static io::ScanBackend DetectBackend() {
+  #ifdef IO_SCAN_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) return io::ScanBackend::AVX2;
+  if (__builtin_cpu_supports("sse4.2")) return io::ScanBackend::SSE42;
+  #endif
+  return io::ScanBackend::SCALAR;
+}
+
+static std::atomic<io::ScanBackend> ActiveBackend{DetectBackend()};
+
+/**
+ * Select the scanner used by every JsonDocument created afterwards
+ * @param {ScanBackend} backend the backend, unsupported ones fall back
+ * @return {ScanBackend} the backend that will actually be used
+ */
+io::ScanBackend io::SetScanBackend(io::ScanBackend backend) {
+  const io::ScanBackend best = DetectBackend();
+  if (backend == io::ScanBackend::AUTO || backend > best)
+    backend = best;
+  ActiveBackend = backend;
+  return backend;
+}
+
+/**
+ * Get the scanner JsonDocument currently uses
+ * @return {ScanBackend} the active backend
+ */
+io::ScanBackend io::GetScanBackend() {
+  return ActiveBackend;
+}
+
+/**
+ * Get the classifier of a backend
+ * @param {ScanBackend} backend the backend
+ * @return {Classifier} the block classifier
+ */
+static inline Classifier ClassifierOf(io::ScanBackend backend) {
+  #ifdef IO_SCAN_X86
+  if (backend == io::ScanBackend::AVX2) return ClassifyAvx2;
+  if (backend == io::ScanBackend::SSE42) return ClassifySse42;
+  #endif
+  return ClassifyScalar;
+}
+
+/**
+ * Set every bit that has an odd amount of set bits at or below it
+ * @param {uint64_t} x the bits
+ * @return {uint64_t} the running xor of the bits
+ */
+static inline uint64_t PrefixXor(uint64_t x) {
+  x ^= x << 1;
+  x ^= x << 2;
+  x ^= x << 4;
+  x ^= x << 8;
+  x ^= x << 16;
+  x ^= x << 32;
+  return x;
+}
+
+/**
+ * Record the structural characters and value starts of a json text
+ * @param {const char*} data the text
+ * @param {size_t} len the text size
+ * @param {Classifier} classify the block classifier
+ * @param {vector} index receives the offsets
+ * @return {bool} if every string was terminated
+ */
+static bool Structurals(const char *data, std::size_t len,
+  Classifier classify, std::vector<uint32_t> &index)
+{
+  uint64_t inString = 0; // all ones when the last block ended in a string
+  uint64_t escaped = 0;  // 1 when the next block starts escaped
+  uint64_t scalar = 0;   // 1 when the last block ended in a scalar
+  unsigned char tail[SCAN_BLOCK];
+  for (std::size_t base = 0; base < len; base += SCAN_BLOCK) {
+    const unsigned char *block = (const unsigned char*)data + base;
+
+    // pad the last block with whitespace
+    if (len - base < SCAN_BLOCK) {
+      std::memset(tail, ' ', SCAN_BLOCK);
+      std::memcpy(tail, block, len - base);
+      block = tail;
+    }
+    BlockMasks m;
+    classify(block, m);
+
+    // backslashes escape the next character unless escaped themselves
+    uint64_t skipped = escaped;
+    uint64_t backslash = m.backslash & ~skipped;
+    escaped = 0;
+    while (backslash) {
+      const uint64_t bit = backslash & (0 - backslash);
+      skipped |= bit << 1;
+      escaped = bit >> 63;
+      backslash &= ~(bit | (bit << 1));
+    }
+
+    // strings run from an opening quote up to (excluding) the closing one
+    const uint64_t quote = m.quote & ~skipped;
+    const uint64_t strings = PrefixXor(quote) ^ inString;
+    inString = (uint64_t)((int64_t)strings >> 63);
+
+    // scalars (numbers, true, false, null) start after a non scalar
+    const uint64_t scalars = ~(m.op | m.ws | quote | strings);
+    const uint64_t starts = scalars & ~((scalars << 1) | scalar);
+    scalar = scalars >> 63;
+
+    // keep operators, opening quotes and scalar starts
+    uint64_t structurals = (m.op & ~strings) | (quote & strings) | starts;
+    while (structurals) {
+      index.push_back((uint32_t)(base + __builtin_ctzll(structurals)));
+      structurals &= structurals - 1;
+    }
+  }
+  return inString == 0;
+}
+
+/**
+ * Index a set of texts with escapes, strings and scalars crossing every
+ * position of a block boundary and compare a backend to the scalar one
+ * @param {ScanBackend} backend the backend to check
+ * @return {bool} if both built the same index for every text
+ */
+static bool SameAsScalar(io::ScanBackend backend) {
+  const Classifier classify = ClassifierOf(backend);
+  std::vector<uint32_t> expected, actual;
+  for (std::size_t shift = 0; shift < 2 * SCAN_BLOCK + 2; shift++) {
+    const std::string text = "[\"" + std::string(shift, 'x') +
+      R"(\"\\\\","\\\"\\",12345)" "\t\r\n"
+      R"(true,{"k":[null,"\\\"\u00e9"]},-1.5e3 ])";
+    expected.clear();
+    actual.clear();
+    const bool ok = Structurals(text.data(), text.size(), ClassifyScalar,
+      expected);
+    if (Structurals(text.data(), text.size(), classify, actual) != ok
+      || actual != expected)
+      return false;
+  }
+  return true;
+}
+
+/**
+ * Check that every backend the cpu supports indexes like the scalar one,
+ * ex: escapes and strings crossing a 64 byte block boundary
+ * @return {bool} if all of them agree
+ */
+bool io::CheckScanBackends() {
+  const io::ScanBackend best = DetectBackend();
+  bool same = true;
+  for (io::ScanBackend backend : {io::ScanBackend::SSE42,
+    io::ScanBackend::AVX2})
+    if (backend <= best && !SameAsScalar(backend)) {
+      std::cerr << "[io] scan backend " << (int)backend
+        << " differs from the scalar one" << std::endl;
+      same = false;
+    }
+  return same;
+}
+
+/**
+ * Scan a json text
+ * @param {const char*} data the text
+ * @param {size_t} len the text size
+ */
+io::JsonDocument::JsonDocument(const char *data, std::size_t len) :
+  data(data), len(len)
+{
+  if (len >= UINT32_MAX)
+    throw std::invalid_argument("JSON text is too large to index");
+  const Classifier classify = ClassifierOf(ActiveBackend);
+  index.reserve(len / 6 + 4);
+
+  if (!Structurals(data, len, classify, index))
+    throw std::invalid_argument("JSON text has an unterminated string");
+
+  // link matching brackets
+  match.resize(index.size());
+  std::vector<uint32_t> open;
+  for (uint32_t i = 0; i < index.size(); i++) {
+    const char c = data[index[i]];
+    if (c == '{' || c == '[') {
+      open.push_back(i);
+    } else if (c == '}' || c == ']') {
+      if (open.empty() || data[index[open.back()]] != (c == '}' ? '{' : '['))
+        throw std::invalid_argument("JSON text has unbalanced brackets");
+      match[open.back()] = i;
+      open.pop_back();
+    }
+  }
+  if (!open.empty())
+    throw std::invalid_argument("JSON text has unbalanced brackets");
+}
+
+// first character of the value
+inline char io::JsonView::kind() const {
+  return doc ? doc->data[doc->index[pos]] : 0;
+}
+
+bool io::JsonView::isObject() const { return kind() == '{'; }
+bool io::JsonView::isArray() const { return kind() == '['; }
+bool io::JsonView::isString() const { return kind() == '"'; }
+bool io::JsonView::isBool() const { return kind() == 't' || kind() == 'f'; }
+bool io::JsonView::isNull() const { return kind() == 'n'; }
+bool io::JsonView::isNumber() const {
+  const char c = kind();
+  return c == '-' || (c >= '0' && c <= '9');
+}
+
+/**
+ * Find an object member, keys are compared as written
+ * @param {string_view} key the member name
+ * @return {JsonView} the member value or an invalid view
+ */
+io::JsonView io::JsonView::find(std::string_view key) const {
+  if (!isObject()) return JsonView();
+  const uint32_t end = doc->match[pos];
+  uint32_t i = pos + 1;
+  while (i < end) {
+    // every member is a key, a colon and a value
+    if (i + 2 >= end || doc->data[doc->index[i]] != '"'
+        || doc->data[doc->index[i + 1]] != ':')
+      return JsonView();
+    if (JsonView(doc, i).string() == key)
+      return JsonView(doc, i + 2);
+    i = doc->skip(i + 2);
+    if (i < end && doc->data[doc->index[i]] == ',') i++;
+  }
+  return JsonView();
+}
+
+/**
+ * Get an array element
+ * @param {size_t} index the element position
+ * @return {JsonView} the element or an invalid view
+ */
+io::JsonView io::JsonView::at(std::size_t index) const {
+  if (!isArray()) return JsonView();
+  const uint32_t end = doc->match[pos];
+  uint32_t i = pos + 1;
+  for (; i < end; index--) {
+    if (index == 0) return JsonView(doc, i);
+    i = doc->skip(i);
+    if (i < end && doc->data[doc->index[i]] == ',') i++;
+  }
+  return JsonView();
+}
+
+/**
+ * Count the members of an object or the elements of an array
+ * @return {size_t} the amount of children
+ */
+std::size_t io::JsonView::size() const {
+  std::size_t count = 0;
+  each([&count](std::string_view, JsonView) { count++; });
+  return count;
+}
+
+/**
+ * Visit every array element or object member value
+ * @param {function} cb called with the key (empty for arrays) and value
+ */
+void io::JsonView::each(
+  const std::function<void(std::string_view, JsonView)> &cb) const
+{
+  const bool object = isObject();
+  if (!object && !isArray()) return;
+  const uint32_t end = doc->match[pos];
+  uint32_t i = pos + 1;
+  while (i < end) {
+    std::string_view key;
+    if (object) {
+      if (i + 2 >= end || doc->data[doc->index[i + 1]] != ':') return;
+      key = JsonView(doc, i).string();
+      i += 2;
+    }
+    cb(key, JsonView(doc, i));
+    i = doc->skip(i);
+    if (i < end && doc->data[doc->index[i]] == ',') i++;
+  }
+}
+
+/**
+ * The text of the value exactly as received
+ * @return {string_view} the raw value including quotes and brackets
+ */
+std::string_view io::JsonView::raw() const {
+  if (!doc) return std::string_view();
+  const char c = kind();
+  const std::size_t start = doc->index[pos];
+  std::size_t end;
+  if (c == '{' || c == '[') {
+    end = doc->index[doc->match[pos]] + 1;
+  } else {
+    // scalars and strings run up to the next structural
+    end = pos + 1 < doc->index.size() ? doc->index[pos + 1] : doc->len;
+    while (end > start && Classes.table[(uint8_t)doc->data[end - 1]] == C_WS)
+      end--;
+  }
+  return std::string_view(doc->data + start, end - start);
+}
+
+/**
+ * Read a string value without unescaping it
+ * @return {string_view} the contents between the quotes
+ */
+std::string_view io::JsonView::string() const {
+  if (!isString()) return std::string_view();
+  const std::string_view text = raw();
+  if (text.size() < 2 || text.back() != '"') return std::string_view();
+  return text.substr(1, text.size() - 2);
+}
+
+/**
+ * Read a string value
+ * @param {string&} out the unescaped string
+ * @return {bool} if the value was a valid string
+ */
+bool io::JsonView::get(std::string &out) const {
+  if (!isString()) return false;
+  const std::string_view text = string();
+  if (text.find('\\') == std::string_view::npos) {
+    out.assign(text.data(), text.size());
+    return true;
+  }
+
+  // leave escapes to the full parser, they are rare
+  try {
+    out = toJson().get<std::string>();
+  } catch (const std::exception &e) {
+    return false;
+  }
+  return true;
+}
+
+/**
+ * Read an unsigned number, quoted numbers (snowflakes) are accepted
+ * @param {uint64_t&} out the number
+ * @return {bool} if the value was an unsigned integer
+ */
+bool io::JsonView::get(uint64_t &out) const {
+  const std::string_view text = isString() ? string() : raw();
+  if (!isString() && !isNumber()) return false;
+  return io::ParseUint(text.data(), text.size(), out);
+}
+
+/**
+ * Read a signed integer, ex: colors and counts
+ * @param {int64_t&} out the number
+ * @return {bool} if the value was an integer in range
+ */
+bool io::JsonView::get(int64_t &out) const {
+  if (!isNumber()) return false;
+  std::string_view text = raw();
+  const bool negative = text[0] == '-';
+  if (negative) text.remove_prefix(1);
+  uint64_t value;
+  if (!io::ParseUint(text.data(), text.size(), value)
+    || value > (uint64_t)INT64_MAX + negative)
+    return false;
+  out = negative ? (int64_t)(0 - value) : (int64_t)value;
+  return true;
+}
+
+/**
+ * Read a boolean
+ * @param {bool&} out the boolean
+ * @return {bool} if the value was true or false
+ */
+bool io::JsonView::get(bool &out) const {
+  const std::string_view text = raw();
+  if (text == "true") out = true;
+  else if (text == "false") out = false;
+  else return false;
+  return true;
+}
+
+/**
+ * Build the full value tree of this value
+ * @return {json} the parsed value (null for invalid views)
+ */
+nlohmann::json io::JsonView::toJson() const {
+  const std::string_view text = raw();
+  if (text.empty()) return nullptr;
+  return nlohmann::json::parse(text.data(), text.data() + text.size());
+}
+
+// append bytes to a frame buffer or stream
+static inline void Put(io::Data &out, char c) {
+  out.push_back(c);
+}
+static inline void Put(io::Data &out, const char *begin, const char *end) {
+  out.insert(out.end(), begin, end);
+}
+static inline void Put(io::WebsockStream &out, char c) {
+  out.put(c);
+}
+static inline void Put(io::WebsockStream &out, const char *begin,
+  const char *end)
+{
+  out.write(begin, end - begin);
+}
+
+/**
+ * Append a string with json escapes
+ * @param {string} text the string to write
+ * @param {Out&} out the buffer or stream to append to
+ */
+template <typename Out>
+static void WriteString(const std::string &text, Out &out) {
+  static const char *hex = "0123456789abcdef";
+  Put(out, '"');
+  std::size_t run = 0; // start of the characters that need no escape
+  for (std::size_t i = 0; i < text.size(); i++) {
+    const unsigned char c = (unsigned char)text[i];
+    if (c >= 0x20 && c != '"' && c != '\\') continue;
+    Put(out, text.data() + run, text.data() + i);
+    run = i + 1;
+    Put(out, '\\');
+    switch (c) {
+      case '"': Put(out, '"'); break;
+      case '\\': Put(out, '\\'); break;
+      case '\b': Put(out, 'b'); break;
+      case '\f': Put(out, 'f'); break;
+      case '\n': Put(out, 'n'); break;
+      case '\r': Put(out, 'r'); break;
+      case '\t': Put(out, 't'); break;
+      default: {
+        const char code[5] = {'u', '0', '0', hex[c >> 4], hex[c & 0xf]};
+        Put(out, code, code + 5);
+      }
+    }
+  }
+  Put(out, text.data() + run, text.data() + text.size());
+  Put(out, '"');
+}
+
+/**
+ * Append a number
+ * @param {T} number the number to write
+ * @param {Out&} out the buffer or stream to append to
+ */
+template <typename T, typename Out>
+static inline void WriteNumber(T number, Out &out) {
+  char digits[32];
+  const std::to_chars_result end =
+    std::to_chars(digits, digits + sizeof(digits), number);
+  Put(out, digits, end.ptr);
+}
+
+/**
+ * Serialize a json value
+ * @param {json} value the value to write
+ * @param {Out&} out the buffer or stream to append to
+ */
+template <typename Out>
+static void Write(const nlohmann::json &value, Out &out) {
+  static const char literals[] = "nulltruefalse";
+  switch (value.type()) {
+    case nlohmann::json::value_t::null:
+    case nlohmann::json::value_t::discarded:
+      Put(out, literals, literals + 4);
+      break;
+    case nlohmann::json::value_t::boolean:
+      if (value.get<bool>())
+        Put(out, literals + 4, literals + 8);
+      else
+        Put(out, literals + 8, literals + 13);
+      break;
+    case nlohmann::json::value_t::number_unsigned:
+      WriteNumber(value.get<uint64_t>(), out);
+      break;
+    case nlohmann::json::value_t::number_integer:
+      WriteNumber(value.get<int64_t>(), out);
+      break;
+    case nlohmann::json::value_t::number_float: {
+      // json has no nan or infinity
+      const double number = value.get<double>();
+      if (!std::isfinite(number))
+        Put(out, literals, literals + 4);
+      else
+        WriteNumber(number, out);
+      break;
+    }
+    case nlohmann::json::value_t::string:
+      WriteString(*value.get_ptr<const std::string*>(), out);
+      break;
+    case nlohmann::json::value_t::array: {
+      Put(out, '[');
+      bool first = true;
+      for (const nlohmann::json &item : value) {
+        if (!first) Put(out, ',');
+        Write(item, out);
+        first = false;
+      }
+      Put(out, ']');
+      break;
+    }
+    case nlohmann::json::value_t::object: {
+      Put(out, '{');
+      bool first = true;
+      for (auto it = value.begin(); it != value.end(); ++it) {
+        if (!first) Put(out, ',');
+        WriteString(it.key(), out);
+        Put(out, ':');
+        Write(it.value(), out);
+        first = false;
+      }
+      Put(out, '}');
+      break;
+    }
+  }
+}
+
+/**
+ * Serialize a json value straight into a buffer
+ * @param {json} value the value to write
+ * @param {Data&} out the buffer to append to
+ */
+void io::JsonWrite(const nlohmann::json &value, io::Data &out) {
+  Write(value, out);
+}
+
+/**
+ * Serialize a json value straight into a fragmented message
+ * @param {json} value the value to write
+ * @param {WebsockStream&} out the message to append to
+ */
+void io::JsonWrite(const nlohmann::json &value, io::WebsockStream &out) {
+  Write(value, out);
+}
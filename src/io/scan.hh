@@ -0,0 +1,243 @@
+#pragma once
+
+#include "etf.hh"
+#include <string_view>
+
+namespace io {
+
+  /**
+   * Implementations of the structural scanner. All of them produce the
+   * same index, they only differ in how many bytes are classified per
+   * instruction.
+   */
+  enum class ScanBackend {
+    AUTO,    // best one the cpu supports
+    SCALAR,  // table lookups, works everywhere
+    SSE42,   // 16 bytes per compare
+    AVX2     // 32 bytes per compare
+  };
+
+  /**
+   * Select the scanner used by every JsonDocument created afterwards
+   * @param {ScanBackend} backend the backend, unsupported ones fall back
+   * @return {ScanBackend} the backend that will actually be used
+   */
+  ScanBackend SetScanBackend(ScanBackend backend);
+
+  /**
+   * Get the scanner JsonDocument currently uses
+   * @return {ScanBackend} the active backend
+   */
+  ScanBackend GetScanBackend();
+
+  /**
+   * Self check of the scanners: index texts with escapes, strings and
+   * scalars at every offset of a block boundary with each backend the
+   * cpu supports and compare to the scalar index
+   * @return {bool} if SCALAR, SSE42 and AVX2 built the same indexes
+   */
+  bool CheckScanBackends();
+
+  /**
+   * Serialize a json value straight into a buffer (compact, like dump())
+   * @param {json} value the value to write
+   * @param {Data&} out the buffer to append to, ex: a frame Buffer()
+   */
+  void JsonWrite(const nlohmann::json &value, Data &out);
+
+  /**
+   * Serialize a json value into a message sent while it is written
+   * @param {json} value the value to write
+   * @param {WebsockStream&} out the message to append to
+   */
+  void JsonWrite(const nlohmann::json &value, WebsockStream &out);
+
+  class JsonDocument;
+
+  class JsonView {
+  /**
+   * On demand cursor into a scanned document. Nothing is parsed until a
+   * value is read, lookups walk the structural index and skip nested
+   * containers in constant time. Views borrow the document and its text.
+   */
+  public:
+    inline JsonView() {}
+    inline JsonView(const JsonDocument *doc, uint32_t pos) :
+      doc(doc), pos(pos) {}
+
+    // the value kinds, from the first character of the value
+    inline bool valid() const { return doc != nullptr; }
+    inline explicit operator bool() const { return valid(); }
+    bool isObject() const;
+    bool isArray() const;
+    bool isString() const;
+    bool isNumber() const;
+    bool isBool() const;
+    bool isNull() const;
+
+    /**
+     * Find an object member, keys are compared as written
+     * @param {string_view} key the member name
+     * @return {JsonView} the member value or an invalid view
+     */
+    JsonView find(std::string_view key) const;
+    inline JsonView operator[](std::string_view key) const {
+      return find(key);
+    }
+
+    /**
+     * Get an array element
+     * @param {size_t} index the element position
+     * @return {JsonView} the element or an invalid view
+     */
+    JsonView at(std::size_t index) const;
+
+    /**
+     * Count the members of an object or the elements of an array
+     * @return {size_t} the amount of children
+     */
+    std::size_t size() const;
+
+    /**
+     * Visit every array element or object member value
+     * @param {function} cb called with the key (empty for arrays) and value
+     */
+    void each(const std::function<void(std::string_view, JsonView)> &cb) const;
+
+    /**
+     * The text of the value exactly as received
+     * @return {string_view} the raw value including quotes and brackets
+     */
+    std::string_view raw() const;
+
+    /**
+     * Read a string value
+     * @param {string&} out the unescaped string
+     * @return {bool} if the value was a valid string
+     */
+    bool get(std::string &out) const;
+
+    /**
+     * Read an unsigned number, quoted numbers (snowflakes) are accepted
+     * @param {uint64_t&} out the number
+     * @return {bool} if the value was an unsigned integer
+     */
+    bool get(uint64_t &out) const;
+
+    /**
+     * Read a signed integer, ex: colors and counts
+     * @param {int64_t&} out the number
+     * @return {bool} if the value was an integer in range
+     */
+    bool get(int64_t &out) const;
+
+    /**
+     * Read a boolean
+     * @param {bool&} out the boolean
+     * @return {bool} if the value was true or false
+     */
+    bool get(bool &out) const;
+
+    /**
+     * Read a string value without unescaping it
+     * @return {string_view} the contents between the quotes
+     */
+    std::string_view string() const;
+
+    /**
+     * Build the full value tree of this value
+     * @return {json} the parsed value (null for invalid views)
+     */
+    nlohmann::json toJson() const;
+
+  private:
+    const JsonDocument *doc = nullptr;
+    uint32_t pos = 0; // position in the structural index
+    inline char kind() const;
+  };
+
+  class JsonDocument {
+  /**
+   * Structural index of a json text (simdjson style stage 1). The text is
+   * classified 64 bytes at a time into bitmasks of quotes, backslashes,
+   * operators and whitespace, strings are masked out with a prefix xor and
+   * the remaining structural characters and value starts are recorded.
+   * Matching brackets are linked so views skip containers in O(1).
+   * The text must outlive the document and every view of it.
+   */
+  public:
+    /**
+     * Scan a json text
+     * @param {const char*} data the text
+     * @param {size_t} len the text size
+     * @throws {invalid_argument} on unbalanced brackets or strings
+     */
+    JsonDocument(const char *data, std::size_t len);
+
+    /**
+     * Get a view of the top level value
+     * @return {JsonView} the root value or an invalid view when empty
+     */
+    inline JsonView root() const {
+      return index.empty() ? JsonView() : JsonView(this, 0);
+    }
+
+  private:
+    friend class JsonView;
+    JsonDocument(const JsonDocument&) = delete;
+    const JsonDocument& operator= (const JsonDocument&) = delete;
+
+    /**
+     * Get the index position right after a value
+     * @param {uint32_t} at the index position of the value
+     * @return {uint32_t} the position of the next structural
+     */
+    inline uint32_t skip(uint32_t at) const {
+      const char c = data[index[at]];
+      return (c == '{' || c == '[') ? match[at] + 1 : at + 1;
+    }
+
+    const char *data;
+    std::size_t len;
+    std::vector<uint32_t> index; // offsets of structurals and value starts
+    std::vector<uint32_t> match; // closing position of each opening bracket
+  };
+
+  class LazyJson {
+  /**
+   * A json value that is only turned into a tree on first access.
+   * Holds either a view into a scanned document (which must outlive it)
+   * or a tree that was already built by another decoder.
+   */
+  public:
+    inline LazyJson() : parsed(true) {}
+    inline LazyJson(JsonView view) : view(view) {}
+    inline LazyJson(nlohmann::json &&tree) :
+      tree(std::move(tree)), parsed(true) {}
+
+    // if the tree was built already
+    inline bool isParsed() const { return parsed; }
+
+    // the unparsed value (invalid once built from a tree)
+    inline const JsonView &source() const { return view; }
+
+    /**
+     * Get the value tree, parsing it the first time
+     * @return {json} the value
+     * @throws {exception} when the value is not valid json
+     */
+    inline nlohmann::json &get() {
+      if (!parsed) {
+        tree = view.toJson();
+        parsed = true;
+      }
+      return tree;
+    }
+
+  private:
+    JsonView view;
+    nlohmann::json tree;
+    bool parsed = false;
+  };
+
+}
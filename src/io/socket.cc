@@ -52,6 +52,6 @@ void io::Socket::Close(int err) {
     SSL_shutdown(ssl);
     SSL_free(ssl);
   }
-  closed = false;
+  closed = true;
   close_cb(err);
 }
\ No newline at end of file
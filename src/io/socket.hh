@@ -17,21 +17,31 @@ namespace io {
    */
   int Resolve(const char *host, int port, char *out);
 
+  // a queued write, bytes before the offset are not sent
+  struct Outgoing {
+    Data data;
+    std::size_t offset = 0;
+  };
+
   class Loop;
   class Socket {
   /** Asynchronous socket object */
   private:
     bool closed = false;                // socket fd state
-    std::deque<Data> writeQueue;        // data to be written out
+    std::deque<Outgoing> writeQueue;    // data to be written out
     std::function<void()> connect_cb;   // connect callback
     std::function<void(Data&)> read_cb; // data read callback
     std::function<void(int)> close_cb;  // close connection callback
+    std::function<void(Socket*)> accept_cb; // new connection callback
   
   public:
     int fd;                 // the socket file descriptor
     SSL *ssl = nullptr;     // the sll object for ssl connections
     Loop *loop = nullptr;   // the internal event loop
     bool connected = false; // socket connection state
+    bool paused = false;    // if reading is suspended
+    bool listening = false; // if accepting connections instead of reading
+    bool ending = false;    // if the loop deletes it once the writes are out
 
     /**
      * Initialize the socket
@@ -66,10 +76,29 @@ namespace io {
     void setConnected();
 
     /**
-     * Send data into write queue to be written
+     * Stop watching for readable data (backpressure)
+     */
+    void pause();
+
+    /**
+     * Start watching for readable data again
+     */
+    void resume();
+
+    /**
+     * Hand a buffer to the write queue without copying it
+     * @param {Data&&} data the buffer to enqueue
+     * @param {size_t} offset where the bytes to send start in the buffer
+     */
+    void Write(Data &&data, std::size_t offset = 0);
+
+    /**
+     * Send a copy of data into write queue to be written
      * @param {Data&} data the buffer to enqueue
      */
-    void Write(Data &data);
+    inline void Write(Data &data) {
+      Write(Data(data));
+    }
 
     /**
      * Send a string to the write queue
@@ -85,11 +114,15 @@ namespace io {
      * @param {size_t} len the size of the pointer data
      */
     inline void Write(const char *data, std::size_t len) {
-      Data wrapper(len);
-      std::memcpy(&wrapper[0], data, len);
-      Write(wrapper);
+      Write(Data(data, data + len));
     }
 
+    /**
+     * Stop reading and let the loop delete the socket once everything
+     * queued was written, ex: after an http response
+     */
+    void End();
+
     /**
      * Check if write queue has pending data
      * @return {bool} if write queu has remaining data
@@ -100,14 +133,27 @@ namespace io {
 
     /**
      * Fetch a pending buffer from the write queue
-     * @return {Data} the pending buffer
+     * @return {Outgoing} the pending buffer
      */
-    inline Data getBuffer() {
-      Data buffer = std::move(writeQueue.back());
+    inline Outgoing getBuffer() {
+      Outgoing buffer = std::move(writeQueue.back());
       writeQueue.pop_back();
       return buffer;
     }
 
+    /**
+     * Return a partially written buffer to the front of the line
+     * @param {Outgoing} buffer the buffer, its offset past the written bytes
+     */
+    inline void putBack(Outgoing &&buffer) {
+      writeQueue.push_back(std::move(buffer));
+    }
+
+    // perform the accept callback function
+    inline void performAccept(Socket *client) {
+      accept_cb(client);
+    }
+
     // bind connection callback
     inline void onConnect(std::function<void()> cb) {
       connect_cb = cb;
@@ -122,5 +168,10 @@ namespace io {
     inline void onClose(std::function<void(int)> cb) {
       close_cb = cb;
     }
+
+    // bind accept callback (listening sockets)
+    inline void onAccept(std::function<void(Socket*)> cb) {
+      accept_cb = cb;
+    }
   };
 }
\ No newline at end of file
@@ -0,0 +1,218 @@
+#pragma once
+
+#include "executor.hh"
+#include <coroutine>
+#include <optional>
+#include <tuple>
+
+namespace io {
+
+  template <typename T = void>
+  class Task;
+
+  template <typename T>
+  struct TaskPromiseBase {
+    /** Coroutine state shared by every Task result type */
+    std::coroutine_handle<> waiter; // coroutine awaiting this task
+    std::exception_ptr error;       // exception thrown by the body
+    bool detached = false;          // destroy on completion (Spawn)
+
+    // resume the awaiting coroutine when finished
+    struct FinalAwaiter {
+      bool await_ready() const noexcept { return false; }
+      void await_resume() const noexcept {}
+      template <typename P>
+      std::coroutine_handle<> await_suspend(
+        std::coroutine_handle<P> handle) noexcept
+      {
+        TaskPromiseBase &promise = handle.promise();
+        std::coroutine_handle<> next = promise.waiter;
+        if (promise.detached) handle.destroy();
+        return next ? next : std::noop_coroutine();
+      }
+    };
+
+    std::suspend_always initial_suspend() noexcept { return {}; }
+    FinalAwaiter final_suspend() noexcept { return {}; }
+    void unhandled_exception() {
+      error = std::current_exception();
+      if (!detached) return;
+      try {
+        std::rethrow_exception(error);
+      } catch (const std::exception &e) {
+        std::cerr << "[io] Spawned task threw: " << e.what() << std::endl;
+      } catch (...) {
+        std::cerr << "[io] Spawned task threw" << std::endl;
+      }
+    }
+  };
+
+  template <typename T>
+  struct TaskPromise : public TaskPromiseBase<T> {
+    std::optional<T> value;
+    Task<T> get_return_object();
+    void return_value(T result) { value = std::move(result); }
+    T result() {
+      if (this->error) std::rethrow_exception(this->error);
+      return std::move(*value);
+    }
+  };
+
+  template <>
+  struct TaskPromise<void> : public TaskPromiseBase<void> {
+    Task<void> get_return_object();
+    void return_void() {}
+    void result() {
+      if (this->error) std::rethrow_exception(this->error);
+    }
+  };
+
+  template <typename T>
+  class Task {
+  /**
+   * Lazily started coroutine. Runs when awaited (or spawned)
+   * and resumes the awaiting coroutine once it completes.
+   */
+  public:
+    typedef TaskPromise<T> promise_type;
+    typedef std::coroutine_handle<promise_type> Handle;
+
+    inline Task(Handle h) : handle(h) {}
+    inline Task(Task &&other) noexcept : handle(other.handle) {
+      other.handle = nullptr;
+    }
+    inline ~Task() {
+      if (handle) handle.destroy();
+    }
+
+    /** Awaiting a task starts it and waits for the result */
+    bool await_ready() const noexcept { return !handle || handle.done(); }
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> waiter) {
+      handle.promise().waiter = waiter;
+      return handle;
+    }
+    T await_resume() { return handle.promise().result(); }
+
+    /**
+     * Start the task without awaiting it, it frees itself when done
+     */
+    inline void start() {
+      Handle h = handle;
+      handle = nullptr;
+      h.promise().detached = true;
+      h.resume();
+    }
+
+  private:
+    Task(const Task&) = delete;
+    Task& operator=(const Task&) = delete;
+    Handle handle;
+  };
+
+  template <typename T>
+  inline Task<T> TaskPromise<T>::get_return_object() {
+    return Task<T>(Task<T>::Handle::from_promise(*this));
+  }
+
+  inline Task<void> TaskPromise<void>::get_return_object() {
+    return Task<void>(Task<void>::Handle::from_promise(*this));
+  }
+
+  /**
+   * Run a task in the background
+   * @param {Task} task the task to start
+   */
+  inline void Spawn(Task<void> &&task) {
+    task.start();
+  }
+
+  class Sleep {
+  /** Awaitable that resumes after a delay on the event loop */
+  public:
+    inline Sleep(Loop *loop, long delay) : loop(loop), delay(delay) {}
+    bool await_ready() const noexcept { return delay <= 0; }
+    void await_suspend(std::coroutine_handle<> waiter) {
+      loop->later(delay, [waiter]() { waiter.resume(); });
+    }
+    void await_resume() const noexcept {}
+  private:
+    Loop *loop;
+    long delay;
+  };
+
+  template <typename Sig>
+  class SignalWait {
+  /**
+   * Awaitable that resumes on the event loop with the arguments of the
+   * first emit of a signal that passes the predicate, or std::nullopt
+   * when the timeout (in ms, 0 to wait forever) expires first.
+   */
+  public:
+    typedef typename Sig::Tuple Tuple;
+    typedef typename Sig::Filter Predicate;
+
+    inline SignalWait(Emitter *events, Loop *loop,
+      Predicate predicate, long timeout)
+    {
+      state = std::make_shared<State>();
+      state->loop = loop;
+      state->events = events;
+      state->timeout = timeout;
+      state->predicate = predicate;
+    }
+
+    bool await_ready() const noexcept { return false; }
+    std::optional<Tuple> await_resume() { return std::move(state->value); }
+    void await_suspend(std::coroutine_handle<> waiter) {
+      std::shared_ptr<State> s = state;
+      s->waiter = waiter;
+
+      // listeners may run on worker threads, so finish on the loop
+      const uint lid = s->events->template on<Sig>([s](const auto&... args) {
+        if (s->done) return;
+        if (s->predicate && !s->predicate(args...)) return;
+        Tuple value(args...);
+        if (s->done.exchange(true)) return;
+        s->unsubscribe();
+        s->loop->post([s, value]() { s->finish(value); });
+      });
+
+      // the listener may have fired before its id was known
+      s->listener = lid;
+      if (s->done) s->unsubscribe();
+
+      // give up once the timeout expires
+      if (s->timeout > 0) {
+        s->loop->later(s->timeout, [s]() {
+          if (s->done.exchange(true)) return;
+          s->unsubscribe();
+          s->finish(std::nullopt);
+        });
+      }
+    }
+
+  private:
+    struct State {
+      Loop *loop;
+      Emitter *events;
+      long timeout;
+      std::atomic<uint> listener{0};
+      Predicate predicate;
+      std::optional<Tuple> value;
+      std::atomic<bool> done{false};
+      std::coroutine_handle<> waiter;
+
+      // remove the listener once, from whoever completes the wait
+      void unsubscribe() {
+        const uint lid = listener.exchange(0);
+        if (lid != 0) events->remove(lid);
+      }
+
+      void finish(std::optional<Tuple> result) {
+        value = std::move(result);
+        waiter.resume();
+      }
+    };
+    std::shared_ptr<State> state;
+  };
+}
@@ -1,6 +1,7 @@
 #include "ws.hh"
 #include <random>
 #include <bitset>
+#include <algorithm>
 
 // random byte generation
 static std::random_device RNG;
@@ -27,107 +28,67 @@ static inline unsigned char randByte() {
 }
 
 /**
- * Calculate the dumped size of a frame
- * @param {Frame*} frame the frame to calculate
- * @return {size_t} the size of the dumped frame
+ * Parse a websocket frame header
+ * @param {Frame*} frame the frame to fill, the payload is left unset
+ * @param {unsigned char*} mask filled with the masking key if masked
+ * @param {const char*} data the received bytes
+ * @param {size_t} len the amount of received bytes
+ * @return {size_t} the header size or 0 if the header is incomplete
  */
-static inline size_t FrameSize(io::Frame *frame) {
-  size_t i = 2 + (frame->masked ? 4 : 0) + frame->len;
-  if (frame->len >= 126 && frame->len < 65536) i += 2;
-  else if (frame->len >= 0x10000) i += 8;
-  return i;
-}
+static std::size_t FrameHeader(io::Frame *frame, unsigned char *mask,
+  const char *data, std::size_t len)
+{
+  const unsigned char *in = (const unsigned char*)data;
+  std::size_t offset = 2, count = 0;
+  if (len < offset) return 0;
 
-/**
- * Parse data into websocket frame
- * @param {Frame*} frame the frame to fill with parsed info
- * @param {const char*} data the data to parse
- * @param {size_t} len the size of the data to parse
- */
-static void FrameParse(io::Frame *frame, const char *data, size_t len) {
-  // create variables and empty out current
-  std::size_t offset = 0;
-  int i, size, count = 0;
-  std::memset(frame, 0, sizeof(*frame));
-  
   // get frame first byte header info
-  frame->fin  = (data[offset] & 0x80) != 0 ? 1 : 0;
-  frame->rsv1 = (data[offset] & 0x40) != 0 ? 1 : 0;
-  frame->rsv2 = (data[offset] & 0x20) != 0 ? 1 : 0;
-  frame->rsv3 = (data[offset] & 0x10) != 0 ? 1 : 0;
-  frame->opcode = data[offset++] & 0x0f;
-  
+  frame->fin  = (in[0] & 0x80) != 0 ? 1 : 0;
+  frame->rsv1 = (in[0] & 0x40) != 0 ? 1 : 0;
+  frame->rsv2 = (in[0] & 0x20) != 0 ? 1 : 0;
+  frame->rsv3 = (in[0] & 0x10) != 0 ? 1 : 0;
+  frame->opcode = in[0] & 0x0f;
+
   // get frame masked state and payload length
-  frame->masked = (data[offset] & 0x80) != 0 ? 1 :0;
-  size = (int)(data[offset++] & (~0x80));
+  frame->masked = (in[1] & 0x80) != 0 ? 1 : 0;
+  uint64_t size = in[1] & 0x7f;
   if (size == 0x7f) count = 8;
   else if (size == 0x7e) count = 2;
+  if (len < offset + count + (frame->masked ? 4 : 0)) return 0;
   if (count > 0) size = 0;
   while (count-- > 0)
-    size |= (data[offset++] & 0xff) << (8 * count);
+    size = (size << 8) | in[offset++];
   frame->len = (std::size_t)size;
-  
+  frame->data = nullptr;
+
   // if masked, get mask from frame
-  char mask[4];
-  if (frame->masked)
-    for (i = 0; i < 4; i++)
-      mask[i] = data[offset++];
-  
-  // allocate frame payload
-  free(frame->data);
-  frame->data = (char*)std::calloc(
-    size + 1, sizeof(char*));
-
-  // get payload and mask it if neccessary
-  for (i = 0; i < size; i++)
-    frame->data[i] = !frame->masked ? data[offset + i]
-      : data[offset + i] ^ mask[i % 4];
-}
-
-/**
- * Dump websocket frame into data to send out
- * @param {Frame*} frame the frame to dump from
- * @param {char*} out the output of the dumped frame
- */
-static void FrameDump(io::Frame *frame, char *out) {
-  int i;                  // iteration variables
-  std::size_t offset = 0; // calculation variables
-  
-  // set first header byte
-  out[offset] = (char)(frame->fin ? 0x80 : 0);
-  out[offset] |= (frame->rsv1 ? 0x40 : 0);
-  out[offset] |= (frame->rsv2 ? 0x20 : 0);
-  out[offset] |= (frame->rsv3 ? 0x10 : 0);
-  out[offset++] |= (char)frame->opcode;
-    
-  // set second header byte
-  char masked = (char)(frame->masked ? 0x80 : 0);
-  if (frame->len <= 125) {
-    out[offset++] = (char)(masked | frame->len);
-  } else if (frame->len >= 126 && frame->len < 65536) {
-    out[offset++] = (char)(masked | 0x7e);
-    for (i = 8; i >= 0; i -= 8)
-      out[offset++] = (char)((frame->len >> i) & 0xff);
-  } else {
-    out[offset++] = (char)(masked | 0x7f);
-    for (i = 56; i >= 0; i -= 8)
-      out[offset++] = (char)((frame->len >> i) & 0xff);
-  }
-  
-  // if frame masked, create mask
-  std::vector<unsigned char> mask;
   if (frame->masked) {
-    mask.reserve(4);
-    for (i = 0; i < 4; i++) {
-      mask[i] = randByte();
-      out[offset++] = mask[i];
-    }
+    std::memcpy(mask, in + offset, 4);
+    offset += 4;
+  }
+  return offset;
+}
+
+/**
+ * Mask a payload in place, a word at a time
+ * @param {char*} data the payload
+ * @param {size_t} len the payload size
+ * @param {const unsigned char*} mask the 4 mask bytes
+ */
+static inline void MaskPayload(char *data, std::size_t len,
+  const unsigned char *mask)
+{
+  std::size_t i = 0;
+  uint64_t word, key;
+  std::memcpy(&key, mask, 4);
+  std::memcpy((char*)&key + 4, mask, 4);
+  for (; i + 8 <= len; i += 8) {
+    std::memcpy(&word, data + i, 8);
+    word ^= key;
+    std::memcpy(data + i, &word, 8);
   }
-  
-  // add payload data
-  for (i = 0; i < (signed)frame->len; i++)
-    out[offset + i] = (char)(!frame->masked ?
-      frame->data[i] : (frame->data[i] ^ mask[i % 4]));
+  for (; i < len; i++)
+    data[i] ^= mask[i % 4];
 }
 
 /**
@@ -136,34 +97,348 @@ static void FrameDump(io::Frame *frame, char *out) {
  * @param {std::string} reason the close status reason
  */
 void io::WebsockClient::Close(int status, const std::string &reason) {
-  if (sock != nullptr) {
-    delete sock;
+  if (sock == nullptr || closing) return;
+
+  // reserved statuses never go on the wire
+  if (!connected || status == 1005 || status == 1006 || status == 1015) {
+    Finish(status, reason);
+    return;
   }
+
+  // status then reason, control frames hold at most 125 bytes
+  io::Data frame = Buffer(2 + reason.size());
+  frame.push_back((char)((status >> 8) & 0xff));
+  frame.push_back((char)(status & 0xff));
+  frame.insert(frame.end(), reason.begin(),
+    reason.begin() + std::min<std::size_t>(reason.size(), 123));
+  SendFrame(std::move(frame), io::Opcode::CLOSE, true);
+  closing = true;
+  connected = false;
+  closeStatus = status;
+  closeReason = reason;
+
+  // stop waiting for an answer that does not come
+  const unsigned gen = timerGen;
+  io::WebsockClient *self = this;
+  loop->later(closeTimeout, [self, gen](){
+    if (gen == self->timerGen && self->closing)
+      self->Finish(self->closeStatus, self->closeReason);
+  });
+}
+
+/**
+ * Drop the socket and report the close
+ * @param {int} status the close status
+ * @param {std::string} reason the close reason
+ */
+void io::WebsockClient::Finish(int status, std::string reason) {
+  Detach();
   close_cb(status, reason);
 }
 
+/**
+ * Delete the socket without it reporting the close again
+ */
+void io::WebsockClient::Detach() {
+  io::Socket *old = sock;
+  sock = nullptr;
+  connected = false;
+  closing = false;
+  pinged = false;
+  timerGen++;
+  if (old == nullptr) return;
+  old->onClose([](int err){});
+  delete old;
+}
+
+/**
+ * Parse every complete frame of the received bytes. Frames are read
+ * where they arrived and only an unfinished one is kept for the next read.
+ * @param {Data&} data the bytes read from the socket
+ */
+void io::WebsockClient::Receive(io::Data &data) {
+  io::Data *in = &data;
+  if (!pending.empty()) {
+    pending.insert(pending.end(), data.begin(), data.end());
+    in = &pending;
+  }
+
+  // stop once a callback closes the connection
+  io::Socket *current = sock;
+  std::size_t offset = 0;
+  while (sock == current && offset < in->size()) {
+    io::Frame frame;
+    unsigned char mask[4];
+    char *start = in->data() + offset;
+    const std::size_t left = in->size() - offset;
+    const std::size_t header = FrameHeader(&frame, mask, start, left);
+    if (header == 0) break;
+
+    // refuse oversized messages before buffering them
+    const std::size_t total = frame.len +
+      (frame.opcode == io::Opcode::CONT ? message.size() : 0);
+    // (its payload is never read, so the answer cannot be awaited)
+    if (maxMessageSize > 0 && total > maxMessageSize) {
+      Close(1009, "message too big");
+      Finish(1009, "message too big");
+      return;
+    }
+    if (left - header < frame.len) break;
+
+    frame.data = start + header;
+    if (frame.masked)
+      MaskPayload(frame.data, frame.len, mask);
+    offset += header + frame.len;
+    Dispatch(frame, in->size() - offset);
+  }
+
+  // keep the unfinished frame
+  if (sock != current) return;
+  if (in == &pending)
+    pending.erase(pending.begin(), pending.begin() + offset);
+  else pending.assign(data.begin() + offset, data.end());
+}
+
+/**
+ * Handle one complete frame. Fragments are collected in a single buffer
+ * sized from the first fragment and everything received behind it, the
+ * finished message is delivered as a view of that buffer.
+ * @param {Frame&} frame the frame, its payload already unmasked
+ * @param {size_t} buffered bytes received after the frame
+ */
+void io::WebsockClient::Dispatch(io::Frame &frame, std::size_t buffered) {
+  // control frames may arrive between the fragments of a message
+  if (frame.opcode == io::Opcode::CLOSE) {
+    int status = 1005;
+    std::string reason;
+    if (frame.len >= 2) {
+      status = ((unsigned char)frame.data[0] << 8) |
+        (unsigned char)frame.data[1];
+      reason.assign(frame.data + 2, frame.len - 2);
+    }
+
+    // the server answered our close
+    if (closing) {
+      Finish(closeStatus, closeReason);
+      return;
+    }
+
+    // answer with the same status, then drop the connection
+    io::Data echo = Buffer(2);
+    if (frame.len >= 2)
+      echo.insert(echo.end(), frame.data, frame.data + 2);
+    SendFrame(std::move(echo), io::Opcode::CLOSE, true);
+    Finish(status, reason);
+    return;
+  }
+
+  // answer pings with their payload
+  if (frame.opcode == io::Opcode::PING) {
+    io::Data pong = Buffer(frame.len);
+    pong.insert(pong.end(), frame.data, frame.data + frame.len);
+    SendFrame(std::move(pong), io::Opcode::PONG, true);
+    return;
+  }
+
+  // only the pong of the last ping counts for the round trip
+  if (frame.opcode == io::Opcode::PONG) {
+    if (pinged && frame.len == sizeof(pingSeq) &&
+      std::memcmp(frame.data, &pingSeq, sizeof(pingSeq)) == 0)
+    {
+      pinged = false;
+      latency = (long)std::chrono::duration_cast<std::chrono::milliseconds>(
+        io::Clock::now() - pingSent).count();
+    }
+    return;
+  }
+  if (frame.opcode > io::Opcode::CLOSE || closing) return;
+
+  // whole messages are delivered straight from the receive buffer
+  if (frame.fin && frame.opcode != io::Opcode::CONT) {
+    message_cb(frame);
+    return;
+  }
+
+  // first fragment, continuations without one are dropped
+  if (frame.opcode != io::Opcode::CONT) {
+    std::size_t hint = frame.len + buffered;
+    if (maxMessageSize > 0) hint = std::min(hint, maxMessageSize);
+    message.clear();
+    message.reserve(hint);
+    messageOpcode = frame.opcode;
+  } else if (messageOpcode == 0) return;
+  message.insert(message.end(), frame.data, frame.data + frame.len);
+  if (!frame.fin) return;
+
+  // deliver the reassembled message
+  frame.opcode = messageOpcode;
+  frame.data = message.data();
+  frame.len = message.size();
+  messageOpcode = 0;
+  message_cb(frame);
+
+  // do not hold on to the memory of an unusually large message
+  if (message.capacity() > (1 << 20)) io::Data().swap(message);
+  else message.clear();
+}
+
 /**
  * Send data over the websocket
  * @param {std::string} data the data to send
  * @param {unsigned} opcode the opcode to use
  */
 void io::WebsockClient::Send(const std::string &data, unsigned opcode) {
-  // create the frame
-  io::Frame frame = { 0 };
-  frame.fin    = 1;
-  frame.masked = 1;
-  frame.opcode = opcode;
-  frame.data   = (char*)data.c_str();
-  frame.len    = std::strlen(frame.data);
+  io::Data frame = Buffer(data.size());
+  frame.insert(frame.end(), data.begin(), data.end());
+  Send(std::move(frame), opcode);
+}
+
+/**
+ * Send a payload serialized into a Buffer() without copying it.
+ * Payloads over fragmentSize are copied into a fragmented message,
+ * serialize large payloads into a Stream() to skip the copy.
+ * @param {Data&&} frame the buffer with the payload after the header room
+ * @param {unsigned} opcode the opcode to use
+ */
+void io::WebsockClient::Send(io::Data &&frame, unsigned opcode) {
+  if (sock == nullptr || frame.size() < FRAME_HEADROOM) return;
+  const std::size_t len = frame.size() - FRAME_HEADROOM;
+  if (fragmentSize > 0 && len > fragmentSize) {
+    WebsockStream stream = Stream(opcode);
+    stream.write(&frame[FRAME_HEADROOM], len);
+    return;
+  }
+  SendFrame(std::move(frame), opcode, true);
+}
+
+/**
+ * Write a frame built in a Buffer()
+ * @param {Data&&} frame the buffer with the payload after the header room
+ * @param {unsigned} opcode the frame opcode
+ * @param {bool} fin if this is the last frame of the message
+ */
+void io::WebsockClient::SendFrame(io::Data &&frame, unsigned opcode,
+  bool fin)
+{
+  if (sock == nullptr || closing || frame.size() < FRAME_HEADROOM) return;
+  const std::size_t len = frame.size() - FRAME_HEADROOM;
+  const std::size_t extended = len > 0xffff ? 8 : len > 125 ? 2 : 0;
+  const std::size_t start = FRAME_HEADROOM - (2 + extended + 4);
+  char *out = &frame[start];
+
+  // fin bit and opcode, then the masked length
+  *out++ = (char)((fin ? 0x80 : 0) | (opcode & 0x0f));
+  if (extended == 0) {
+    *out++ = (char)(0x80 | len);
+  } else {
+    *out++ = (char)(0x80 | (extended == 2 ? 0x7e : 0x7f));
+    for (int i = (int)extended - 1; i >= 0; i--)
+      *out++ = (char)((len >> (8 * i)) & 0xff);
+  }
+
+  // client frames are masked with a random key
+  const uint32_t key = (uint32_t)Rand();
+  unsigned char mask[4];
+  std::memcpy(mask, &key, 4);
+  std::memcpy(out, mask, 4);
+  MaskPayload(&frame[FRAME_HEADROOM], len, mask);
+  sock->Write(std::move(frame), start);
+}
+
+/**
+ * Send the next ping or close when the last one went unanswered
+ * @param {unsigned} gen the schedule the timer belongs to
+ */
+void io::WebsockClient::Ping(unsigned gen) {
+  if (gen != timerGen || !connected) return;
+
+  // an unread pong does not count while reading is paused
+  io::WebsockClient *self = this;
+  if (pinged && !sock->paused) {
+    std::cerr << "[io] Websocket ping unanswered, closing" << std::endl;
+
+    // closing deletes the socket, urgent tasks run between the socket
+    // events of a batch so wait until the loop is done with them
+    loop->post([self, gen](){
+      if (gen == self->timerGen) self->Close(1006, "ping timeout");
+    });
+    return;
+  }
 
-  // convert frame to transferable data
-  char buffer[FrameSize(&frame)] = { 0 };
-  FrameDump(&frame, buffer);
-  io::Data output(buffer, buffer + sizeof(buffer));
+  // the payload identifies the ping, stale pongs are ignored
+  if (!pinged) {
+    pingSeq++;
+    io::Data ping = Buffer(sizeof(pingSeq));
+    const char *seq = (const char*)&pingSeq;
+    ping.insert(ping.end(), seq, seq + sizeof(pingSeq));
+    SendFrame(std::move(ping), io::Opcode::PING, true);
+    pinged = true;
+    pingSent = io::Clock::now();
+  }
+  loop->urgent(pingInterval, [self, gen](){
+    self->Ping(gen);
+  });
+}
+
+/**
+ * Start a fragmented message
+ * @param {WebsockClient} ws the connection to send on
+ * @param {unsigned} opcode the message opcode
+ * @param {size_t} fragment payload bytes per frame
+ */
+io::WebsockStream::WebsockStream(io::WebsockClient *ws, unsigned opcode,
+  std::size_t fragment) : ws(ws), opcode(opcode), fragment(fragment)
+{
+  frame = io::WebsockClient::Buffer(fragment);
+}
+
+// take over an unfinished message
+io::WebsockStream::WebsockStream(io::WebsockStream &&other) noexcept :
+  ws(other.ws), opcode(other.opcode), fragment(other.fragment),
+  started(other.started), total(other.total), frame(std::move(other.frame))
+{
+  other.ws = nullptr;
+}
+
+/**
+ * Append payload bytes, sending every full fragment
+ * @param {const char*} data the bytes
+ * @param {size_t} len the amount of bytes
+ */
+void io::WebsockStream::write(const char *data, std::size_t len) {
+  if (ws == nullptr) return;
+  total += len;
+  while (len > 0) {
+    // a full fragment is only sent once more data follows it,
+    // the final frame needs the fin bit
+    if (frame.size() == FRAME_HEADROOM + fragment)
+      flush(false);
+    const std::size_t take =
+      std::min(FRAME_HEADROOM + fragment - frame.size(), len);
+    frame.insert(frame.end(), data, data + take);
+    data += take;
+    len -= take;
+  }
+}
 
-  // send data over socket
-  if (sock != nullptr)
-    sock->Write(output);
+/**
+ * Send the buffered bytes as the final frame
+ */
+void io::WebsockStream::end() {
+  if (ws == nullptr) return;
+  flush(true);
+  ws = nullptr;
+}
+
+/**
+ * Send the buffered fragment
+ * @param {bool} fin if this is the last frame of the message
+ */
+void io::WebsockStream::flush(bool fin) {
+  const unsigned code = started ? io::Opcode::CONT : opcode;
+  ws->SendFrame(std::move(frame), code, fin);
+  started = true;
+  if (!fin) frame = io::WebsockClient::Buffer(fragment);
 }
 
 /**
@@ -176,54 +451,56 @@ bool io::WebsockClient::Connect(const std::string &url) {
   sock = loop->spawn(uri);
   if (sock == nullptr) return false;
 
-  // builders and frame variabels
-  io::Data builder;
-  io::Frame frame = { 0 };
+  // start a new stream of frames
+  pending.clear();
+  message.clear();
+  messageOpcode = 0;
+  connected = false;
+  pinged = false;
+  latency = -1;
+  timerGen++;
+
+  // the loop deletes sockets that fail, forget it and report the drop
+  sock->onClose([this](int err) {
+    const bool closing = this->closing;
+    const std::string reason = closing ? this->closeReason : "";
+    this->sock = nullptr;
+    this->connected = false;
+    this->closing = false;
+    this->timerGen++;
+    this->close_cb(closing ? this->closeStatus : 1006, reason);
+  });
 
   // handle coming from the websocket
-  sock->onRead([this, &builder, &frame](io::Data &data) {
-
-    // handle handshake response
-    if (!this->connected) {
-      std::string http(data.begin(), data.end());
-      if (http.find("HTTP/1.1 101") != std::string::npos) {
-        this->connected = true;
-        this->connect_cb();
-      } else this->Close(1005, "");
-
-    // handle websocket frames
-    } else {
-
-      FrameParse(&frame, &data[0], data.size());
-
-      // handle nont continuation frams
-      if (frame.fin && frame.opcode != io::Opcode::CONT) {
-
-        // close on opcode
-        if (frame.opcode == io::Opcode::CLOSE) {
-          this->Close(1000, "");
-          return;
-        }
-
-        // combine the builder data and the received data
-        io::Data merged(frame.len + builder.size());
-        merged.insert(merged.begin(), &builder[0],
-          &builder[0] + builder.size());
-        merged.insert(merged.begin() + builder.size(),
-          frame.data, frame.data + frame.len);
-        frame.len = merged.size();
-        memcpy(frame.data, &merged[0], frame.len);
-
-        // perform message callback and clear builder
-        this->message_cb(frame);
-        builder.clear();
-
-      // packet is continuation, add data to builder
-      } else {
-        builder.insert(builder.end(),
-          frame.data, frame.data + frame.len);
-      }
+  sock->onRead([this](io::Data &data) {
+
+    // handle websocket frames, also while our close awaits its answer
+    if (this->connected || this->closing) {
+      this->Receive(data);
+      return;
+    }
+
+    // handle handshake response, frames may follow it in the same read
+    const char *end = "\r\n\r\n";
+    auto body = std::search(data.begin(), data.end(), end, end + 4);
+    std::string http(data.begin(), body);
+    if (http.find("HTTP/1.1 101") == std::string::npos) {
+      this->Close(1005, "");
+      return;
+    }
+    this->connected = true;
+    if (this->pingInterval > 0) {
+      const unsigned gen = this->timerGen;
+      io::WebsockClient *self = this;
+      this->loop->urgent(this->pingInterval, [self, gen](){
+        self->Ping(gen);
+      });
     }
+    io::Socket *current = this->sock;
+    this->connect_cb();
+    if (this->sock != current || body == data.end()) return;
+    io::Data rest(body + 4, data.end());
+    if (!rest.empty()) this->Receive(rest);
   });
 
   // create websocket sec-key for handshake
@@ -1,6 +1,6 @@
 #pragma once
 
-#include "loop.hh"
+#include "ipc.hh"
 
 namespace io {
 
@@ -15,6 +15,9 @@ namespace io {
     static const unsigned PONG  = 0x0a;
   };
 
+  // room for the largest client frame header (2 + 8 length + 4 mask)
+  static const std::size_t FRAME_HEADROOM = 14;
+
   /* Websocket Frame container */
   typedef struct Frame {
     unsigned fin;    // 0 or 1 (bool) if frame fin
@@ -26,31 +29,136 @@ namespace io {
     unsigned rsv2;
     unsigned rsv3;
     
-    char *data; // frame payload data
+    char *data; // frame payload, points into the receive buffers
     size_t len; // frame payload length
   } Frame;
 
+  class WebsockClient;
+  class WebsockStream {
+  /**
+   * Outgoing message written in pieces. Whenever a fragment worth of
+   * bytes is buffered it goes out as its own frame (continuation frames
+   * after the first), so memory stays bounded by the fragment size and
+   * the first bytes are on the wire while the rest is still produced.
+   * The message is finished by end() or when the stream is destroyed.
+   * While a stream is open no other data frame may be sent on the
+   * connection (the peer would read it as part of this message), only
+   * control frames (ping, pong, close) may be interleaved.
+   */
+  public:
+    WebsockStream(WebsockStream &&other) noexcept;
+    inline ~WebsockStream() { end(); }
+
+    /**
+     * Append payload bytes
+     * @param {const char*} data the bytes
+     * @param {size_t} len the amount of bytes
+     */
+    void write(const char *data, std::size_t len);
+    inline void write(const std::string &data) {
+      write(data.data(), data.size());
+    }
+
+    // append a single byte, ex: from a serializer
+    inline void put(char c) {
+      if (ws == nullptr) return;
+      if (frame.size() == FRAME_HEADROOM + fragment) flush(false);
+      frame.push_back(c);
+      total++;
+    }
+
+    // payload bytes written so far
+    inline std::size_t size() const { return total; }
+
+    /**
+     * Send the buffered bytes as the final frame
+     */
+    void end();
+
+  private:
+    friend class WebsockClient;
+    WebsockStream(WebsockClient *ws, unsigned opcode, std::size_t fragment);
+    WebsockStream(const WebsockStream&) = delete;
+    WebsockStream& operator= (const WebsockStream&) = delete;
+    void flush(bool fin);
+
+    WebsockClient *ws;     // the connection, nullptr once ended
+    unsigned opcode;       // the message opcode
+    std::size_t fragment;  // payload bytes per frame
+    bool started = false;  // if the first frame went out
+    std::size_t total = 0; // payload bytes written
+    Data frame;            // the frame being filled
+  };
+
   class WebsockClient {
   /**
    * Websocket client class
    */
   private:
+    friend class WebsockStream;
     Loop *loop;             // the internal event loop
-    Socket *sock;           // the internal socket object
+    Socket *sock = nullptr; // the internal socket object
     bool connected = false; // websocket connection state
 
+    // incoming frame state
+    Data pending;                // start of a frame that arrived partially
+    Data message;                // fragments of the message being received
+    unsigned messageOpcode = 0;  // opcode of that message, 0 if none
+
+    // close handshake state
+    bool closing = false;        // if our close frame awaits its answer
+    int closeStatus = 0;         // the status we closed with
+    std::string closeReason;     // the reason we closed with
+
+    // client ping state
+    unsigned timerGen = 0;       // connection the timers belong to
+    uint64_t pingSeq = 0;        // payload of the last ping
+    bool pinged = false;         // if the last ping is unanswered
+    TimeStamp pingSent;          // when the last ping was sent
+
+    // write a frame built in a Buffer()
+    void SendFrame(Data &&frame, unsigned opcode, bool fin);
+
+    // parse every complete frame of the received bytes
+    void Receive(Data &data);
+
+    // handle one complete frame
+    void Dispatch(Frame &frame, std::size_t buffered);
+
+    // drop the socket without reporting its close again
+    void Detach();
+
+    // drop the socket and report the close
+    void Finish(int status, std::string reason);
+
+    // send the next ping or close when the last one went unanswered
+    void Ping(unsigned gen);
+
     // websocket callbacks
     std::function<void()> connect_cb;
     std::function<void(Frame&)> message_cb;
     std::function<void(int, std::string)> close_cb;
   
   public:
+    // split sends larger than this into fragments (0 to never split)
+    std::size_t fragmentSize = 0;
+
+    // close with 1009 on messages larger than this (0 for no limit)
+    std::size_t maxMessageSize = 64 << 20;
+
+    // ping the server this often in ms and close the connection when the
+    // previous ping is still unanswered (0 to only answer server pings)
+    long pingInterval = 0;
+
+    // ms to wait for the server to answer a close frame
+    long closeTimeout = 2000;
+
+    // last ping round trip in ms (-1 if none)
+    long latency = -1;
+
     // close the websocket when client is killed
     inline ~WebsockClient() {
-      if (sock != nullptr)
-        delete sock;
-      sock = nullptr;
-      connected = false;
+      Detach();
     }
 
     /** Connection State accessor */
@@ -74,8 +182,11 @@ namespace io {
     bool Connect(const std::string &url);
 
     /**
-     * Close the websocket connection
-     * @param {int} status the websocket opcode status
+     * Close the websocket connection. A close frame is sent and the
+     * connection dropped once the server answers it (or closeTimeout
+     * passes), then onClose reports the status. Reserved statuses
+     * (1005, 1006, 1015) drop the connection without a close frame.
+     * @param {int} status the websocket close status
      * @param {std::string} reason the websocket close reason
      */
     void Close(int status, const std::string &reason);
@@ -88,17 +199,61 @@ namespace io {
     void Send(const std::string &data,
       unsigned opode = Opcode::TEXT);
 
+    /**
+     * Send a payload serialized into a Buffer() without copying it, the
+     * header is written in front and the payload is masked in place
+     * @param {Data&&} frame the buffer with the payload after the header room
+     * @param {unsigned} opcode the opcode to use
+     */
+    void Send(Data &&frame, unsigned opcode = Opcode::TEXT);
+
+    /**
+     * Start a message that is sent in fragments while it is written
+     * @param {unsigned} opcode the message opcode
+     * @param {size_t} fragment payload bytes per frame (0 for fragmentSize)
+     * @return {WebsockStream} the stream to write the message into
+     */
+    inline WebsockStream Stream(unsigned opcode = Opcode::TEXT,
+      std::size_t fragment = 0)
+    {
+      if (fragment == 0) fragment = fragmentSize;
+      return WebsockStream(this, opcode, fragment == 0 ? 16384 : fragment);
+    }
+
+    /**
+     * Create a buffer to serialize an outgoing payload into
+     * @param {size_t} reserve the expected payload size
+     * @return {Data} a buffer holding only the frame header room
+     */
+    static inline Data Buffer(std::size_t reserve = 0) {
+      Data frame(FRAME_HEADROOM);
+      frame.reserve(FRAME_HEADROOM + reserve);
+      return frame;
+    }
+
+    /** Stop reading incoming frames until resumed */
+    inline void Pause() {
+      if (sock != nullptr) sock->pause();
+    }
+
+    /** Continue reading incoming frames */
+    inline void Resume() {
+      if (sock != nullptr) sock->resume();
+    }
+
     // bind connection callback
     inline void onConnect(std::function<void()> cb) {
       connect_cb = cb;
     }
 
-    // bind text or binary frame callback
+    // bind text or binary message callback, fragmented messages arrive
+    // reassembled and the payload is only valid during the callback
     inline void onMessage(std::function<void(Frame&)> cb) {
       message_cb = cb;
     }
 
-    // bind close callback
+    // bind close callback, called with the status the server closed with
+    // or the one passed to Close() (1006 when the connection was lost)
     inline void onClose(std::function<void(int, std::string)> cb) {
       close_cb = cb;
     }
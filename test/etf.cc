@@ -0,0 +1,71 @@
+#include "test.hh"
+#include "cda/cda.hh"
+
+/**
+ * Encode and decode a value like a gateway packet would travel
+ * @param {json} value the value to send
+ * @return {json} the value as the gateway decodes it
+ */
+static io::json roundTrip(const io::json &value) {
+  const std::string payload = io::EtfEncode(value);
+  return io::EtfDecode(payload.data(), payload.size());
+}
+
+/**
+ * Hand an ETF packet to a shard like the websocket would
+ * @param {Gateway} shard the receiving shard
+ * @param {json} packet the gateway packet
+ */
+static void receive(cda::Gateway &shard, const io::json &packet) {
+  std::string payload = io::EtfEncode(packet);
+  io::Frame frame = {};
+  frame.opcode = io::Opcode::BIN;
+  frame.data = &payload[0];
+  frame.len = payload.size();
+  shard.handle(frame);
+}
+
+int main() {
+  // HELLO and dispatch sequences past a small integer
+  io::json hello = roundTrip({{"op", 10}, {"s", nullptr},
+    {"d", {{"heartbeat_interval", 41250}}}});
+  CHECK(hello["op"].is_number_unsigned() && hello["op"] == 10);
+  CHECK(hello["d"]["heartbeat_interval"].is_number_unsigned());
+  CHECK(hello["d"]["heartbeat_interval"] == 41250);
+  CHECK(hello["s"].is_null());
+  for (uint64_t s : {1ULL, 255ULL, 256ULL, 70000ULL, 0x7fffffffULL,
+    0x80000000ULL}) {
+    io::json packet = roundTrip({{"op", 0}, {"s", s}});
+    CHECK(packet["s"].is_number_unsigned() && packet["s"] == s);
+  }
+
+  // snowflakes as strings (like discord) and as big integers
+  io::json guild = roundTrip({{"id", "41771983423143937"},
+    {"owner_id", 41771983423143937ULL}});
+  CHECK(cda::toId(guild["id"]) == 41771983423143937ULL);
+  CHECK(guild["owner_id"].is_number_unsigned());
+  CHECK(cda::toId(guild["owner_id"]) == 41771983423143937ULL);
+
+  // negative values stay signed
+  io::json negative = roundTrip({{"a", -5}, {"b", -100000},
+    {"c", -(int64_t)(1LL << 40)}});
+  CHECK(negative["a"] == -5 && negative["b"] == -100000);
+  CHECK(negative["c"] == -(int64_t)(1LL << 40));
+
+  // a shard in etf mode starts heartbeating and records sequences
+  cda::Client client;
+  client.etf = true;
+  cda::Gateway shard(0, 1, &client);
+  receive(shard, {{"op", 10}, {"s", nullptr},
+    {"d", {{"heartbeat_interval", 41250}}}});
+  CHECK(shard.hello && shard.beatInter == 41150);
+  receive(shard, {{"op", 0}, {"s", 300}, {"t", "TYPING_START"},
+    {"d", io::json::object()}});
+  CHECK(shard.seq == 300);
+  io::json signedSeq = {{"op", 0}, {"t", "TYPING_START"},
+    {"d", io::json::object()}};
+  signedSeq["s"] = (int64_t)301;
+  receive(shard, signedSeq);
+  CHECK(shard.seq == 301);
+  return 0;
+}
@@ -0,0 +1,68 @@
+#include "test.hh"
+#include "cda/cda.hh"
+#include "cda/fake.hh"
+#include <atomic>
+
+static const cda::snowflake GUILD = 41771983423143937ULL;
+
+/**
+ * Check the shard identified and cached the guilds listed in READY
+ * @param {Client} client the client under test
+ * @param {FakeGateway} gateway the gateway it connected to
+ * @return {int} 0 if every check passed
+ */
+static int identified(cda::Client &client, cda::FakeGateway &gateway) {
+  CHECK(gateway.identifies == 1 && gateway.sessions(0) == 1);
+  std::shared_ptr<cda::Guild> guild = client.getGuild(GUILD);
+  CHECK(guild.get() != nullptr && guild->unavailable);
+  return 0;
+}
+
+/**
+ * Check the dispatched GUILD_CREATE reached the cache and the listener
+ * @param {Client} client the client under test
+ * @param {int} created members of the guild the listener got
+ * @return {int} 0 if every check passed
+ */
+static int cached(cda::Client &client, int created) {
+  std::shared_ptr<cda::Guild> guild = client.getGuild(GUILD);
+  CHECK(guild.get() != nullptr && !guild->unavailable);
+  CHECK(guild->name == io::StringPool::global().get("test"));
+  CHECK(guild->getMember(7).get() != nullptr);
+  CHECK(guild->getMember(7)->user->username
+    == io::StringPool::global().get("a"));
+  CHECK(created == 1);
+  return 0;
+}
+
+int main() {
+  cda::Client client;
+  io::Loop *loop = client.loop;
+  cda::FakeGateway gateway(loop);
+  CHECK(gateway.listen());
+  gateway.guilds = {GUILD};
+
+  std::atomic<int> created{-1};
+  client.onGuildCreate([&created](const std::shared_ptr<cda::Guild> &g) {
+    created = (int)g->members.size();
+  });
+  client.launch(gateway.url(), 1, 0, 1);
+
+  int result = 1;
+  loop->later(1000, [&]() {
+    if ((result = identified(client, gateway)) != 0) return loop->quit();
+    gateway.dispatch(0, "GUILD_CREATE", {
+      {"id", std::to_string(GUILD)}, {"name", "test"}, {"large", false},
+      {"unavailable", false}, {"roles", io::json::array()},
+      {"channels", io::json::array()},
+      {"members", {{{"roles", io::json::array()},
+        {"user", {{"id", "7"}, {"username", "a"}}}}}}
+    });
+  });
+  loop->later(1500, [&]() {
+    if (result == 0) result = cached(client, created);
+    loop->quit();
+  });
+  loop->run();
+  return result;
+}
@@ -0,0 +1,61 @@
+#include "test.hh"
+
+// every backend the cpu supports, the scalar one first
+static const io::ScanBackend Backends[] = {
+  io::ScanBackend::SCALAR, io::ScanBackend::SSE42, io::ScanBackend::AVX2
+};
+
+/**
+ * Look values up in a document with the active backend
+ * @param {string} text the json text
+ * @return {int} 0 if every lookup matched the tree parser
+ */
+static int lookups(const std::string &text) {
+  const io::json tree = io::json::parse(text);
+  io::JsonDocument doc(text.data(), text.size());
+  io::JsonView root = doc.root();
+  CHECK(root.isObject() && root.size() == tree.size());
+  CHECK(root.toJson() == tree);
+
+  std::string name;
+  CHECK(root["name"].get(name) && name == tree["name"]);
+  uint64_t id;
+  CHECK(root["id"].get(id) && id == 41771983423143937ULL);
+  int64_t color;
+  CHECK(root["color"].get(color) && color == -16711936);
+  bool large;
+  CHECK(root["large"].get(large) && !large);
+  CHECK(root["icon"].isNull() && !root["missing"].valid());
+
+  // containers are skipped to reach the members after them
+  io::JsonView members = root["members"];
+  CHECK(members.isArray() && members.size() == 2);
+  CHECK(members.at(1)["user"]["id"].get(id) && id == 8);
+  CHECK(!members.at(2).valid());
+  CHECK(root["after"].get(name) && name == "end");
+  return 0;
+}
+
+int main() {
+  CHECK(io::CheckScanBackends());
+
+  // escapes and nested containers before the looked up members, padded
+  // so every part crosses a 64 byte block boundary at some point
+  for (std::size_t pad = 0; pad < 130; pad++) {
+    const std::string text = "{\"pad\":\"" + std::string(pad, ' ') +
+      "\",\"name\":\"G \\\"q\\\" \\\\ \\u00e9\",\"id\":\"41771983423143937\","
+      "\"color\":-16711936,\"large\":false,\"icon\":null,"
+      "\"members\":[{\"user\":{\"id\":\"7\",\"roles\":[[],{}]}},"
+      "{\"user\":{\"id\":\"8\"}}],\"after\":\"end\"}";
+    for (io::ScanBackend backend : Backends) {
+      if (io::SetScanBackend(backend) != backend) continue;
+      if (lookups(text) != 0) {
+        std::cerr << "backend " << (int)backend << " pad " << pad
+          << std::endl;
+        return 1;
+      }
+    }
+  }
+  io::SetScanBackend(io::ScanBackend::AUTO);
+  return 0;
+}
@@ -0,0 +1,13 @@
+#pragma once
+
+#include "io/io.hh"
+#include <iostream>
+
+// fail the test binary with the location of the first broken check
+#define CHECK(cond) do { \
+    if (!(cond)) { \
+      std::cerr << __FILE__ << ":" << __LINE__ << " failed: " #cond \
+        << std::endl; \
+      return 1; \
+    } \
+  } while (0)